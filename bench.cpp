@@ -0,0 +1,831 @@
+#include "WiPryClarity.h"
+#include "writer.h"
+#include "lineprotocol.h"
+#include "output.h"
+#include "gzip.h"
+#include "device.h"
+#include "kernels.h"
+#include "peaks.h"
+#include "timing.h"
+#include <atomic>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <new>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <thread>
+
+/*
+
+    wipry-bench
+
+    Measures the output pipeline without a WiPry attached: each stage on its
+    own, from pushing a sweep into the queue through serializing and writing
+    it out, and the whole pipeline end to end.  Built and run by `make
+    bench`; it does not link libWiPryClarity.
+
+    operator new is replaced to count allocations, and the run fails if the
+    pipeline allocates anything per sweep once it is running.  It also fails
+    if the kernels disagree with the scalar code, the ring drops a sweep
+    while the writer keeps up, or SweepClock misreads a made-up stream of
+    arrivals.
+
+    Besides the report on stdout the key numbers are written, one per line,
+    as
+
+        <metric>\t<value>\t<unit>
+
+    The stages are run several times and each metric keeps its best value,
+    which takes out most of the noise of a busy machine.  With a baseline in
+    the same format every metric is compared to it and the run fails if one
+    got worse by more than the threshold: higher for times and sizes, lower
+    for rates (units ending in /s).
+
+        wipry-bench [iterations] [--runs N] [--out FILE] [--baseline FILE] [--threshold PCT]
+
+*/
+
+
+// The numbers that are kept, in the order they were measured.
+class BenchResults {
+public:
+	// A metric measured again keeps the better of the two values.
+	void add(const std::string &metric, double value, const char *unit) {
+		std::map<std::string, double>::iterator known = values.find(metric);
+		if (known == values.end()) {
+			order.push_back(metric);
+			values[metric] = value;
+			units[metric] = unit;
+		}
+		else if (higherIsBetter(unit) ? value > known->second : value < known->second)
+			known->second = value;
+	}
+
+	bool write(const std::string &path) const {
+		std::ofstream out(path.c_str());
+		for (size_t m = 0; m < order.size(); m++)
+			out << order[m] << "\t" << values.at(order[m]) << "\t" << units.at(order[m]) << "\n";
+		return out.good();
+	}
+
+	// Returns false if a metric regressed by more than threshold, a fraction.
+	bool compare(const std::string &baselinePath, double threshold, std::ostream &out) const {
+		std::ifstream in(baselinePath.c_str());
+		if (!in) {
+			out << "baseline: unable to read " << baselinePath << std::endl;
+			return false;
+		}
+		bool ok = true;
+		unsigned int compared = 0;
+		std::string line;
+		out << "baseline: " << baselinePath << ", " << threshold * 100 << "% threshold" << std::endl;
+		while (std::getline(in, line)) {
+			std::istringstream fields(line);
+			std::string metric, unit;
+			double baseline;
+			if (!std::getline(fields, metric, '\t') || !(fields >> baseline >> unit))
+				continue;
+			std::map<std::string, double>::const_iterator current = values.find(metric);
+			if (current == values.end()) {
+				// a stage that was renamed or stopped reporting must not pass unseen
+				ok = false;
+				out << "  MISSING " << metric << ": in the baseline but not measured" << std::endl;
+				continue;
+			}
+			if (baseline <= 0)
+				continue;
+			double change = (current->second - baseline) / baseline;
+			bool regressed = higherIsBetter(unit) ? change < -threshold : change > threshold;
+			compared++;
+			if (regressed) {
+				ok = false;
+				out << "  REGRESSION " << metric << ": " << current->second << " " << unit << ", baseline " << baseline
+					<< " (" << (change > 0 ? "+" : "") << change * 100 << "%)" << std::endl;
+			}
+		}
+		out << "  " << compared << " metrics compared, " << (ok ? "no regressions" : "FAILED") << std::endl;
+		return ok;
+	}
+
+private:
+	static bool higherIsBetter(const std::string &unit) {
+		return unit.size() > 2 && unit.compare(unit.size() - 2, 2, "/s") == 0;
+	}
+
+	std::vector<std::string> order;
+	std::map<std::string, double> values;
+	std::map<std::string, std::string> units;
+};
+
+static BenchResults results;
+
+
+struct BenchBand {
+	const char *name;
+	oscium::WiPryClarity::DataType dataType;
+	char band;
+	float freqLow, freqHigh;
+	unsigned int points;
+};
+
+static BenchBand benchBands[] = {
+	{ "2.4GHz", oscium::WiPryClarity::DataType::RSSI_2_4GHZ, '2', 2400.0f, 2495.0f, 1000 },
+	{ "5GHz", oscium::WiPryClarity::DataType::RSSI_5GHZ, '5', 5150.0f, 5895.0f, 1000 },
+	{ "6E", oscium::WiPryClarity::DataType::RSSI_6E, '6', 5925.0f, 7125.0f, 1000 },
+};
+
+static const std::string benchSerial = "WPC0000000";
+
+
+// Every operator new of the process.
+static std::atomic<unsigned long long> allocations(0);
+
+// both out of line, or gcc sees malloc() and free() paired with new and
+// delete once they are inlined, and warns
+__attribute__((noinline))
+void *operator new(size_t size) {
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	void *p = malloc(size != 0 ? size : 1);
+	if (p == nullptr)
+		throw std::bad_alloc();
+	return p;
+}
+
+__attribute__((noinline))
+void operator delete(void *p) noexcept {
+	free(p);
+}
+
+
+static double nowSeconds() {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+static void fillFrame(RssiFrame &frame, const BenchBand &band, unsigned int seed) {
+	frame.dataType = band.dataType;
+	frame.count = band.points;
+	frame.timens = 1700000000000000000LL + seed;
+	for (unsigned int p = 0; p < frame.count; p++)
+		frame.points[p] = (int8_t)(-95 + (int)((p * 7 + seed * 13) % 60));
+}
+
+
+// The formatting main.cpp used before LineProtocolSerializer, kept as the reference.
+static void legacyFormat(std::ostream &out, const RssiFrame &frame, const BenchBand &band) {
+	float stepsize = ( (band.freqHigh - band.freqLow) / (int)frame.count );
+	out << "wipry,serial=" << benchSerial << ",band=" << band.band << " ";
+	for (int p=0; p < (int)frame.count; p++) {
+		if (p < ((int)frame.count - 1))
+			out << (band.freqLow + p * stepsize) << "=" <<(int)frame.points[p] << ",";
+		else
+			out << (band.freqLow + p * stepsize) << "=" <<(int)frame.points[p];
+	}
+	out << " " << frame.timens << std::endl;
+}
+
+
+static bool benchSerializer(int iterations) {
+	bool ok = true;
+	RssiFrame *frame = new RssiFrame;
+
+	std::cout << "serializer: iostream vs LineProtocolSerializer, " << iterations << " sweeps per band" << std::endl;
+	for (size_t b = 0; b < sizeof(benchBands) / sizeof(benchBands[0]); b++) {
+		const BenchBand &band = benchBands[b];
+
+		LineProtocolSerializer serializer;
+		serializer.setSerial(benchSerial);
+		serializer.setBoundary(band.dataType, band.freqLow, band.freqHigh);
+		LineBuffer buffer;
+
+		// byte-for-byte check first
+		for (unsigned int i = 0; i < 16; i++) {
+			fillFrame(*frame, band, i);
+			std::ostringstream legacy;
+			legacyFormat(legacy, *frame, band);
+			buffer.clear();
+			serializer.serialize(*frame, buffer);
+			if (legacy.str() != std::string(buffer.data(), buffer.size())) {
+				std::cout << "  " << band.name << ": OUTPUT MISMATCH" << std::endl;
+				ok = false;
+				break;
+			}
+		}
+
+		size_t bytes = 0;
+		std::ostringstream legacy;
+		double t0 = nowSeconds();
+		for (int i = 0; i < iterations; i++) {
+			fillFrame(*frame, band, i);
+			legacy.str(std::string());
+			legacyFormat(legacy, *frame, band);
+			bytes += legacy.tellp();
+		}
+		double legacySeconds = nowSeconds() - t0;
+
+		t0 = nowSeconds();
+		for (int i = 0; i < iterations; i++) {
+			fillFrame(*frame, band, i);
+			buffer.clear();
+			serializer.serialize(*frame, buffer);
+		}
+		double newSeconds = nowSeconds() - t0;
+
+		double points = (double)iterations * band.points;
+		results.add(std::string("serialize.") + band.name, newSeconds * 1e9 / iterations, "ns/sweep");
+		std::cout << "  " << band.name << ": " << band.points << " points, " << bytes / iterations << " bytes/sweep"
+			<< "  iostream " << legacySeconds * 1e9 / points << " ns/point"
+			<< "  serializer " << newSeconds * 1e9 / points << " ns/point"
+			<< "  speedup " << legacySeconds / newSeconds << "x" << std::endl;
+	}
+
+	delete frame;
+	return ok;
+}
+
+
+// Size and formatting cost of the three schemas for the same sweeps.
+static void benchSchemas(int iterations) {
+	RssiFrame *frame = new RssiFrame;
+	const BenchBand &band = benchBands[1];
+	const LineSchema schemas[3] = { LineSchema::Wide, LineSchema::Narrow, LineSchema::Packed };
+	const char *names[3] = { "wide", "narrow", "packed" };
+
+	std::cout << "schemas: " << band.name << ", " << band.points << " points, " << iterations << " sweeps" << std::endl;
+	size_t wideBytes = 0;
+	for (int s = 0; s < 3; s++) {
+		LineProtocolSerializer serializer;
+		serializer.setSerial(benchSerial);
+		serializer.setBoundary(band.dataType, band.freqLow, band.freqHigh);
+		serializer.setSchema(schemas[s]);
+		LineBuffer buffer;
+
+		size_t bytes = 0;
+		unsigned long long lines = 0;
+		double t0 = nowSeconds();
+		for (int i = 0; i < iterations; i++) {
+			fillFrame(*frame, band, i);
+			buffer.clear();
+			lines += serializer.serialize(*frame, buffer);
+			bytes += buffer.size();
+		}
+		double seconds = nowSeconds() - t0;
+		if (s == 0)
+			wideBytes = bytes;
+		results.add(std::string("schema.") + names[s], seconds * 1e9 / iterations, "ns/sweep");
+		results.add(std::string("schema.") + names[s] + ".bytes", (double)bytes / iterations, "bytes/sweep");
+
+		std::cout << "  " << names[s] << ": " << bytes / iterations << " bytes/sweep, " << lines / iterations << " lines/sweep, "
+			<< seconds * 1e9 / iterations << " ns/sweep, " << 100.0 * bytes / wideBytes << "% of wide" << std::endl;
+	}
+	delete frame;
+}
+
+
+// The peak detector has to keep up with every sweep of every band.
+static void benchPeaks(int iterations) {
+	RssiFrame *frame = new RssiFrame;
+	std::cout << "peaks: " << iterations << " sweeps per band, 10dB prominence" << std::endl;
+	for (size_t b = 0; b < sizeof(benchBands) / sizeof(benchBands[0]); b++) {
+		const BenchBand &band = benchBands[b];
+		PeakDetector detector(10, 3);
+		detector.setSerial(benchSerial);
+		detector.setBoundary(band.dataType, band.freqLow, band.freqHigh);
+		LineBuffer buffer;
+
+		double t0 = nowSeconds();
+		for (int i = 0; i < iterations; i++) {
+			fillFrame(*frame, band, i);
+			buffer.clear();
+			detector.add(*frame, buffer);
+		}
+		double seconds = nowSeconds() - t0;
+		results.add(std::string("peaks.") + band.name, seconds * 1e9 / iterations, "ns/sweep");
+		std::cout << "  " << band.name << ": " << seconds * 1e9 / iterations << " ns/sweep, "
+			<< detector.events() << " events" << std::endl;
+	}
+	delete frame;
+}
+
+
+// Times one kernel over a buffer of n values, returns ns per value.
+template<typename Kernel>
+static double timeKernel(int iterations, unsigned int n, Kernel kernel) {
+	double t0 = nowSeconds();
+	for (int i = 0; i < iterations; i++)
+		kernel();
+	return (nowSeconds() - t0) * 1e9 / ((double)iterations * n);
+}
+
+
+// The vector kernels against the scalar loops at the sizes the output path
+// sees: whole sweeps, a dual-band sweep, a full zoom window and one 20MHz
+// channel of a 5GHz sweep.
+static bool benchKernels(int iterations) {
+	bool ok = true;
+	const BenchBand &band = benchBands[1];
+	struct { const char *name; unsigned int n; } sizes[] = {
+		{ "sweep", band.points },
+		{ "dual sweep", 2 * band.points },
+		{ "zoom window", 255 },
+		{ "5GHz channel", (unsigned int)(20 / ((band.freqHigh - band.freqLow) / band.points)) },
+	};
+
+	std::vector<float> in(2 * band.points + 1);
+	for (size_t p = 0; p < in.size(); p++)
+		in[p] = -95.0f + (float)((p * 7) % 60) + 0.25f;
+	// out of int8 range and negative fractions, to check clamping and truncation
+	in[3] = -200.5f;
+	in[5] = 300.0f;
+	in[9] = -0.75f;
+	std::vector<int8_t> bytes(in.size()), bytesRef(in.size());
+
+	std::cout << "kernels: " << kernelName() << " vs scalar, " << iterations << " runs per size" << std::endl;
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		unsigned int n = sizes[s].n;
+
+		// same results first, on an odd start too
+		for (unsigned int start = 0; start < 2; start++) {
+			kernelQuantize8(&in[start], bytes.data(), n);
+			scalarQuantize8(&in[start], bytesRef.data(), n);
+			KernelStats stats, statsRef;
+			kernelStats(bytes.data(), n, -90.5f, -91.0f, stats);
+			scalarStats(bytes.data(), n, -90.5f, -91.0f, statsRef);
+			if (memcmp(bytes.data(), bytesRef.data(), n) != 0
+				|| stats.min != statsRef.min || stats.max != statsRef.max || stats.sum != statsRef.sum || stats.above != statsRef.above) {
+				std::cout << "  " << sizes[s].name << ": KERNEL MISMATCH" << std::endl;
+				ok = false;
+			}
+		}
+
+		KernelStats stats;
+		double quantScalar = timeKernel(iterations, n, [&] { scalarQuantize8(in.data(), bytes.data(), n); });
+		double quantKernel = timeKernel(iterations, n, [&] { kernelQuantize8(in.data(), bytes.data(), n); });
+		double statsScalar = timeKernel(iterations, n, [&] { scalarStats(bytes.data(), n, -90.0f, -91.0f, stats); });
+		double statsKernel = timeKernel(iterations, n, [&] { kernelStats(bytes.data(), n, -90.0f, -91.0f, stats); });
+		std::string metric = std::string("kernel.") + sizes[s].name;
+		for (size_t c = 0; c < metric.size(); c++)
+			if (metric[c] == ' ')
+				metric[c] = '_';
+		results.add(metric + ".quantize8", quantKernel, "ns/value");
+		results.add(metric + ".stats", statsKernel, "ns/value");
+		std::cout << "  " << sizes[s].name << " (" << n << "): ns/value scalar/" << kernelName()
+			<< "  quantize8 " << quantScalar << "/" << quantKernel
+			<< "  stats " << statsScalar << "/" << statsKernel << std::endl;
+	}
+	return ok;
+}
+
+
+// SweepClock against made-up arrivals: sweeps handed over in pairs, which
+// is what queueing in the library looks like, with and without sweeps
+// missing, and a steady stream with a long gap and then a short one.
+static bool checkTiming() {
+	bool ok = true;
+	const long long period = 666667;
+	std::cout << "timing: SweepClock on arrivals in pairs, " << period << " ns period" << std::endl;
+	for (int lose = 0; lose < 2; lose++) {
+		SweepClock clock;
+		SweepTime t;
+		unsigned long long missed = 0;
+		for (int k = 0; k < 3000; k++) {
+			if (lose && (k == 2000 || k == 2001))
+				continue;
+			// every even sweep is held back until the odd one after it is done
+			long long at = k % 2 == 0 ? (k + 1) * period : k * period + 18000;
+			t = clock.arrived(at, at);
+			missed += t.missed;
+		}
+		double error = std::abs((double)clock.periodNs() / period - 1);
+		bool good = error < 0.01 && missed == (lose ? 2 : 0) && t.sequence == 3000 && t.endns - t.startns == clock.periodNs();
+		std::cout << "  " << (lose ? "2 missing" : "none missing") << ": " << clock.periodNs() << " ns period, "
+			<< clock.gaps() << " gaps with " << missed << " missed" << (good ? "" : ", TIMING MISMATCH") << std::endl;
+		ok = ok && good;
+	}
+
+	SweepClock clock;
+	long long at = 0;
+	const long long slow = 100000000;
+	auto after = [&](long long ns) {
+		at += ns;
+		return clock.arrived(at, at).missed;
+	};
+	for (int k = 0; k < 40; k++)
+		after(slow);
+	unsigned int longGap = after(21 * slow);
+	for (int k = 0; k < 4; k++)
+		after(slow);
+	unsigned int shortGap = after(2 * slow);
+	bool good = longGap == 20 && shortGap == 1 && clock.periodNs() == slow;
+	std::cout << "  steady: 20 missing seen as " << longGap << ", then 1 as " << shortGap << ", "
+		<< clock.periodNs() << " ns period" << (good ? "" : ", TIMING MISMATCH") << std::endl;
+	return ok && good;
+}
+
+
+static void benchOutput(int iterations) {
+	const BenchBand &band = benchBands[1];
+	RssiFrame *frame = new RssiFrame;
+	LineProtocolSerializer serializer;
+	serializer.setSerial(benchSerial);
+	serializer.setBoundary(band.dataType, band.freqLow, band.freqHigh);
+
+	int fd = open("/dev/null", O_WRONLY);
+	if (fd < 0) {
+		delete frame;
+		return;
+	}
+
+	std::cout << "output: " << band.name << " sweeps to /dev/null, " << iterations << " sweeps" << std::endl;
+	const unsigned int batches[] = { 1, 16, 256 };
+	for (size_t b = 0; b < sizeof(batches) / sizeof(batches[0]); b++) {
+		BatchedOutput output(fd, batches[b], 1000);
+		double t0 = nowSeconds();
+		for (int i = 0; i < iterations; i++) {
+			fillFrame(*frame, band, i);
+			if (serializer.serialize(*frame, output.buffer()))
+				output.linesAdded(1);
+		}
+		output.flush();
+		double seconds = nowSeconds() - t0;
+		results.add("output.batch" + std::to_string(batches[b]), seconds * 1e9 / iterations, "ns/sweep");
+		std::cout << "  --batch-lines " << batches[b] << ": " << iterations / seconds << " sweeps/s  "
+			<< seconds * 1e9 / iterations << " ns/sweep" << std::endl;
+	}
+
+	close(fd);
+	delete frame;
+}
+
+
+// What the device callback costs: quantizing one sweep into a pooled frame,
+// while the writer thread drains the queue.
+// The device callback's side of the ring: pushes are timed in bursts of
+// half the ring, and between bursts the writer thread is let catch up, so
+// every push is an ordinary enqueue that may have to wake the writer, never
+// the overflow path.  A dropped sweep fails the run.
+static bool benchCapture(int iterations) {
+	const BenchBand &band = benchBands[1];
+	const unsigned int capacity = 64, burst = capacity / 2;
+	std::vector<float> sweep(band.points);
+	for (unsigned int p = 0; p < band.points; p++)
+		sweep[p] = -95.0f + (float)((p * 7) % 60) + 0.25f;
+
+	std::atomic<unsigned long long> handled(0);
+	FrameWriter writer(capacity, OverflowPolicy::DropOldest, [&](const RssiFrame &frame) { handled.fetch_add(1, std::memory_order_relaxed); });
+	writer.start();
+	// the writer thread is up and waiting before the first push
+	writer.sync();
+
+	double seconds = 0;
+	for (int i = 0; i < iterations; ) {
+		int end = i + (int)burst < iterations ? i + (int)burst : iterations;
+		double t0 = nowSeconds();
+		for (; i < end; i++)
+			writer.push(band.dataType, sweep, 1700000000000000000LL + i);
+		seconds += nowSeconds() - t0;
+		while (handled.load(std::memory_order_relaxed) < (unsigned long long)i)
+			std::this_thread::yield();
+	}
+	writer.stop();
+
+	unsigned long long dropped = writer.droppedFrames();
+	results.add("capture.push", seconds * 1e9 / iterations, "ns/sweep");
+	results.add("capture.dropped", (double)dropped, "sweeps");
+	std::cout << "capture: " << iterations << " " << band.name << " sweeps of " << band.points << " points into a "
+		<< capacity << "-frame ring, " << burst << " at a time" << std::endl;
+	std::cout << "  " << seconds * 1e9 / iterations << " ns/sweep, " << handled.load() << " handled, "
+		<< dropped << " dropped" << (dropped != 0 ? ", FAILED" : "") << std::endl;
+	return dropped == 0;
+}
+
+
+// Heap allocations per sweep once the pipeline runs: the callback filling a
+// pooled frame, the writer thread serializing it and writing it out.  Any at
+// all fail the run.
+static bool benchAllocations(int iterations) {
+	const BenchBand &band = benchBands[1];
+	std::vector<float> sweep(band.points);
+	for (unsigned int p = 0; p < band.points; p++)
+		sweep[p] = -95.0f + (float)((p * 7) % 60) + 0.25f;
+	int fd = open("/dev/null", O_WRONLY);
+	if (fd < 0)
+		return true;
+
+	LineProtocolSerializer serializer;
+	serializer.setSerial(benchSerial);
+	serializer.setBoundary(band.dataType, band.freqLow, band.freqHigh);
+	BatchedOutput output(fd, 64, 100);
+	FrameWriter writer(64, OverflowPolicy::DropOldest, [&](const RssiFrame &frame) {
+		if (serializer.serialize(frame, output.buffer()))
+			output.linesAdded(1);
+	});
+	writer.setIdleHandler([&] { output.poll(); }, 100);
+	writer.start();
+
+	// the first sweeps size the buffers
+	for (int i = 0; i < 1000; i++)
+		writer.push(band.dataType, sweep, 1700000000000000000LL + i);
+	writer.sync();
+	unsigned long long before = allocations.load();
+	for (int i = 0; i < iterations; i++)
+		writer.push(band.dataType, sweep, 1700000000000000000LL + i);
+	writer.sync();
+	unsigned long long counted = allocations.load() - before;
+	writer.stop();
+	output.flush();
+	close(fd);
+
+	// what a frame of the library's floats took before
+	size_t floatFrame = sizeof(RssiFrame) + WIPRY_MAX_POINTS * (sizeof(float) - sizeof(int8_t));
+	results.add("pipeline.allocations", (double)counted / iterations, "allocs/sweep");
+	results.add("frame.bytes", sizeof(RssiFrame), "bytes");
+	std::cout << "allocations: " << iterations << " " << band.name << " sweeps, " << counted << " allocations, "
+		<< (double)counted / iterations << "/sweep" << std::endl;
+	std::cout << "  frame " << sizeof(RssiFrame) << " bytes (" << floatFrame << " with float bins), "
+		<< writer.poolBytes() << " bytes pooled for the 64-frame ring" << std::endl;
+	if (counted != 0) {
+		std::cout << "  ALLOCATING PER SWEEP" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+
+// What --gzip costs and saves per level, on batches of 16 sweeps, each
+// ending on a sync flush as the outputs do.
+static void benchGzip(int iterations) {
+	if (iterations < 1)
+		iterations = 1;
+	const BenchBand &band = benchBands[1];
+	RssiFrame *frame = new RssiFrame;
+	LineProtocolSerializer serializer;
+	serializer.setSerial(benchSerial);
+	serializer.setBoundary(band.dataType, band.freqLow, band.freqHigh);
+	LineBuffer batch;
+
+	std::cout << "gzip: " << band.name << ", " << iterations << " sweeps in batches of 16" << std::endl;
+	const int levels[] = { 1, 6, 9 };
+	for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+		GzipStream gzip(levels[l]);
+		for (int i = 0; i < iterations; i++) {
+			fillFrame(*frame, band, i);
+			serializer.serialize(*frame, batch);
+			if (i % 16 == 15 || i + 1 == iterations) {
+				gzip.add(batch.data(), batch.size());
+				gzip.flush(i + 1 == iterations);
+				gzip.clear();
+				batch.clear();
+			}
+		}
+		std::string metric = "gzip.level" + std::to_string(levels[l]);
+		results.add(metric, gzip.cpuMsPerMiB(), "ms/MiB");
+		results.add(metric + ".bytes", (double)gzip.bytesOut() / iterations, "bytes/sweep");
+		std::cout << "  level " << levels[l] << ": " << gzip.ratio() << ":1, " << gzip.bytesOut() / iterations << " bytes/sweep, "
+			<< gzip.cpuMsPerMiB() << " ms CPU per MiB" << std::endl;
+	}
+	delete frame;
+}
+
+
+// Reads fd to the end, as the other side of a pipe or socket would.
+static void drain(int fd) {
+	char buf[65536];
+	while (true) {
+		ssize_t n = read(fd, buf, sizeof(buf));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+	}
+}
+
+
+// Output throughput of formatted sweeps to the kinds of descriptor stdout can be.
+static void benchSinks(int iterations) {
+	const BenchBand &band = benchBands[1];
+	RssiFrame *frame = new RssiFrame;
+	fillFrame(*frame, band, 0);
+	LineProtocolSerializer serializer;
+	serializer.setSerial(benchSerial);
+	serializer.setBoundary(band.dataType, band.freqLow, band.freqHigh);
+	LineBuffer line;
+	serializer.serialize(*frame, line);
+	delete frame;
+
+	std::cout << "sinks: " << iterations << " " << band.name << " sweeps, --batch-lines 256" << std::endl;
+	const char *names[3] = { "devnull", "pipe", "socket" };
+	for (int k = 0; k < 3; k++) {
+		int fds[2] = { -1, -1 };
+		if (k == 0)
+			fds[1] = open("/dev/null", O_WRONLY | O_CLOEXEC);
+		else if (k == 1 && pipe2(fds, O_CLOEXEC) != 0)
+			continue;
+		else if (k == 2 && socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0)
+			continue;
+		if (fds[1] < 0)
+			continue;
+
+		std::thread reader;
+		if (fds[0] >= 0)
+			reader = std::thread(drain, fds[0]);
+		double t0 = nowSeconds();
+		{
+			BatchedOutput output(fds[1], 256, 1000);
+			for (int i = 0; i < iterations; i++) {
+				output.buffer().append(line.data(), line.size());
+				output.linesAdded(1);
+			}
+			output.flush();
+		}
+		close(fds[1]);
+		if (reader.joinable())
+			reader.join();
+		double seconds = nowSeconds() - t0;
+		if (fds[0] >= 0)
+			close(fds[0]);
+
+		double mbs = (double)line.size() * iterations / seconds / (1 << 20);
+		results.add(std::string("sink.") + names[k], mbs, "MiB/s");
+		std::cout << "  " << names[k] << ": " << mbs << " MiB/s, " << iterations / seconds << " sweeps/s" << std::endl;
+	}
+}
+
+
+// Pushes every synthetic sweep into a FrameWriter, as main.cpp's delegate does.
+class BenchDelegate : public DeviceDelegate {
+public:
+	explicit BenchDelegate(FrameWriter *writer) : writer(writer) {}
+
+	void deviceDidReceiveRSSIData(Device *device, oscium::WiPryClarity::DataType dataType, const std::vector<float> &rssiData) {
+		long long timens = std::chrono::time_point_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now()).time_since_epoch().count();
+		writer->push(dataType, rssiData, timens);
+	}
+
+private:
+	FrameWriter *writer;
+};
+
+
+// Synthetic device -> ring -> writer thread -> serializer -> /dev/null, at increasing rates.
+static void benchPipeline(double seconds) {
+	int fd = open("/dev/null", O_WRONLY);
+	if (fd < 0)
+		return;
+
+	std::cout << "pipeline: synthetic 5GHz sweeps, 1000 points, " << seconds << " s per rate, 64-frame ring, drop-oldest" << std::endl;
+	const double rates[] = { 100, 1000, 5000, 20000, 0 };
+	for (size_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+		LineProtocolSerializer serializer;
+		BatchedOutput output(fd, 64, 100);
+		unsigned long long written = 0;
+		double busy = 0;
+
+		FrameWriter writer(64, OverflowPolicy::DropOldest, [&](const RssiFrame &frame) {
+			double t0 = nowSeconds();
+			if (serializer.serialize(frame, output.buffer()))
+				output.linesAdded(1);
+			busy += nowSeconds() - t0;
+			written++;
+		});
+		writer.setIdleHandler([&] { output.poll(); }, 100);
+
+		SyntheticConfig config;
+		config.sweepsPerSecond = rates[r];
+		config.serial = benchSerial;
+		SyntheticDevice device(config);
+		float low, high;
+		device.get5GHzBoundary(&low, &high);
+		serializer.setSerial(benchSerial);
+		serializer.setBoundary(oscium::WiPryClarity::DataType::RSSI_5GHZ, low, high);
+
+		BenchDelegate delegate(&writer);
+		device.setDelegate(&delegate);
+		writer.start();
+		device.startCommunication();
+		device.startRssiData(oscium::WiPryClarity::DataType::RSSI_5GHZ, 0, 0, 0);
+		std::this_thread::sleep_for(std::chrono::milliseconds((long long)(seconds * 1000)));
+		device.stopRssiData();
+		device.endCommunication();
+		writer.stop();
+		output.flush();
+
+		unsigned long long generated = device.framesSent();
+		if (rates[r] == 0)
+			results.add("pipeline.unpaced", written / seconds, "sweeps/s");
+		std::cout << "  ";
+		if (rates[r] > 0)
+			std::cout << rates[r] << " sweeps/s: ";
+		else
+			std::cout << "unpaced: ";
+		std::cout << generated / seconds << " generated/s, " << written / seconds << " written/s, "
+			<< (written > 0 ? busy * 1e9 / (written * 1000.0) : 0) << " ns/point, "
+			<< writer.droppedFrames() << " dropped" << std::endl;
+	}
+	close(fd);
+}
+
+
+static void usage() {
+	std::cerr << "Usage: wipry-bench [ITERATIONS] [--runs N] [--out FILE] [--baseline FILE [--threshold PERCENT]]" << std::endl;
+	std::cerr << std::endl;
+	std::cerr << "	ITERATIONS		Sweeps per stage, scaled up for the cheap ones (default 2000)" << std::endl;
+	std::cerr << "	--runs N		Runs of the single-threaded stages, each metric keeps its best (default 3)" << std::endl;
+	std::cerr << "	--out FILE		Write the metrics to FILE" << std::endl;
+	std::cerr << "	--baseline FILE		Fail if a metric of FILE got worse by more than the threshold, or is missing" << std::endl;
+	std::cerr << "	--threshold PERCENT	Allowed regression (default 15)" << std::endl;
+}
+
+
+// A whole, positive number; false for anything else.
+static bool parseCount(const char *s, int &value) {
+	char *end;
+	errno = 0;
+	long n = strtol(s, &end, 10);
+	if (end == s || *end != '\0' || errno != 0 || n <= 0 || n > 1000000000L)
+		return false;
+	value = (int)n;
+	return true;
+}
+
+
+int main(int argc, char *argv[]) {
+	int iterations = 2000;
+	int runs = 3;
+	std::string outPath, baselinePath;
+	double threshold = 0.15;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+			usage();
+			return 0;
+		}
+		else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+			outPath = argv[++i];
+		else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+			baselinePath = argv[++i];
+		else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+			if (!parseCount(argv[++i], runs)) {
+				std::cerr << "Invalid run count!" << std::endl;
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+			char *end;
+			const char *s = argv[++i];
+			threshold = strtod(s, &end) / 100;
+			if (end == s || *end != '\0' || !(threshold >= 0)) {
+				std::cerr << "Invalid threshold!" << std::endl;
+				return 1;
+			}
+		}
+		else if (argv[i][0] == '-' || !parseCount(argv[i], iterations)) {
+			std::cerr << "Invalid Argument Specified!" << std::endl;
+			usage();
+			return 1;
+		}
+	}
+
+	bool ok = benchSerializer(iterations);
+	benchSchemas(iterations);
+	benchPeaks(iterations);
+	ok = benchKernels(iterations * 50) && ok;
+	ok = checkTiming() && ok;
+	ok = benchCapture(iterations * 50) && ok;
+	ok = benchAllocations(iterations * 10) && ok;
+	benchOutput(iterations * 10);
+	benchGzip(iterations / 4);
+	benchSinks(iterations * 10);
+	benchPipeline(1.0);
+
+	// the single-threaded stages again for their best values, without the report
+	std::ostringstream discard;
+	std::streambuf *report = std::cout.rdbuf(discard.rdbuf());
+	for (int run = 1; run < runs; run++) {
+		benchSerializer(iterations);
+		benchSchemas(iterations);
+		benchPeaks(iterations);
+		benchKernels(iterations * 50);
+		benchCapture(iterations * 50);
+		benchOutput(iterations * 10);
+		benchGzip(iterations / 4);
+		benchSinks(iterations * 10);
+	}
+	std::cout.rdbuf(report);
+
+	if (!outPath.empty() && !results.write(outPath)) {
+		std::cout << "Unable to write " << outPath << std::endl;
+		ok = false;
+	}
+	if (!baselinePath.empty())
+		ok = results.compare(baselinePath, threshold, std::cout) && ok;
+
+	return ok ? 0 : 1;
+}
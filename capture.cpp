@@ -0,0 +1,205 @@
+#include "capture.h"
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+// In a delta payload this byte starts a run of unchanged bins, its length in the next byte.
+#define CAPTURE_RUN ((uint8_t)0x80)
+
+
+void captureHeaderInit(CaptureHeader &header, unsigned int band, CaptureEncoding encoding, const std::string &serial) {
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CAPTURE_MAGIC, 8);
+	header.version = CAPTURE_VERSION;
+	header.headerBytes = sizeof(CaptureHeader);
+	header.band = band <= 255 ? (uint8_t)band : 0;
+	header.encoding = (uint8_t)encoding;
+	strncpy(header.serial, serial.c_str(), sizeof(header.serial) - 1);
+}
+
+
+bool isCaptureFile(const std::string &path) {
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	char magic[8];
+	bool result = read(fd, magic, sizeof(magic)) == sizeof(magic) && memcmp(magic, CAPTURE_MAGIC, 8) == 0;
+	::close(fd);
+	return result;
+}
+
+
+CaptureWriter::CaptureWriter(Sink *sink, CaptureEncoding encoding)
+	: sink(sink), encoding(encoding), frameCount(0), byteCount(0) {
+}
+
+
+void CaptureWriter::writeHeader(const CaptureHeader &header) {
+	sink->buffer().append((const char *)&header, sizeof(header));
+	sink->linesAdded(1);
+	byteCount += sizeof(header);
+}
+
+
+void CaptureWriter::write(const RssiFrame &frame) {
+	unsigned int count = frame.count;
+	const int8_t *bins = frame.points;
+
+	std::vector<int8_t> &prev = previous[(int)frame.dataType & 3];
+	LineBuffer &out = sink->buffer();
+
+	CaptureFrameHeader header;
+	header.timens = frame.timens;
+	header.dataType = (uint8_t)frame.dataType;
+	header.flags = 0;
+	header.count = (uint16_t)count;
+	header.bytes = count;
+
+	// leave room for the header, fill in the payload, then decide which form to keep
+	char *start = out.reserve(sizeof(header) + count);
+	uint8_t *payload = (uint8_t *)start + sizeof(header);
+	size_t used = 0;
+
+	if (encoding == CaptureDelta && prev.size() == count) {
+		bool ok = true;
+		for (unsigned int p = 0; p < count && ok; p++) {
+			int d = bins[p] - prev[p];
+			if (d == 0) {
+				unsigned int run = 1;
+				while (p + run < count && run < 255 && bins[p + run] == prev[p + run])
+					run++;
+				if (run > 1) {
+					if (used + 2 >= count) {
+						ok = false;
+						break;
+					}
+					payload[used++] = CAPTURE_RUN;
+					payload[used++] = (uint8_t)run;
+					p += run - 1;
+					continue;
+				}
+			}
+			if (d < -127 || d > 127 || used + 1 >= count) {
+				ok = false;
+				break;
+			}
+			payload[used++] = (uint8_t)(int8_t)d;
+		}
+		if (ok) {
+			header.flags = CAPTURE_FRAME_DELTA;
+			header.bytes = (uint32_t)used;
+		}
+	}
+	if (header.flags == 0)
+		memcpy(payload, bins, count);
+
+	memcpy(start, &header, sizeof(header));
+	out.commit(sizeof(header) + header.bytes);
+	sink->linesAdded(1);
+
+	prev.assign(bins, bins + count);
+	frameCount++;
+	byteCount += sizeof(header) + header.bytes;
+}
+
+
+CaptureReader::CaptureReader() : map(nullptr), size(0), offset(0) {
+	memset(&fileHeader, 0, sizeof(fileHeader));
+}
+
+
+CaptureReader::~CaptureReader() {
+	close();
+}
+
+
+bool CaptureReader::open(const std::string &path) {
+	close();
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CaptureHeader)) {
+		::close(fd);
+		return false;
+	}
+	void *m = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (m == MAP_FAILED)
+		return false;
+	madvise(m, st.st_size, MADV_SEQUENTIAL);
+
+	map = (const uint8_t *)m;
+	size = st.st_size;
+	memcpy(&fileHeader, map, sizeof(fileHeader));
+	if (memcmp(fileHeader.magic, CAPTURE_MAGIC, 8) != 0 || fileHeader.version != CAPTURE_VERSION
+		|| fileHeader.headerBytes < sizeof(CaptureHeader) || fileHeader.headerBytes > size) {
+		close();
+		return false;
+	}
+	rewind();
+	return true;
+}
+
+
+void CaptureReader::close() {
+	if (map != nullptr)
+		munmap((void *)map, size);
+	map = nullptr;
+	size = 0;
+	offset = 0;
+}
+
+
+void CaptureReader::rewind() {
+	offset = fileHeader.headerBytes;
+	for (int i = 0; i < 4; i++)
+		previous[i].clear();
+}
+
+
+bool CaptureReader::next(RssiFrame &frame) {
+	if (map == nullptr || offset + sizeof(CaptureFrameHeader) > size)
+		return false;
+	CaptureFrameHeader header;
+	memcpy(&header, map + offset, sizeof(header));
+	if (header.count > WIPRY_MAX_POINTS || header.dataType > 3 || offset + sizeof(header) + header.bytes > size)
+		return false;
+
+	const uint8_t *payload = map + offset + sizeof(header);
+	std::vector<int8_t> &prev = previous[header.dataType];
+
+	if (header.flags & CAPTURE_FRAME_DELTA) {
+		if (prev.size() != header.count)
+			return false;
+		unsigned int p = 0;
+		for (uint32_t i = 0; i < header.bytes && p < header.count; i++) {
+			if (payload[i] == CAPTURE_RUN && i + 1 < header.bytes) {
+				p += payload[++i];
+				continue;
+			}
+			prev[p] = (int8_t)(prev[p] + (int8_t)payload[i]);
+			p++;
+		}
+		if (p != header.count)
+			return false;
+	}
+	else {
+		if (header.bytes != header.count)
+			return false;
+		prev.assign((const int8_t *)payload, (const int8_t *)payload + header.count);
+	}
+
+	frame.timens = header.timens;
+	frame.startns = header.timens;
+	frame.sequence = 0;
+	frame.dataType = (oscium::WiPryClarity::DataType)header.dataType;
+	frame.count = header.count;
+	memcpy(frame.points, prev.data(), header.count);
+
+	offset += sizeof(header) + header.bytes;
+	return true;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include "WiPryClarity.h"
+#include "writer.h"
+#include "sink.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*
+
+    Capture files
+
+    Compact, append-only binary recording of sweeps, about a tenth of the
+    size of the same sweeps as line protocol.  Little-endian throughout.
+
+        CaptureHeader
+        { CaptureFrameHeader, payload } ...
+
+    Each bin is the RSSI truncated to an int8, exactly as the line protocol
+    output truncates it to an int, so converting a capture gives the same
+    lines a live run would have printed.  With delta encoding a frame holds
+    the difference to the previous frame of the same data type, with runs
+    of unchanged bins collapsed; frames that do not get smaller that way, and
+    the first frame of each type, are stored raw.
+
+    A frame cut short by a crash ends the file for readers, everything
+    before it is intact.
+
+*/
+
+
+#define CAPTURE_MAGIC "WIPRYCAP"
+#define CAPTURE_VERSION 1
+
+enum CaptureEncoding {
+	CaptureRaw = 0,
+	CaptureDelta = 1
+};
+
+// CaptureFrameHeader flags
+#define CAPTURE_FRAME_DELTA 1
+
+
+struct CaptureHeader {
+	char magic[8];
+	uint16_t version;
+	uint16_t headerBytes;
+	uint8_t band;			// as on the command line: 2, 5, 6, 25, or 0 for -T
+	uint8_t encoding;		// CaptureEncoding
+	uint8_t reserved0[2];
+	char serial[32];		// NUL padded
+	float freqLow[3];		// 2.4GHz, 5GHz, 6E boundaries in MHz, 0 if unknown
+	float freqHigh[3];
+	float evenMin, evenMax, evenNoiseFloor;
+	float oddMin, oddMax, oddNoiseFloor;
+	uint32_t dualSplit;		// --dual-split, 0 for automatic
+	uint16_t zoomStart;		// valid bins of the band's sweeps, zoomWidth 0 for all
+	uint16_t zoomWidth;
+	uint32_t reserved1[2];
+};
+
+struct CaptureFrameHeader {
+	int64_t timens;
+	uint8_t dataType;		// oscium::WiPryClarity::DataType
+	uint8_t flags;
+	uint16_t count;			// bins in the sweep
+	uint32_t bytes;			// payload bytes that follow
+};
+
+
+// Encodes frames into a Sink, normally a BatchedOutput on the capture file.
+class CaptureWriter {
+public:
+	CaptureWriter(Sink *sink, CaptureEncoding encoding);
+
+	// Writes the file header.  Only for a new, empty file.
+	void writeHeader(const CaptureHeader &header);
+
+	void write(const RssiFrame &frame);
+
+	unsigned long long frames() const { return frameCount; }
+	unsigned long long bytes() const { return byteCount; }
+
+private:
+	Sink *sink;
+	CaptureEncoding encoding;
+	std::vector<int8_t> previous[4];	// last frame per data type
+	unsigned long long frameCount;
+	unsigned long long byteCount;
+};
+
+
+// Maps a capture file and decodes its frames in order.
+class CaptureReader {
+public:
+	CaptureReader();
+	~CaptureReader();
+
+	bool open(const std::string &path);
+	void close();
+
+	const CaptureHeader &header() const { return fileHeader; }
+
+	// Decodes the next frame into frame.  Returns false at the end of the file
+	// or at a truncated or corrupt frame.
+	bool next(RssiFrame &frame);
+
+	// Back to the first frame.
+	void rewind();
+
+	// File offset just past the last frame returned by next().
+	size_t position() const { return offset; }
+	size_t fileSize() const { return size; }
+
+private:
+	const uint8_t *map;
+	size_t size;
+	size_t offset;
+	CaptureHeader fileHeader;
+	std::vector<int8_t> previous[4];
+};
+
+
+// Fills in a header for a live session.
+void captureHeaderInit(CaptureHeader &header, unsigned int band, CaptureEncoding encoding, const std::string &serial);
+
+// True if path starts with the capture magic.
+bool isCaptureFile(const std::string &path);
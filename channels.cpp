@@ -0,0 +1,245 @@
+#include "channels.h"
+#include "zoom.h"
+#include "kernels.h"
+#include <cmath>
+
+
+// Appends v with one decimal.
+static char *formatFixed1(char *p, double v) {
+	long long tenths = llround(v * 10);
+	if (tenths < 0) {
+		*p++ = '-';
+		tenths = -tenths;
+	}
+	p = formatInt(p, tenths / 10);
+	*p++ = '.';
+	*p++ = (char)('0' + tenths % 10);
+	return p;
+}
+
+
+ChannelAggregator::ChannelAggregator(unsigned int windowMs)
+	: windowNs((long long)windowMs * 1000000), evenNoiseFloor(-95), oddNoiseFloor(-95), pscOnly(false), dualSplit(0) {
+	const unsigned int numbers[3] = { 2, 5, 6 };
+	for (int i = 0; i < 3; i++) {
+		bands[i].number = numbers[i];
+		bands[i].valid = false;
+		bands[i].freqLow = 0;
+		bands[i].freqHigh = 0;
+		bands[i].windowFirst = 0;
+		bands[i].windowWidth = 0;
+		bands[i].count = 0;
+		bands[i].windowStart = -1;
+		bands[i].lastTimens = 0;
+	}
+}
+
+
+void ChannelAggregator::setSerial(const std::string &aSerial) {
+	serial = aSerial;
+	for (int i = 0; i < 3; i++)
+		bands[i].count = 0;
+}
+
+
+void ChannelAggregator::setBoundary(oscium::WiPryClarity::DataType dataType, float freqLow, float freqHigh) {
+	Band *band = bandFor(dataType);
+	if (band == nullptr)
+		return;
+	band->valid = true;
+	band->freqLow = freqLow;
+	band->freqHigh = freqHigh;
+	band->count = 0;
+}
+
+
+void ChannelAggregator::setNoiseFloor(float even, float odd) {
+	evenNoiseFloor = even;
+	oddNoiseFloor = odd;
+}
+
+
+void ChannelAggregator::setPscOnly(bool aPscOnly) {
+	pscOnly = aPscOnly;
+	bands[2].count = 0;
+}
+
+
+void ChannelAggregator::setWindow(oscium::WiPryClarity::DataType dataType, unsigned int first, unsigned int width) {
+	Band *band = bandFor(dataType);
+	if (band == nullptr)
+		return;
+	band->windowFirst = first;
+	band->windowWidth = width;
+	band->count = 0;
+}
+
+
+void ChannelAggregator::setDualSplit(unsigned int points) {
+	dualSplit = points;
+}
+
+
+ChannelAggregator::Band *ChannelAggregator::bandFor(oscium::WiPryClarity::DataType dataType) {
+	switch (dataType)
+	{
+		case oscium::WiPryClarity::DataType::RSSI_2_4GHZ:
+			return &bands[0];
+		case oscium::WiPryClarity::DataType::RSSI_5GHZ:
+			return &bands[1];
+		case oscium::WiPryClarity::DataType::RSSI_6E:
+			return &bands[2];
+		default:
+			return nullptr;
+	}
+}
+
+
+void ChannelAggregator::buildChannels(Band &band, unsigned int count) {
+	band.channels.clear();
+	band.count = count;
+	band.windowStart = -1;
+
+	unsigned int firstNumber, lastNumber, stride;
+	switch (band.number) {
+		case 2:
+			firstNumber = 1, lastNumber = 14, stride = 1;
+			break;
+		case 5:
+			firstNumber = 36, lastNumber = 177, stride = 1;
+			break;
+		default:
+			firstNumber = pscOnly ? 5 : 1, lastNumber = 233, stride = pscOnly ? 16 : 4;
+			break;
+	}
+
+	// valid bins, all of them unless zoomed
+	unsigned int validFirst = 0, validEnd = count;
+	if (band.windowWidth != 0) {
+		validFirst = band.windowFirst < count ? band.windowFirst : count;
+		validEnd = band.windowFirst + band.windowWidth < count ? band.windowFirst + band.windowWidth : count;
+	}
+
+	float step = (band.freqHigh - band.freqLow) / (int)count;
+	for (unsigned int number = firstNumber; number <= lastNumber; number += stride) {
+		// 20MHz channels at 5GHz are every fourth number, 36, 40, ... 64, 100, ... 144, 149, ... 177
+		if (band.number == 5 && (number < 149 ? number % 4 != 0 || (number > 64 && number < 100) : (number - 149) % 4 != 0))
+			continue;
+		float center = channelCenter(band.number, number);
+		if (center == 0 || center < band.freqLow || center > band.freqHigh)
+			continue;
+
+		// bin p covers freqLow + p * step onwards, as in the line protocol keys
+		long first = (long)ceil((center - 10 - band.freqLow) / step);
+		long end = (long)ceil((center + 10 - band.freqLow) / step);
+		if (first < (long)validFirst)
+			first = validFirst;
+		if (end > (long)validEnd)
+			end = validEnd;
+		if (end <= first)
+			continue;
+
+		Channel channel;
+		channel.first = first;
+		channel.end = end;
+		channel.prefix = "wipry_channel,serial=" + serial + ",band=" + std::to_string(band.number)
+			+ ",channel=" + std::to_string(number) + " max=";
+		channel.max = -1000;
+		channel.sum = 0;
+		channel.bins = 0;
+		channel.above = 0;
+		band.channels.push_back(channel);
+	}
+}
+
+
+unsigned int ChannelAggregator::accumulate(Band &band, const int8_t *points, unsigned int count, long long timens, LineBuffer &out) {
+	if (!band.valid)
+		return 0;
+	if (band.count != count)
+		buildChannels(band, count);
+
+	unsigned int lines = 0;
+	if (band.windowStart >= 0 && timens - band.windowStart >= windowNs)
+		lines = writeWindow(band, out);
+	if (band.windowStart < 0)
+		band.windowStart = timens;
+	band.lastTimens = timens;
+
+	for (size_t c = 0; c < band.channels.size(); c++) {
+		Channel &channel = band.channels[c];
+		KernelStats stats;
+		// the floors follow the parity of the bin index, not of the position in the range
+		if (channel.first & 1)
+			kernelStats(points + channel.first, channel.end - channel.first, oddNoiseFloor, evenNoiseFloor, stats);
+		else
+			kernelStats(points + channel.first, channel.end - channel.first, evenNoiseFloor, oddNoiseFloor, stats);
+		if (stats.max > channel.max)
+			channel.max = stats.max;
+		channel.sum += stats.sum;
+		channel.bins += channel.end - channel.first;
+		channel.above += stats.above;
+	}
+
+	if (windowNs == 0)
+		lines += writeWindow(band, out);
+	return lines;
+}
+
+
+unsigned int ChannelAggregator::writeWindow(Band &band, LineBuffer &out) {
+	if (band.windowStart < 0)
+		return 0;
+	unsigned int lines = 0;
+	for (size_t c = 0; c < band.channels.size(); c++) {
+		Channel &channel = band.channels[c];
+		if (channel.bins == 0)
+			continue;
+		char *start = out.reserve(channel.prefix.size() + 96);
+		char *p = start;
+		memcpy(p, channel.prefix.data(), channel.prefix.size());
+		p += channel.prefix.size();
+		p = formatInt(p, (int)channel.max);
+		memcpy(p, ",mean=", 6);
+		p = formatFixed1(p + 6, channel.sum / channel.bins);
+		memcpy(p, ",duty=", 6);
+		p = formatFixed1(p + 6, 100.0 * channel.above / channel.bins);
+		*p++ = ' ';
+		p = formatInt(p, band.lastTimens);
+		*p++ = '\n';
+		out.commit(p - start);
+		lines++;
+
+		channel.max = -1000;
+		channel.sum = 0;
+		channel.bins = 0;
+		channel.above = 0;
+	}
+	band.windowStart = -1;
+	return lines;
+}
+
+
+unsigned int ChannelAggregator::add(const RssiFrame &frame, LineBuffer &out) {
+	if (frame.count == 0)
+		return 0;
+	if (frame.dataType == oscium::WiPryClarity::DataType::RSSI_DUAL25) {
+		unsigned int split = dualSplit != 0 ? dualSplit : frame.count / 2;
+		if (split >= frame.count)
+			return 0;
+		return accumulate(bands[0], frame.points, split, frame.timens, out)
+			+ accumulate(bands[1], frame.points + split, frame.count - split, frame.timens, out);
+	}
+	Band *band = bandFor(frame.dataType);
+	if (band == nullptr)
+		return 0;
+	return accumulate(*band, frame.points, frame.count, frame.timens, out);
+}
+
+
+unsigned int ChannelAggregator::flush(LineBuffer &out) {
+	unsigned int lines = 0;
+	for (int i = 0; i < 3; i++)
+		lines += writeWindow(bands[i], out);
+	return lines;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "WiPryClarity.h"
+#include "writer.h"
+#include "lineprotocol.h"
+#include <string>
+#include <vector>
+
+/*
+
+    ChannelAggregator
+
+    Reduces sweeps to per-802.11-channel statistics instead of one field per
+    bin.  Over each window it writes one line per 20MHz channel:
+
+        wipry_channel,serial=<serial>,band=<2|5|6>,channel=<n> max=<dBm>,mean=<dBm>,duty=<%> <timens>\n
+
+    max and mean are taken over every bin of the channel in every sweep of
+    the window, duty is the share of those bins above the noise floor (the
+    even limit for even bins, the odd limit for odd bins).  The timestamp is
+    that of the last sweep in the window.
+
+    Channels are 1-14 at 2.4GHz, 36-177 at 5GHz and all of 1-233 or only the
+    preferred scanning channels in 6E, limited to those whose center lies
+    within the band boundary.  Bins are mapped to channels once per band and
+    sweep size, the same way the line protocol keys are.
+
+*/
+
+
+class ChannelAggregator {
+public:
+	// windowMs 0 writes the statistics of every sweep on its own.
+	explicit ChannelAggregator(unsigned int windowMs);
+
+	void setSerial(const std::string &serial);
+	void setBoundary(oscium::WiPryClarity::DataType dataType, float freqLow, float freqHigh);
+	void setNoiseFloor(float even, float odd);
+
+	// Only the preferred scanning channels (5, 21, 37, ...) in 6E.
+	void setPscOnly(bool pscOnly);
+
+	// As LineProtocolSerializer::setWindow and setDualSplit.
+	void setWindow(oscium::WiPryClarity::DataType dataType, unsigned int first, unsigned int width);
+	void setDualSplit(unsigned int points);
+
+	// Accounts for frame and appends the lines of any window it completes.
+	// Returns the number of lines appended.
+	unsigned int add(const RssiFrame &frame, LineBuffer &out);
+
+	// Appends the lines of every window still open.
+	unsigned int flush(LineBuffer &out);
+
+private:
+	struct Channel {
+		unsigned int first, end;	// bins
+		std::string prefix;		// "wipry_channel,...,channel=N max="
+		float max;
+		double sum;
+		unsigned int bins;
+		unsigned int above;
+	};
+
+	struct Band {
+		unsigned int number;		// 2, 5 or 6
+		bool valid;
+		float freqLow, freqHigh;
+		unsigned int windowFirst, windowWidth;
+		unsigned int count;		// sweep size the channel map is for
+		std::vector<Channel> channels;
+		long long windowStart;		// timens of the first sweep, -1 while empty
+		long long lastTimens;
+	};
+
+	Band *bandFor(oscium::WiPryClarity::DataType dataType);
+	void buildChannels(Band &band, unsigned int count);
+	unsigned int accumulate(Band &band, const int8_t *points, unsigned int count, long long timens, LineBuffer &out);
+	unsigned int writeWindow(Band &band, LineBuffer &out);
+
+	long long windowNs;
+	std::string serial;
+	float evenNoiseFloor, oddNoiseFloor;
+	bool pscOnly;
+	unsigned int dualSplit;
+	Band bands[3];
+};
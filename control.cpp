@@ -0,0 +1,244 @@
+#include "control.h"
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+// How often the server thread looks at running while nobody talks to it.
+#define CONTROL_POLL_MS 200
+// A command longer than this is cut off.
+#define CONTROL_MAX_LINE 4096
+
+
+unsigned int parseBand(const std::string &name) {
+	if (name == "2")
+		return 2;
+	if (name == "5")
+		return 5;
+	if (name == "6")
+		return 6;
+	if (name == "D")
+		return 25;
+	if (name == "T")
+		return 256;
+	return 0;
+}
+
+
+const char *bandName(unsigned int band) {
+	switch (band) {
+		case 2:
+			return "2";
+		case 5:
+			return "5";
+		case 6:
+			return "6";
+		case 25:
+			return "D";
+		default:
+			return "T";
+	}
+}
+
+
+bool loadRuntimeConfig(const std::string &path, RuntimeConfig &config) {
+	std::ifstream in(path.c_str());
+	if (!in) {
+		std::cerr << "Unable to read " << path << ": " << strerror(errno) << std::endl;
+		return false;
+	}
+
+	RuntimeConfig read;
+	std::string line;
+	for (unsigned int number = 1; std::getline(in, line); number++) {
+		size_t hash = line.find('#');
+		if (hash != std::string::npos)
+			line.erase(hash);
+		size_t first = line.find_first_not_of(" \t\r");
+		if (first == std::string::npos)
+			continue;
+		size_t last = line.find_last_not_of(" \t\r");
+		line = line.substr(first, last + 1 - first);
+
+		size_t space = line.find_first_of(" \t");
+		std::string key = line.substr(0, space);
+		std::string value = space != std::string::npos ? line.substr(line.find_first_not_of(" \t", space)) : std::string();
+
+		bool valid = !value.empty();
+		if (!valid)
+			;
+		else if (key == "band")
+			valid = (read.band = parseBand(value)) != 0;
+		else if (key == "zoom")
+			read.zoom = value;
+		else if (key == "schema")
+			valid = read.hasSchema = parseLineSchema(value, read.schema);
+		else if (key == "sink")
+			read.sinks.push_back(value);
+		else
+			valid = false;
+		if (!valid) {
+			std::cerr << path << ":" << number << ": invalid setting!" << std::endl;
+			return false;
+		}
+	}
+	config = read;
+	return true;
+}
+
+
+ControlServer::ControlServer(const std::string &path, EventLoop *events)
+	: path(path), events(events), fd(-1), running(false), waiting(false) {
+}
+
+
+ControlServer::~ControlServer() {
+	stop();
+}
+
+
+bool ControlServer::start() {
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(addr.sun_path)) {
+		std::cerr << "Control socket path is too long!" << std::endl;
+		return false;
+	}
+	strcpy(addr.sun_path, path.c_str());
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return false;
+	unlink(path.c_str());
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 4) != 0) {
+		std::cerr << "Unable to listen on " << path << ": " << strerror(errno) << std::endl;
+		close(fd);
+		fd = -1;
+		return false;
+	}
+	// whoever can connect can reconfigure, keep it to this user
+	chmod(path.c_str(), 0600);
+	running = true;
+	thread = std::thread(&ControlServer::threadMain, this);
+	return true;
+}
+
+
+void ControlServer::stop() {
+	if (!running.exchange(false))
+		return;
+	answered.notify_all();
+	if (thread.joinable())
+		thread.join();
+	close(fd);
+	fd = -1;
+	unlink(path.c_str());
+}
+
+
+void ControlServer::serve(const Handler &handler) {
+	std::unique_lock<std::mutex> lock(mtx);
+	if (!waiting)
+		return;
+	std::string line = command;
+	lock.unlock();
+
+	std::string answer = handler(line);
+
+	lock.lock();
+	reply = answer;
+	waiting = false;
+	lock.unlock();
+	answered.notify_all();
+}
+
+
+void ControlServer::threadMain() {
+	while (running) {
+		struct pollfd p;
+		p.fd = fd;
+		p.events = POLLIN;
+		if (poll(&p, 1, CONTROL_POLL_MS) <= 0)
+			continue;
+		int client = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+		if (client < 0)
+			continue;
+		converse(client);
+		close(client);
+	}
+}
+
+
+// One command per line until the client hangs up.
+void ControlServer::converse(int client) {
+	struct timeval tv;
+	tv.tv_sec = 1;
+	tv.tv_usec = 0;
+	setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	std::string pending;
+	char buf[1024];
+	while (running) {
+		size_t newline = pending.find('\n');
+		if (newline == std::string::npos) {
+			struct pollfd p;
+			p.fd = client;
+			p.events = POLLIN;
+			if (poll(&p, 1, CONTROL_POLL_MS) <= 0)
+				continue;
+			ssize_t n = recv(client, buf, sizeof(buf), 0);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				return;
+			pending.append(buf, n);
+			if (pending.size() > CONTROL_MAX_LINE && pending.find('\n') == std::string::npos)
+				pending.resize(CONTROL_MAX_LINE);
+			continue;
+		}
+
+		std::string line = pending.substr(0, newline);
+		pending.erase(0, newline + 1);
+		if (!line.empty() && line[line.size() - 1] == '\r')
+			line.erase(line.size() - 1);
+		if (line.empty())
+			continue;
+
+		std::unique_lock<std::mutex> lock(mtx);
+		command = line;
+		waiting = true;
+		events->notify();
+		// a wakeup can be swallowed while the main thread waits for something
+		// else, such as the first sweep of a band, so keep knocking
+		while (waiting && running) {
+			if (answered.wait_for(lock, std::chrono::milliseconds(CONTROL_POLL_MS)) == std::cv_status::timeout)
+				events->notify();
+		}
+		if (waiting) {
+			waiting = false;
+			return;
+		}
+		std::string answer = reply + "\n";
+		lock.unlock();
+
+		const char *p = answer.data();
+		size_t left = answer.size();
+		while (left > 0) {
+			ssize_t sent = send(client, p, left, MSG_NOSIGNAL);
+			if (sent < 0 && errno == EINTR)
+				continue;
+			if (sent <= 0)
+				return;
+			p += sent;
+			left -= sent;
+		}
+	}
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "events.h"
+#include "lineprotocol.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+
+    Control
+
+    Changing what wipry-lp does without restarting it, and so without
+    connecting to the WiPry again.  The settings that can change at runtime
+    come from a config file, read at startup and again on SIGHUP, or as
+    commands on a local Unix socket:
+
+        band 2|5|6|D|T					switches band, dropping the zoom
+        zoom LOW-HIGH|channels C,C...|off	zooms the band being streamed
+        schema wide|narrow|packed
+        sink add SPEC					as --sink
+        sink remove NAME				SPEC without its options
+        reload							reads the config file again
+        status
+
+    Every command is answered with one line, "ok" and maybe more, or
+    "error: " and why.  The config file takes the same settings, one per
+    line, with # comments:
+
+        band 5
+        zoom 5170-5250
+        schema packed
+        sink file:/var/log/wipry.lp,max-mb=50
+
+    ControlServer only carries commands to the main thread and answers
+    back, main() does the work between two waits of its EventLoop.
+
+*/
+
+
+struct RuntimeConfig {
+	unsigned int band;					// 0 if not given
+	std::string zoom;					// "LOW-HIGH", "channels C,C...", "off", or empty if not given
+	bool hasSchema;
+	LineSchema schema;
+	std::vector<std::string> sinks;
+
+	RuntimeConfig() : band(0), hasSchema(false), schema(LineSchema::Wide) {}
+};
+
+
+// 2, 5, 6, 25 or 256 for "2", "5", "6", "D" or "T", as the band options; 0 for anything else.
+unsigned int parseBand(const std::string &name);
+
+// The other way round.
+const char *bandName(unsigned int band);
+
+// Reads a config file.  False, with the reason logged, if it can not be read
+// or has a line it does not understand.
+bool loadRuntimeConfig(const std::string &path, RuntimeConfig &config);
+
+
+class ControlServer {
+public:
+	// Runs one command on the main thread and returns the reply, without the newline.
+	typedef std::function<std::string(const std::string &)> Handler;
+
+	ControlServer(const std::string &path, EventLoop *events);
+	~ControlServer();
+
+	// Listens on path, replacing a socket left behind.
+	bool start();
+	void stop();
+
+	// Main thread, after every wakeup: runs the command waiting, if there is one.
+	void serve(const Handler &handler);
+
+private:
+	void threadMain();
+	void converse(int client);
+
+	std::string path;
+	EventLoop *events;
+	int fd;
+	std::atomic<bool> running;
+	std::thread thread;
+
+	std::mutex mtx;
+	std::condition_variable answered;
+	bool waiting;				// command holds a command for serve()
+	std::string command;
+	std::string reply;
+};
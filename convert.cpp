@@ -0,0 +1,211 @@
+#include "capture.h"
+#include "lineprotocol.h"
+#include "output.h"
+#include "influx.h"
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+
+/*
+
+    wipry-convert
+
+    Turns capture files written by wipry-lp --record into line protocol on
+    stdout, or sends them straight to InfluxDB.  The files are mapped and
+    decoded in place, so this runs as fast as the serializer and the output
+    allow.
+
+*/
+
+
+static void helptext() {
+	std::cout << "Converts wipry-lp --record captures to Influx Line Protocol" << std::endl;
+	std::cout << std::endl;
+	std::cout << "Usage:" << std::endl;
+	std::cout << std::endl;
+	std::cout << "    wipry-convert [options] FILE..." << std::endl;
+	std::cout << std::endl;
+	std::cout << "Options:" << std::endl;
+	std::cout << "	-h			Print this help text and exit." << std::endl;
+	std::cout << "	--batch-lines N		Write output in batches of N lines (default 1000)" << std::endl;
+	std::cout << "	--schema wide|narrow|packed	Line layout, as in wipry-lp (default wide)" << std::endl;
+	std::cout << "	--gzip L		Compress stdout with gzip level 1-9 (default 0, off)" << std::endl;
+	std::cout << "	--influx-url URL	POST to InfluxDB v2 at http://host:port instead of printing to stdout" << std::endl;
+	std::cout << "	--influx-org ORG	Organization to write to" << std::endl;
+	std::cout << "	--influx-bucket B	Bucket to write to" << std::endl;
+	std::cout << "	--influx-token T	API token, defaults to $INFLUX_TOKEN" << std::endl;
+	std::cout << "	--influx-gzip L		gzip level 0-9, 0 sends uncompressed (default 6)" << std::endl;
+}
+
+
+// Sends every frame of one capture to output.  Returns false if the file can not be read.
+static bool convert(const std::string &path, LineSchema schema, Sink *output, RssiFrame &frame, unsigned long long &lines) {
+	CaptureReader reader;
+	if (!reader.open(path)) {
+		std::cerr << "Unable to read capture " << path << std::endl;
+		return false;
+	}
+	const CaptureHeader &header = reader.header();
+
+	// a fresh serializer per file, the keys come from this capture's boundaries
+	LineProtocolSerializer serializer;
+	char serial[sizeof(header.serial) + 1];
+	memcpy(serial, header.serial, sizeof(header.serial));
+	serial[sizeof(header.serial)] = 0;
+	serializer.setSerial(serial);
+	serializer.setSchema(schema);
+	serializer.setBoundary(oscium::WiPryClarity::DataType::RSSI_2_4GHZ, header.freqLow[0], header.freqHigh[0]);
+	serializer.setBoundary(oscium::WiPryClarity::DataType::RSSI_5GHZ, header.freqLow[1], header.freqHigh[1]);
+	serializer.setBoundary(oscium::WiPryClarity::DataType::RSSI_6E, header.freqLow[2], header.freqHigh[2]);
+	serializer.setDualSplit(header.dualSplit);
+	if (header.zoomWidth != 0) {
+		oscium::WiPryClarity::DataType dataType = header.band == 2 ? oscium::WiPryClarity::DataType::RSSI_2_4GHZ
+			: header.band == 5 ? oscium::WiPryClarity::DataType::RSSI_5GHZ : oscium::WiPryClarity::DataType::RSSI_6E;
+		serializer.setWindow(dataType, header.zoomStart, header.zoomWidth);
+	}
+
+	unsigned long long frames = 0;
+	while (reader.next(frame)) {
+		frames++;
+		if (unsigned int n = serializer.serialize(frame, output->buffer())) {
+			output->linesAdded(n);
+			lines += n;
+		}
+	}
+	if (reader.position() != reader.fileSize())
+		std::cerr << path << ": stopped at a damaged frame at offset " << reader.position() << std::endl;
+	std::cerr << path << ": " << frames << " frames, serial " << serial << ", band " << (int)header.band << std::endl;
+	return true;
+}
+
+
+int main(int argc, char *argv[]) {
+	int batchLines = 1000;
+	LineSchema schema = LineSchema::Wide;
+	int gzipLevel = 0;
+	std::string influxUrl;
+	InfluxConfig influxConfig;
+	std::vector<std::string> files;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-h") == 0) {
+			helptext();
+			return 0;
+		}
+		else if (strcmp(argv[i], "--batch-lines") == 0 && i + 1 < argc) {
+			batchLines = atoi(argv[++i]);
+			if (batchLines <= 0) {
+				std::cerr << "Invalid batch size!" << std::endl;
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--schema") == 0 && i + 1 < argc) {
+			if (!parseLineSchema(argv[++i], schema)) {
+				std::cerr << "Invalid schema!" << std::endl;
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--gzip") == 0 && i + 1 < argc) {
+			gzipLevel = atoi(argv[++i]);
+			if (gzipLevel < 0 || gzipLevel > 9) {
+				std::cerr << "Invalid gzip level!" << std::endl;
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--influx-url") == 0 && i + 1 < argc) {
+			influxUrl = argv[++i];
+			if (!influxConfig.url.parse(influxUrl)) {
+				std::cerr << "Invalid InfluxDB URL, only http://host[:port] is supported!" << std::endl;
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--influx-org") == 0 && i + 1 < argc) {
+			influxConfig.org = argv[++i];
+		}
+		else if (strcmp(argv[i], "--influx-bucket") == 0 && i + 1 < argc) {
+			influxConfig.bucket = argv[++i];
+		}
+		else if (strcmp(argv[i], "--influx-token") == 0 && i + 1 < argc) {
+			influxConfig.token = argv[++i];
+		}
+		else if (strcmp(argv[i], "--influx-gzip") == 0 && i + 1 < argc) {
+			int n = atoi(argv[++i]);
+			if (n < 0 || n > 9) {
+				std::cerr << "Invalid gzip level!" << std::endl;
+				return 1;
+			}
+			influxConfig.gzipLevel = n;
+		}
+		else if (argv[i][0] == '-') {
+			std::cerr << "Invalid Argument Specified!" << std::endl;
+			helptext();
+			return 1;
+		}
+		else
+			files.push_back(argv[i]);
+	}
+
+	if (files.empty()) {
+		std::cerr << "No capture specified!" << std::endl;
+		helptext();
+		return 1;
+	}
+
+	Sink *output;
+	BatchedOutput *stdoutOutput = nullptr;
+	InfluxSink *influxSink = nullptr;
+	if (!influxUrl.empty()) {
+		if (gzipLevel > 0) {
+			std::cerr << "--gzip compresses stdout, use --influx-gzip for InfluxDB!" << std::endl;
+			return 1;
+		}
+		if (influxConfig.bucket.empty()) {
+			std::cerr << "--influx-url needs --influx-bucket!" << std::endl;
+			return 1;
+		}
+		if (influxConfig.token.empty() && getenv("INFLUX_TOKEN") != nullptr)
+			influxConfig.token = getenv("INFLUX_TOKEN");
+		influxConfig.batchLines = batchLines;
+		influxSink = new InfluxSink(influxConfig);
+		influxSink->start();
+		output = influxSink;
+	}
+	else {
+		// the capture is read as fast as it goes, batches are cut by size alone
+		stdoutOutput = new BatchedOutput(STDOUT_FILENO, batchLines, 0);
+		if (gzipLevel > 0 && !stdoutOutput->setGzip(gzipLevel)) {
+			std::cerr << "Unable to initialise gzip!" << std::endl;
+			delete stdoutOutput;
+			return 1;
+		}
+		output = stdoutOutput;
+	}
+
+	RssiFrame *frame = new RssiFrame;
+	unsigned long long lines = 0;
+	int status = 0;
+	for (size_t f = 0; f < files.size(); f++) {
+		if (!convert(files[f], schema, output, *frame, lines))
+			status = 1;
+	}
+	delete frame;
+
+	// a dead InfluxDB must not keep the conversion from finishing
+	if (influxSink != nullptr)
+		influxSink->shutdown();
+	if (!output->flush())
+		status = 1;
+	if (influxSink != nullptr) {
+		influxSink->stop();
+		std::cerr << "InfluxDB: " << influxSink->batchesSent() << " batches sent, " << influxSink->batchesDropped()
+			<< " dropped, " << influxSink->bytesSent() << " bytes on the wire." << std::endl;
+		if (influxSink->batchesDropped() != 0)
+			status = 1;
+	}
+	if (stdoutOutput != nullptr)
+		stdoutOutput->report(std::cerr);
+	std::cerr << lines << " lines written." << std::endl;
+	delete output;
+	return status;
+}
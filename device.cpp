@@ -0,0 +1,92 @@
+#include "device.h"
+#include <chrono>
+
+
+ThreadedDevice::ThreadedDevice() : communicating(false), streaming(false), requestedType(-1), zoomStart(0), zoomWidth(0), session(0), streamSession(0), frames(0) {
+}
+
+
+ThreadedDevice::~ThreadedDevice() {
+	endCommunication();
+}
+
+
+bool ThreadedDevice::startCommunication() {
+	if (communicating.exchange(true))
+		return false;
+	// the thread of a connection that was lost has ended on its own
+	if (thread.joinable())
+		thread.join();
+	thread = std::thread(&ThreadedDevice::threadMain, this);
+	return true;
+}
+
+
+bool ThreadedDevice::endCommunication() {
+	bool wasCommunicating = communicating.exchange(false);
+	streaming = false;
+	if (thread.joinable() && thread.get_id() != std::this_thread::get_id())
+		thread.join();
+	else if (thread.joinable())
+		thread.detach();
+	return wasCommunicating;
+}
+
+
+bool ThreadedDevice::didStartCommunication() {
+	return communicating.load();
+}
+
+
+bool ThreadedDevice::startRssiData(oscium::WiPryClarity::DataType dataType, uint8_t shouldZoom, uint16_t startIndex, uint16_t width) {
+	zoomStart = shouldZoom ? startIndex : 0;
+	zoomWidth = shouldZoom ? width : 0;
+	requestedType = (int)dataType;
+	session++;
+	streaming = true;
+	return true;
+}
+
+
+bool ThreadedDevice::stopRssiData() {
+	streaming = false;
+	requestedType = -1;
+	session++;
+	return true;
+}
+
+
+void ThreadedDevice::connectionLost(oscium::WiPryClarity::ErrorCode errorCode) {
+	communicating = false;
+	streaming = false;
+	requestedType = -1;
+	if (delegate != nullptr)
+		delegate->deviceUnableToConnect(this, errorCode);
+}
+
+
+void ThreadedDevice::threadMain() {
+	if (!open()) {
+		communicating = false;
+		if (delegate != nullptr)
+			delegate->deviceUnableToConnect(this, oscium::WiPryClarity::ErrorCode::UnableToCommunicateWithAccessory);
+		return;
+	}
+	if (delegate != nullptr)
+		delegate->deviceDidConnect(this);
+
+	while (communicating) {
+		int type = requestedType.load();
+		if (!streaming || type < 0) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			continue;
+		}
+		streamSession = session.load();
+		if (!stream((oscium::WiPryClarity::DataType)type)) {
+			streaming = false;
+			requestedType = -1;
+			if (delegate != nullptr)
+				delegate->deviceDidEndData(this);
+		}
+	}
+}
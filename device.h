@@ -0,0 +1,218 @@
+#pragma once
+
+#include "WiPryClarity.h"
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+
+    Device
+
+    Source of RSSI sweeps.  Mirrors the parts of oscium::WiPryClarity and
+    WiPryClarityDelegate that wipry-lp uses, so the pipeline can be driven by
+    a physical WiPry (WiPryDevice), generated data (SyntheticDevice) or a
+    recording (ReplayDevice).  Delegate callbacks arrive on the device's own
+    thread, exactly as they do from libWiPryClarity.
+
+*/
+
+
+class Device;
+
+
+class DeviceDelegate {
+public:
+	virtual ~DeviceDelegate() {}
+
+	virtual void deviceDidConnect(Device *device) {}
+
+	virtual void deviceUnableToConnect(Device *device, oscium::WiPryClarity::ErrorCode errorCode) {}
+
+	// Make sure this is fast, the source does not wait for it.
+	virtual void deviceDidReceiveRSSIData(Device *device, oscium::WiPryClarity::DataType dataType,
+		const std::vector<float> &rssiData) {}
+
+	// A finite source (a replay) has nothing more to send.
+	virtual void deviceDidEndData(Device *device) {}
+};
+
+
+class Device {
+public:
+	Device() : delegate(nullptr) {}
+	virtual ~Device() {}
+
+	void setDelegate(DeviceDelegate *aDelegate) { delegate = aDelegate; }
+	DeviceDelegate *getDelegate() { return delegate; }
+
+	virtual bool startCommunication() = 0;
+	virtual bool endCommunication() = 0;
+	virtual bool didStartCommunication() = 0;
+
+	virtual bool startRssiData(oscium::WiPryClarity::DataType dataType, uint8_t shouldZoom, uint16_t startIndex, uint16_t width) = 0;
+	virtual bool stopRssiData() = 0;
+
+	virtual std::string getSerialNumber() = 0;
+	virtual bool getOddRssiLimts(float *min, float *max, float *noiseFloor) = 0;
+	virtual bool getEvenRssiLimts(float *min, float *max, float *noiseFloor) = 0;
+	virtual bool get2_4GHzBoundary(float *minMHz, float *maxMHz) = 0;
+	virtual bool get5GHzBoundary(float *minMHz, float *maxMHz) = 0;
+	virtual bool get6EBoundary(float *minMHz, float *maxMHz) = 0;
+
+protected:
+	DeviceDelegate *delegate;
+};
+
+
+// A WiPry on USB, through libWiPryClarity.
+class WiPryDevice : public Device {
+public:
+	WiPryDevice();
+	~WiPryDevice();
+
+	bool startCommunication();
+	bool endCommunication();
+	bool didStartCommunication();
+
+	bool startRssiData(oscium::WiPryClarity::DataType dataType, uint8_t shouldZoom, uint16_t startIndex, uint16_t width);
+	bool stopRssiData();
+
+	std::string getSerialNumber();
+	bool getOddRssiLimts(float *min, float *max, float *noiseFloor);
+	bool getEvenRssiLimts(float *min, float *max, float *noiseFloor);
+	bool get2_4GHzBoundary(float *minMHz, float *maxMHz);
+	bool get5GHzBoundary(float *minMHz, float *maxMHz);
+	bool get6EBoundary(float *minMHz, float *maxMHz);
+
+private:
+	class Forwarder;
+
+	oscium::WiPryClarity *wipryClarity;
+	Forwarder *forwarder;
+};
+
+
+// Base for sources that run their own data thread.  Subclasses must call
+// endCommunication() in their destructor so the thread is gone before
+// their members are.
+class ThreadedDevice : public Device {
+public:
+	ThreadedDevice();
+	~ThreadedDevice();
+
+	bool startCommunication();
+	bool endCommunication();
+	bool didStartCommunication();
+
+	bool startRssiData(oscium::WiPryClarity::DataType dataType, uint8_t shouldZoom, uint16_t startIndex, uint16_t width);
+	bool stopRssiData();
+
+	unsigned long long framesSent() const { return frames.load(std::memory_order_relaxed); }
+
+protected:
+	// Runs on the data thread; returns when streaming should end, either
+	// because streaming was stopped or because the source ran dry (return false).
+	virtual bool stream(oscium::WiPryClarity::DataType dataType) = 0;
+
+	// Called on the data thread before the connect callback; false fails the connection.
+	virtual bool open() { return true; }
+
+	// For stream(): the source went away.  Ends the data thread once stream()
+	// returns and tells the delegate, the way a WiPry pulled from USB does.
+	void connectionLost(oscium::WiPryClarity::ErrorCode errorCode);
+
+	void threadMain();
+
+	// For stream()'s loop: false once streaming stops or is restarted, even
+	// with the same data type.
+	bool keepStreaming(oscium::WiPryClarity::DataType dataType) const {
+		return streaming && requestedType.load() == (int)dataType && session.load() == streamSession;
+	}
+
+	std::atomic<bool> communicating;
+	std::atomic<bool> streaming;
+	std::atomic<int> requestedType;		// -1 while stopped
+	std::atomic<unsigned int> zoomStart;
+	std::atomic<unsigned int> zoomWidth;	// 0 unless zoomed
+	std::atomic<unsigned int> session;	// counts startRssiData() and stopRssiData() calls
+	unsigned int streamSession;		// session the running stream() was started for
+	std::atomic<unsigned long long> frames;
+	std::thread thread;
+};
+
+
+struct SyntheticConfig {
+	double sweepsPerSecond;		// 0 for as fast as possible
+	unsigned int points[4];		// per DataType: 2.4GHz, 5GHz, 6E, dual
+	std::string serial;
+	unsigned int seed;
+	unsigned int dropEvery;		// sweeps after each connect before the link drops, 0 for never
+
+	SyntheticConfig() : sweepsPerSecond(10), serial("SYNTHETIC"), seed(1), dropEvery(0) {
+		points[0] = 1000;
+		points[1] = 1000;
+		points[2] = 1000;
+		points[3] = 2000;
+	}
+};
+
+
+// Generates noise-floor sweeps with a drifting carrier and periodic bursts, at a
+// fixed rate.  Zoomed, only the window is filled and sweeps come faster in
+// proportion, the way a narrower scan speeds up a WiPry.
+class SyntheticDevice : public ThreadedDevice {
+public:
+	explicit SyntheticDevice(const SyntheticConfig &config);
+	~SyntheticDevice();
+
+	std::string getSerialNumber() { return config.serial; }
+	bool getOddRssiLimts(float *min, float *max, float *noiseFloor);
+	bool getEvenRssiLimts(float *min, float *max, float *noiseFloor);
+	bool get2_4GHzBoundary(float *minMHz, float *maxMHz);
+	bool get5GHzBoundary(float *minMHz, float *maxMHz);
+	bool get6EBoundary(float *minMHz, float *maxMHz);
+
+protected:
+	bool open();
+	bool stream(oscium::WiPryClarity::DataType dataType);
+
+private:
+	SyntheticConfig config;
+	std::vector<float> sweep;
+	uint32_t rng;
+	unsigned long long sinceOpen;
+};
+
+
+// Plays back line protocol previously written by wipry-lp.  speed 1 keeps
+// the recorded pacing, 2 plays twice as fast, 0 as fast as possible.  Only
+// sweeps of the streamed band are delivered.
+class ReplayDevice : public ThreadedDevice {
+public:
+	ReplayDevice(const std::string &path, double speed);
+	~ReplayDevice();
+
+	std::string getSerialNumber() { return serial; }
+	bool getOddRssiLimts(float *min, float *max, float *noiseFloor);
+	bool getEvenRssiLimts(float *min, float *max, float *noiseFloor);
+	bool get2_4GHzBoundary(float *minMHz, float *maxMHz);
+	bool get5GHzBoundary(float *minMHz, float *maxMHz);
+	bool get6EBoundary(float *minMHz, float *maxMHz);
+
+protected:
+	bool open();
+	bool stream(oscium::WiPryClarity::DataType dataType);
+
+private:
+	bool parseLine(const std::string &line, int &band, long long &timens, std::vector<float> *keys);
+	bool boundary(int band, float *minMHz, float *maxMHz);
+
+	std::string path;
+	double speed;
+	std::string serial;
+	bool haveBand[3];
+	float freqLow[3], freqHigh[3];
+	std::vector<float> sweep;
+};
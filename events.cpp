@@ -0,0 +1,60 @@
+#include "events.h"
+#include <cerrno>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+
+
+EventLoop::EventLoop(const std::vector<int> &signals) : signalFd(-1), eventFd(-1) {
+	sigset_t mask;
+	sigemptyset(&mask);
+	for (size_t s = 0; s < signals.size(); s++)
+		sigaddset(&mask, signals[s]);
+	if (pthread_sigmask(SIG_BLOCK, &mask, nullptr) == 0)
+		signalFd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+	eventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+}
+
+
+EventLoop::~EventLoop() {
+	if (signalFd >= 0)
+		close(signalFd);
+	if (eventFd >= 0)
+		close(eventFd);
+}
+
+
+void EventLoop::notify() {
+	uint64_t one = 1;
+	// only fails when the counter is about to overflow, and then a wakeup is pending anyway
+	ssize_t n = write(eventFd, &one, sizeof(one));
+	(void)n;
+}
+
+
+int EventLoop::wait(int timeoutMs) {
+	struct pollfd fds[2];
+	fds[0].fd = signalFd;
+	fds[0].events = POLLIN;
+	fds[1].fd = eventFd;
+	fds[1].events = POLLIN;
+
+	int n = poll(fds, 2, timeoutMs);
+	if (n <= 0)
+		return 0;
+
+	if (fds[1].revents & POLLIN) {
+		uint64_t count;
+		while (read(eventFd, &count, sizeof(count)) < 0 && errno == EINTR)
+			;
+	}
+	if (fds[0].revents & POLLIN) {
+		struct signalfd_siginfo info;
+		if (read(signalFd, &info, sizeof(info)) == sizeof(info))
+			return (int)info.ssi_signo;
+	}
+	return 0;
+}
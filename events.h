@@ -0,0 +1,38 @@
+#pragma once
+
+#include <vector>
+
+/*
+
+    EventLoop
+
+    What the main thread sleeps on.  The given signals are blocked in every
+    thread and read from a signalfd, and any thread can wake the loop through
+    an eventfd with notify(), so a signal, a connect or a lost device ends the
+    wait right away instead of at the next poll.
+
+    Create it before any other thread is started, threads inherit the signal
+    mask of the thread that creates them.
+
+*/
+
+
+class EventLoop {
+public:
+	explicit EventLoop(const std::vector<int> &signals);
+	~EventLoop();
+
+	// False if the descriptors could not be created.
+	bool ok() const { return signalFd >= 0 && eventFd >= 0; }
+
+	// Wakes wait().  Safe from any thread and from a signal handler.
+	void notify();
+
+	// Waits for a signal, a notify() or timeoutMs (-1 for no limit).  Returns
+	// the signal number, or 0 for anything else.
+	int wait(int timeoutMs);
+
+private:
+	int signalFd;
+	int eventFd;
+};
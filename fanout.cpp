@@ -0,0 +1,689 @@
+#include "fanout.h"
+#include "output.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+// How often an idle target thread wakes up when the target has nothing to do then.
+#define FANOUT_IDLE_MS 1000
+// Lines are packed into datagrams up to this size, a longer line goes out alone.
+#define FANOUT_UDP_DATAGRAM 1400
+#define FANOUT_UDP_MAX 65507
+// A unix socket that went away is tried again at most this often.
+#define FANOUT_RECONNECT_MS 1000
+// A reader that stops reading is given up on after this long, so it can not hold up shutdown.
+#define FANOUT_SEND_TIMEOUT_MS 1000
+
+
+FanOutTarget::FanOutTarget(const std::string &name, size_t capacity, OverflowPolicy policy)
+	: idleMs(FANOUT_IDLE_MS), written(0), dropped(0), failed(0), targetName(name), policy(policy),
+	ring(capacity > 0 ? capacity : 1), head(0), count(0), running(false) {
+}
+
+
+FanOutTarget::~FanOutTarget() {
+	stop();
+}
+
+
+void FanOutTarget::start() {
+	running = true;
+	thread = std::thread(&FanOutTarget::threadMain, this);
+}
+
+
+void FanOutTarget::stop() {
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		if (!running)
+			return;
+		running = false;
+	}
+	cv.notify_one();
+	if (thread.joinable())
+		thread.join();
+}
+
+
+void FanOutTarget::push(const std::shared_ptr<const SharedLines> &batch) {
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		if (count == ring.size()) {
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			if (policy == OverflowPolicy::DropNewest)
+				return;
+			ring[head].reset();
+			head = (head + 1) % ring.size();
+			count--;
+		}
+		ring[(head + count) % ring.size()] = batch;
+		count++;
+	}
+	cv.notify_one();
+}
+
+
+void FanOutTarget::threadMain() {
+	std::unique_lock<std::mutex> lock(mtx);
+	while (true) {
+		if (count == 0) {
+			if (!running)
+				break;
+			if (!cv.wait_for(lock, std::chrono::milliseconds(idleMs), [this] { return count != 0 || !running; })) {
+				lock.unlock();
+				idle();
+				lock.lock();
+			}
+			continue;
+		}
+		std::shared_ptr<const SharedLines> batch;
+		batch.swap(ring[head]);
+		head = (head + 1) % ring.size();
+		count--;
+		lock.unlock();
+
+		if (!write(*batch))
+			failed.fetch_add(1, std::memory_order_relaxed);
+		// let go of the buffer before waiting, the writer thread reuses it
+		batch.reset();
+		lock.lock();
+	}
+	lock.unlock();
+	finish();
+}
+
+
+bool FanOutTarget::setGzip(int level) {
+	gzip.reset(new GzipStream(level));
+	if (gzip->valid())
+		return true;
+	gzip.reset();
+	return false;
+}
+
+
+bool FanOutTarget::encode(const SharedLines &batch, const char *&data, size_t &len) {
+	if (!gzip) {
+		data = batch.lines.data();
+		len = batch.lines.size();
+		return true;
+	}
+	gzip->clear();
+	bool ok = gzip->add(batch.lines.data(), batch.lines.size()) && gzip->flush();
+	data = gzip->data();
+	len = gzip->size();
+	return ok;
+}
+
+
+bool FanOutTarget::encodeEnd(const char *&data, size_t &len) {
+	len = 0;
+	if (!gzip)
+		return true;
+	gzip->clear();
+	bool ok = gzip->flush(true);
+	data = gzip->data();
+	len = gzip->size();
+	return ok;
+}
+
+
+void FanOutTarget::report(std::ostream &out) const {
+	out << "Sink " << targetName << ": " << bytesOut() << " bytes written, " << batchesDropped() << " batches dropped from the queue, "
+		<< failed.load(std::memory_order_relaxed) << " lost to errors." << std::endl;
+	if (gzip)
+		gzip->report(out, targetName);
+}
+
+
+// stdout, or any descriptor that is already open.
+class FdTarget : public FanOutTarget {
+public:
+	FdTarget(const std::string &name, int fd, size_t capacity, OverflowPolicy policy)
+		: FanOutTarget(name, capacity, policy), fd(fd) {}
+	~FdTarget() { stop(); }
+
+	bool open() { return true; }
+
+protected:
+	bool write(const SharedLines &batch) {
+		const char *data;
+		size_t len;
+		if (!encode(batch, data, len) || !writeAll(fd, data, len))
+			return false;
+		written.fetch_add(len, std::memory_order_relaxed);
+		return true;
+	}
+
+	void finish() {
+		const char *data;
+		size_t len;
+		if (encodeEnd(data, len) && len != 0 && writeAll(fd, data, len))
+			written.fetch_add(len, std::memory_order_relaxed);
+	}
+
+private:
+	int fd;
+};
+
+
+class RotatingFileTarget : public FanOutTarget {
+public:
+	RotatingFileTarget(const std::string &path, size_t maxBytes, unsigned int keep, size_t capacity, OverflowPolicy policy)
+		: FanOutTarget("file:" + path, capacity, policy), path(path), maxBytes(maxBytes), keep(keep), fd(-1), size(0), rotations(0) {}
+
+	~RotatingFileTarget() {
+		stop();
+		if (fd >= 0)
+			close(fd);
+	}
+
+	bool open() {
+		fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+		if (fd < 0) {
+			std::cerr << "Unable to open " << path << ": " << strerror(errno) << std::endl;
+			return false;
+		}
+		off_t end = lseek(fd, 0, SEEK_END);
+		size = end > 0 ? end : 0;
+		return true;
+	}
+
+	void report(std::ostream &out) const {
+		FanOutTarget::report(out);
+		if (rotations != 0)
+			out << "Sink " << name() << ": rotated " << rotations << " times." << std::endl;
+	}
+
+protected:
+	bool write(const SharedLines &batch) {
+		// compressed, the size of a batch is only known once it is part of the
+		// file's gzip member, so the file rotates once it has reached the limit
+		bool full = gzip ? size >= maxBytes : size + batch.lines.size() > maxBytes;
+		if (maxBytes != 0 && size != 0 && full)
+			rotate();
+		const char *data;
+		size_t len;
+		if (fd < 0 || !encode(batch, data, len) || !writeAll(fd, data, len))
+			return false;
+		size += len;
+		written.fetch_add(len, std::memory_order_relaxed);
+		return true;
+	}
+
+	void finish() {
+		endMember();
+	}
+
+private:
+	// Closes the gzip member, the file is complete as it is then.
+	void endMember() {
+		const char *data;
+		size_t len;
+		if (fd >= 0 && encodeEnd(data, len) && len != 0 && writeAll(fd, data, len)) {
+			size += len;
+			written.fetch_add(len, std::memory_order_relaxed);
+		}
+	}
+
+	// PATH.keep-1 -> PATH.keep ... PATH -> PATH.1, the oldest falls off the end
+	void rotate() {
+		endMember();
+		close(fd);
+		fd = -1;
+		for (unsigned int i = keep; i > 1; i--)
+			rename((path + "." + std::to_string(i - 1)).c_str(), (path + "." + std::to_string(i)).c_str());
+		if (keep > 0)
+			rename(path.c_str(), (path + ".1").c_str());
+		fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+		if (fd < 0)
+			std::cerr << "Unable to open " << path << ": " << strerror(errno) << std::endl;
+		size = 0;
+		rotations++;
+	}
+
+	std::string path;
+	size_t maxBytes;
+	unsigned int keep;
+	int fd;
+	size_t size;
+	unsigned long long rotations;
+};
+
+
+class UdpTarget : public FanOutTarget {
+public:
+	UdpTarget(const std::string &host, const std::string &port, size_t capacity, OverflowPolicy policy)
+		: FanOutTarget("udp:" + host + ":" + port, capacity, policy), host(host), port(port), fd(-1) {}
+
+	~UdpTarget() {
+		stop();
+		if (fd >= 0)
+			close(fd);
+	}
+
+	bool open() {
+		struct addrinfo hints;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_DGRAM;
+
+		struct addrinfo *addrs = nullptr;
+		if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addrs) != 0) {
+			std::cerr << "Unable to resolve " << host << std::endl;
+			return false;
+		}
+		for (struct addrinfo *a = addrs; a != nullptr; a = a->ai_next) {
+			fd = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+			if (fd < 0)
+				continue;
+			if (connect(fd, a->ai_addr, a->ai_addrlen) == 0)
+				break;
+			close(fd);
+			fd = -1;
+		}
+		freeaddrinfo(addrs);
+		if (fd < 0)
+			std::cerr << "Unable to set up " << name() << ": " << strerror(errno) << std::endl;
+		return fd >= 0;
+	}
+
+protected:
+	// as many whole lines per datagram as fit, a receiver never sees half a line
+	bool write(const SharedLines &batch) {
+		const char *p = batch.lines.data();
+		const char *end = p + batch.lines.size();
+		bool ok = true;
+		while (p < end) {
+			// at least one line, even if it is longer than a datagram should be
+			const char *q = p;
+			while (q < end) {
+				const char *nl = (const char *)memchr(q, '\n', end - q);
+				const char *next = nl != nullptr ? nl + 1 : end;
+				if (q != p && next - p > FANOUT_UDP_DATAGRAM)
+					break;
+				q = next;
+			}
+			size_t len = q - p;
+			ssize_t n = -1;
+			if (len <= FANOUT_UDP_MAX) {
+				do {
+					n = send(fd, p, len, 0);
+				} while (n < 0 && errno == EINTR);
+			}
+			// nobody listening shows up as ECONNREFUSED on a later send
+			if (n == (ssize_t)len)
+				written.fetch_add(len, std::memory_order_relaxed);
+			else
+				ok = false;
+			p = q;
+		}
+		return ok;
+	}
+
+private:
+	std::string host, port;
+	int fd;
+};
+
+
+class UnixSocketTarget : public FanOutTarget {
+public:
+	UnixSocketTarget(const std::string &path, size_t capacity, OverflowPolicy policy)
+		: FanOutTarget("unix:" + path, capacity, policy), path(path), fd(-1) {}
+
+	~UnixSocketTarget() {
+		stop();
+		if (fd >= 0)
+			close(fd);
+	}
+
+	bool open() {
+		if (path.size() >= sizeof(((struct sockaddr_un *)nullptr)->sun_path)) {
+			std::cerr << "Socket path " << path << " is too long!" << std::endl;
+			return false;
+		}
+		if (!connectSocket())
+			std::cerr << "Nothing listening on " << path << " yet, " << name() << " keeps trying." << std::endl;
+		return true;
+	}
+
+protected:
+	bool write(const SharedLines &batch) {
+		if (fd < 0) {
+			if (std::chrono::steady_clock::now() < nextAttempt || !connectSocket())
+				return false;
+		}
+		const char *p = batch.lines.data();
+		size_t left = batch.lines.size();
+		while (left > 0) {
+			ssize_t n = send(fd, p, left, MSG_NOSIGNAL);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0) {
+				// the reader went away, a new connection starts on a line boundary again
+				close(fd);
+				fd = -1;
+				nextAttempt = std::chrono::steady_clock::now() + std::chrono::milliseconds(FANOUT_RECONNECT_MS);
+				return false;
+			}
+			written.fetch_add(n, std::memory_order_relaxed);
+			p += n;
+			left -= n;
+		}
+		return true;
+	}
+
+private:
+	bool connectSocket() {
+		nextAttempt = std::chrono::steady_clock::now() + std::chrono::milliseconds(FANOUT_RECONNECT_MS);
+		fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd < 0)
+			return false;
+		struct timeval tv;
+		tv.tv_sec = FANOUT_SEND_TIMEOUT_MS / 1000;
+		tv.tv_usec = (FANOUT_SEND_TIMEOUT_MS % 1000) * 1000;
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		memcpy(addr.sun_path, path.c_str(), path.size());
+		if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+			close(fd);
+			fd = -1;
+			return false;
+		}
+		return true;
+	}
+
+	std::string path;
+	int fd;
+	std::chrono::steady_clock::time_point nextAttempt;
+};
+
+
+class InfluxTarget : public FanOutTarget {
+public:
+	InfluxTarget(InfluxSink *sink, unsigned int flushMs, size_t capacity, OverflowPolicy policy)
+		: FanOutTarget("influx", capacity, policy), sink(sink) {
+		idleMs = flushMs > 0 ? flushMs : FANOUT_IDLE_MS;
+	}
+	~InfluxTarget() { stop(); }
+
+	bool open() { return true; }
+
+	void report(std::ostream &out) const {
+		out << "Sink " << name() << ": " << batchesDropped() << " batches dropped from the queue." << std::endl;
+	}
+
+protected:
+	// only this thread touches the InfluxSink, as only the writer thread does without fan-out
+	bool write(const SharedLines &batch) {
+		sink->buffer().append(batch.lines.data(), batch.lines.size());
+		sink->linesAdded(batch.count);
+		written.store(sink->bytesOut(), std::memory_order_relaxed);
+		return true;
+	}
+
+	void idle() {
+		sink->poll();
+		written.store(sink->bytesOut(), std::memory_order_relaxed);
+	}
+
+	void finish() {
+		sink->flush();
+	}
+
+private:
+	InfluxSink *sink;
+};
+
+
+FanOutTarget *makeFanOutTarget(const std::string &spec, int gzipLevel) {
+	std::string target = spec;
+	size_t capacity = FANOUT_QUEUE_BATCHES;
+	OverflowPolicy policy = OverflowPolicy::DropOldest;
+	size_t maxBytes = 100 << 20;
+	unsigned int keep = 5;
+	int gzip = -1;			// -1 unless given
+
+	// options come after the first comma
+	size_t comma = spec.find(',');
+	if (comma != std::string::npos) {
+		target = spec.substr(0, comma);
+		std::string options = spec.substr(comma + 1);
+		size_t start = 0;
+		while (start <= options.size()) {
+			size_t end = options.find(',', start);
+			if (end == std::string::npos)
+				end = options.size();
+			std::string option = options.substr(start, end - start);
+			size_t eq = option.find('=');
+			std::string key = option.substr(0, eq);
+			std::string value = eq != std::string::npos ? option.substr(eq + 1) : std::string();
+			int n = atoi(value.c_str());
+			if (key == "queue" && n > 0)
+				capacity = n;
+			else if (key == "drop" && value == "oldest")
+				policy = OverflowPolicy::DropOldest;
+			else if (key == "drop" && value == "newest")
+				policy = OverflowPolicy::DropNewest;
+			else if (key == "max-mb" && n >= 0 && !value.empty())
+				maxBytes = (size_t)n << 20;
+			else if (key == "keep" && n >= 0 && !value.empty())
+				keep = n;
+			else if (key == "gzip" && n >= 0 && n <= 9 && !value.empty())
+				gzip = n;
+			else
+				return nullptr;
+			start = end + 1;
+		}
+	}
+
+	FanOutTarget *made = nullptr;
+	if (target == "stdout")
+		made = new FdTarget("stdout", STDOUT_FILENO, capacity, policy);
+	else if (target.compare(0, 5, "file:") == 0 && target.size() > 5)
+		made = new RotatingFileTarget(target.substr(5), maxBytes, keep, capacity, policy);
+	if (made != nullptr) {
+		int level = gzip >= 0 ? gzip : gzipLevel;
+		if (level > 0 && !made->setGzip(level)) {
+			delete made;
+			return nullptr;
+		}
+		return made;
+	}
+
+	// datagrams and sockets are read line by line as they come
+	if (gzip > 0)
+		return nullptr;
+	if (target.compare(0, 4, "udp:") == 0) {
+		size_t colon = target.rfind(':');
+		if (colon <= 4 || colon + 1 >= target.size())
+			return nullptr;
+		std::string host = target.substr(4, colon - 4);
+		// [v6]:port
+		if (host.size() > 2 && host[0] == '[' && host[host.size() - 1] == ']')
+			host = host.substr(1, host.size() - 2);
+		return new UdpTarget(host, target.substr(colon + 1), capacity, policy);
+	}
+	if (target.compare(0, 5, "unix:") == 0 && target.size() > 5)
+		return new UnixSocketTarget(target.substr(5), capacity, policy);
+	return nullptr;
+}
+
+
+FanOutTarget *makeInfluxTarget(InfluxSink *sink, unsigned int flushMs) {
+	return new InfluxTarget(sink, flushMs, FANOUT_QUEUE_BATCHES, OverflowPolicy::DropOldest);
+}
+
+
+FanOut::FanOut(unsigned int batchLines, unsigned int flushMs)
+	: batchLines(batchLines > 0 ? batchLines : 1), flushMs(flushMs), detachedBytes(0), active(0), batches(0) {
+	pool.push_back(std::make_shared<SharedLines>());
+	pool[0]->count = 0;
+}
+
+
+FanOut::~FanOut() {
+	stop();
+	for (size_t t = 0; t < targets.size(); t++)
+		delete targets[t];
+}
+
+
+void FanOut::add(FanOutTarget *target) {
+	targets.push_back(target);
+}
+
+
+bool FanOut::start() {
+	for (size_t t = 0; t < targets.size(); t++) {
+		if (!targets[t]->open())
+			return false;
+	}
+	for (size_t t = 0; t < targets.size(); t++)
+		targets[t]->start();
+	return true;
+}
+
+
+void FanOut::stop() {
+	for (size_t t = 0; t < targets.size(); t++)
+		targets[t]->stop();
+}
+
+
+bool FanOut::attach(FanOutTarget *target) {
+	if (!target->open()) {
+		delete target;
+		return false;
+	}
+	target->start();
+	std::lock_guard<std::mutex> lock(targetsMutex);
+	targets.push_back(target);
+	return true;
+}
+
+
+bool FanOut::detach(const std::string &name) {
+	FanOutTarget *target = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(targetsMutex);
+		for (size_t t = 0; t < targets.size(); t++) {
+			if (targets[t]->name() == name) {
+				target = targets[t];
+				targets.erase(targets.begin() + t);
+				break;
+			}
+		}
+	}
+	if (target == nullptr)
+		return false;
+	// the batches it still holds keep their buffers until it is done with them
+	target->stop();
+	target->report(std::cerr);
+	std::lock_guard<std::mutex> lock(targetsMutex);
+	detachedBytes += target->bytesOut();
+	delete target;
+	return true;
+}
+
+
+std::vector<std::string> FanOut::targetNames() const {
+	std::lock_guard<std::mutex> lock(targetsMutex);
+	std::vector<std::string> names;
+	for (size_t t = 0; t < targets.size(); t++)
+		names.push_back(targets[t]->name());
+	return names;
+}
+
+
+LineBuffer &FanOut::buffer() {
+	return pool[active]->lines;
+}
+
+
+void FanOut::linesAdded(unsigned int lines) {
+	if (lines == 0)
+		return;
+	SharedLines &batch = *pool[active];
+	if (batch.count == 0)
+		firstPending = std::chrono::steady_clock::now();
+	batch.count += lines;
+
+	if (batch.count >= batchLines)
+		submit();
+	else
+		poll();
+}
+
+
+void FanOut::poll() {
+	if (pool[active]->count == 0 || flushMs == 0)
+		return;
+	if (std::chrono::steady_clock::now() - firstPending >= std::chrono::milliseconds(flushMs))
+		submit();
+}
+
+
+bool FanOut::flush() {
+	if (pool[active]->count != 0)
+		submit();
+	return true;
+}
+
+
+// Hands the active batch to every target and moves on to a free buffer.
+void FanOut::submit() {
+	std::shared_ptr<const SharedLines> batch = pool[active];
+	{
+		std::lock_guard<std::mutex> lock(targetsMutex);
+		for (size_t t = 0; t < targets.size(); t++)
+			targets[t]->push(batch);
+	}
+	batch.reset();
+	batches++;
+
+	// a buffer only the pool still refers to has been written or dropped by every target
+	size_t next = pool.size();
+	for (size_t b = 0; b < pool.size(); b++) {
+		if (b != active && pool[b].use_count() == 1) {
+			next = b;
+			break;
+		}
+	}
+	if (next == pool.size())
+		pool.push_back(std::make_shared<SharedLines>());
+	else
+		// the targets' last reads happen before their release of the reference
+		std::atomic_thread_fence(std::memory_order_acquire);
+	active = next;
+	pool[active]->lines.clear();
+	pool[active]->count = 0;
+}
+
+
+unsigned long long FanOut::bytesOut() const {
+	std::lock_guard<std::mutex> lock(targetsMutex);
+	unsigned long long total = detachedBytes;
+	for (size_t t = 0; t < targets.size(); t++)
+		total += targets[t]->bytesOut();
+	return total;
+}
+
+
+void FanOut::report(std::ostream &out) const {
+	std::lock_guard<std::mutex> lock(targetsMutex);
+	out << "Fan-out: " << batches << " batches to " << targets.size() << " sinks in " << pool.size() << " shared buffers." << std::endl;
+	for (size_t t = 0; t < targets.size(); t++)
+		targets[t]->report(out);
+}
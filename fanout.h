@@ -0,0 +1,185 @@
+#pragma once
+
+#include "sink.h"
+#include "writer.h"
+#include "gzip.h"
+#include "influx.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+
+    FanOut
+
+    Sends the same line protocol to several places at once.  The writer
+    thread serializes every sweep once into a batch, exactly as for a single
+    output; once the batch is due it is frozen and a reference to it is
+    handed to every target.  The batch buffer is reused when the last target
+    lets go of it, so the steady state allocates nothing.
+
+    Each FanOutTarget has its own bounded queue, overflow policy and thread.
+    A slow or dead target fills up and drops from its own queue, the writer
+    thread never waits for it and neither do the other targets.
+
+    Targets are given on the command line as
+
+        stdout
+        file:PATH[,max-mb=N][,keep=N]	rotated to PATH.1 .. PATH.keep once N MiB
+        udp:HOST:PORT					datagrams of whole lines
+        unix:PATH						a stream socket, reconnected when it goes away
+
+    each optionally followed by ,queue=N (batches, default 64) and
+    ,drop=oldest|newest (default oldest), and stdout and files by ,gzip=L
+    (1-9, 0 for none).  A gzipped target compresses on its own thread and
+    sync-flushes after every batch; a rotated file is a gzip file of its
+    own.  InfluxDB is a target as well when --influx-url is given alongside.
+
+    Targets can be attached and detached while running.  The set changes
+    between two batches: a batch goes to every target of the old set or to
+    every target of the new one, never to some of each.
+
+*/
+
+
+// Batches a target holds before its overflow policy applies.
+#define FANOUT_QUEUE_BATCHES 64
+
+
+// One frozen batch, shared by every target.
+struct SharedLines {
+	LineBuffer lines;
+	unsigned int count;
+};
+
+
+class FanOutTarget {
+public:
+	FanOutTarget(const std::string &name, size_t capacity, OverflowPolicy policy);
+	virtual ~FanOutTarget();
+
+	const std::string &name() const { return targetName; }
+
+	// Main thread, before start(): opens the file or socket.  False if the
+	// target can not work at all.
+	virtual bool open() = 0;
+
+	void start();
+
+	// Writes what is still queued and stops the thread.
+	void stop();
+
+	// Writer thread, never blocks.
+	void push(const std::shared_ptr<const SharedLines> &batch);
+
+	// Compresses what the target writes, level 1-9.  Before start(), false if
+	// zlib can not be set up.
+	bool setGzip(int level);
+
+	unsigned long long bytesOut() const { return written.load(std::memory_order_relaxed); }
+	unsigned long long batchesDropped() const { return dropped.load(std::memory_order_relaxed); }
+
+	virtual void report(std::ostream &out) const;
+
+protected:
+	// Target thread: writes one batch.  False if it was lost.
+	virtual bool write(const SharedLines &batch) = 0;
+
+	// Target thread: called at least every idleMs while the queue is empty.
+	virtual void idle() {}
+
+	// Target thread: called once the queue is drained for good.
+	virtual void finish() {}
+
+	// Target thread: the batch as it is to be written, compressed up to a sync
+	// flush when gzip is on.  Valid until the next call.
+	bool encode(const SharedLines &batch, const char *&data, size_t &len);
+
+	// Target thread: the end of the gzip member, nothing if gzip is off or
+	// nothing was written since the last end.
+	bool encodeEnd(const char *&data, size_t &len);
+
+	unsigned int idleMs;
+	std::unique_ptr<GzipStream> gzip;
+	std::atomic<unsigned long long> written;
+	std::atomic<unsigned long long> dropped;
+	std::atomic<unsigned long long> failed;
+
+private:
+	void threadMain();
+
+	std::string targetName;
+	OverflowPolicy policy;
+	std::vector<std::shared_ptr<const SharedLines> > ring;
+	size_t head, count;
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::thread thread;
+	bool running;
+};
+
+
+// Parses a target as given to --sink, nullptr if it is not one.  stdout and
+// files without a gzip option of their own are compressed at gzipLevel.
+FanOutTarget *makeFanOutTarget(const std::string &spec, int gzipLevel = 0);
+
+// Feeds an InfluxSink from its own thread, so a slow endpoint only backs up this target.
+FanOutTarget *makeInfluxTarget(InfluxSink *sink, unsigned int flushMs);
+
+
+class FanOut : public Sink {
+public:
+	// Batches as BatchedOutput does.
+	FanOut(unsigned int batchLines, unsigned int flushMs);
+	~FanOut();
+
+	// Takes ownership.  Before start().
+	void add(FanOutTarget *target);
+
+	// Opens and starts every target.  False if one of them can not be opened.
+	bool start();
+
+	// Once flush() has handed over the last batch: drains and stops every target.
+	void stop();
+
+	// After start(): the target gets every batch from the next one on.  Takes
+	// ownership, false if it can not be opened and it is deleted.
+	bool attach(FanOutTarget *target);
+
+	// After start(): takes the target called name out, writes what it still
+	// has queued and deletes it.  False if there is none.
+	bool detach(const std::string &name);
+
+	std::vector<std::string> targetNames() const;
+
+	LineBuffer &buffer();
+	void linesAdded(unsigned int lines);
+	void poll();
+	bool flush();
+	unsigned long long bytesOut() const;
+
+	void report(std::ostream &out) const;
+
+private:
+	void submit();
+
+	unsigned int batchLines;
+	unsigned int flushMs;
+	// written by the main thread, read by the writer thread and telemetry
+	mutable std::mutex targetsMutex;
+	std::vector<FanOutTarget *> targets;
+	unsigned long long detachedBytes;
+
+	// every batch buffer, the active one is being filled, the others are free
+	// once no target holds them any more
+	std::vector<std::shared_ptr<SharedLines> > pool;
+	size_t active;
+	std::chrono::steady_clock::time_point firstPending;
+	unsigned long long batches;
+};
@@ -0,0 +1,85 @@
+#include "gzip.h"
+#include <cmath>
+#include <cstring>
+#include <time.h>
+
+
+// Compressed output held before the first flush, doubled when a batch needs more.
+#define GZIP_OUT_BYTES (64 * 1024)
+
+
+static long long threadCpuNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+GzipStream::GzipStream(int level)
+	: ready(false), started(false), gzipLevel(level), out(GZIP_OUT_BYTES), used(0), inBytes(0), outBytes(0), cpuNs(0) {
+	memset(&zs, 0, sizeof(zs));
+	// 16 + MAX_WBITS asks zlib for a gzip wrapper instead of raw zlib
+	ready = deflateInit2(&zs, level, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+}
+
+
+GzipStream::~GzipStream() {
+	if (ready)
+		deflateEnd(&zs);
+}
+
+
+bool GzipStream::add(const char *data, size_t len) {
+	if (len == 0)
+		return true;
+	inBytes += len;
+	started = true;
+	return run(data, len, Z_NO_FLUSH);
+}
+
+
+bool GzipStream::flush(bool end) {
+	if (!started)
+		return true;
+	if (!end)
+		return run(nullptr, 0, Z_SYNC_FLUSH);
+	bool ok = run(nullptr, 0, Z_FINISH);
+	started = false;
+	return deflateReset(&zs) == Z_OK && ok;
+}
+
+
+bool GzipStream::run(const char *data, size_t len, int mode) {
+	if (!ready)
+		return false;
+	long long t0 = threadCpuNs();
+	size_t before = used;
+	zs.next_in = (Bytef *)data;
+	zs.avail_in = (uInt)len;
+	bool ok = true;
+	while (true) {
+		if (used == out.size())
+			out.resize(out.size() * 2);
+		zs.next_out = (Bytef *)out.data() + used;
+		zs.avail_out = (uInt)(out.size() - used);
+		int rc = deflate(&zs, mode);
+		used = out.size() - zs.avail_out;
+		// done once zlib has taken all the input and had room left over,
+		// or for Z_FINISH once it has written the trailer
+		if (mode == Z_FINISH ? rc == Z_STREAM_END : zs.avail_in == 0 && zs.avail_out != 0)
+			break;
+		if (rc != Z_OK && !(rc == Z_BUF_ERROR && zs.avail_out == 0)) {
+			ok = false;
+			break;
+		}
+	}
+	outBytes += used - before;
+	cpuNs += threadCpuNs() - t0;
+	return ok;
+}
+
+
+void GzipStream::report(std::ostream &stream, const std::string &name) const {
+	stream << "Gzip " << name << ": level " << gzipLevel << ", " << inBytes << " bytes in, " << outBytes << " out, "
+		<< std::round(ratio() * 10) / 10 << ":1, " << std::round(cpuMsPerMiB() * 100) / 100 << " ms CPU per MiB." << std::endl;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+/*
+
+    GzipStream
+
+    Streaming gzip for the stdout and file outputs, so that line protocol
+    leaves wipry-lp compressed instead of going through a second process.
+
+    Whole batches of lines go in with add(); flush() ends them on a deflate
+    sync flush, which byte-aligns the output and empties zlib's buffers, so
+    a reader that has got everything written so far can decompress every
+    line of it, a partial last batch never.  flush(true) closes the gzip
+    member with its trailer and the next add() starts a new one; gzip
+    readers take the members of a file back to back as one stream, so a
+    file appended to by several runs still reads as a whole.
+
+    The compressed bytes collect in data() until clear().  The buffer only
+    grows, once output is flowing nothing is allocated per batch.
+
+    Used by one thread at a time, the one that writes the output.  The CPU
+    time it takes there is measured on that thread's clock and reported
+    against the bytes it compressed.
+
+*/
+
+
+class GzipStream {
+public:
+	// level 1-9, as gzip's
+	explicit GzipStream(int level);
+	~GzipStream();
+
+	GzipStream(const GzipStream &) = delete;
+	GzipStream &operator=(const GzipStream &) = delete;
+
+	// False if zlib could not be set up, nothing is compressed then.
+	bool valid() const { return ready; }
+
+	bool add(const char *data, size_t len);
+
+	// Ends what was added on a flush boundary, with end the gzip member as well.
+	// Does nothing if nothing was added since the member was last ended.
+	bool flush(bool end = false);
+
+	const char *data() const { return out.data(); }
+	size_t size() const { return used; }
+	void clear() { used = 0; }
+
+	int level() const { return gzipLevel; }
+	unsigned long long bytesIn() const { return inBytes; }
+	unsigned long long bytesOut() const { return outBytes; }
+	double ratio() const { return outBytes != 0 ? (double)inBytes / outBytes : 0; }
+	// CPU time spent compressing per MiB of input.
+	double cpuMsPerMiB() const { return inBytes != 0 ? cpuNs / 1e6 / ((double)inBytes / (1 << 20)) : 0; }
+
+	// "Gzip <name>: level, bytes in and out, ratio, CPU per MiB"
+	void report(std::ostream &stream, const std::string &name) const;
+
+private:
+	bool run(const char *data, size_t len, int mode);
+
+	z_stream zs;
+	bool ready;
+	bool started;				// a member is open
+	int gzipLevel;
+	std::vector<char> out;
+	size_t used;
+	unsigned long long inBytes, outBytes;
+	long long cpuNs;
+};
@@ -0,0 +1,266 @@
+#include "http.h"
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+
+// Retry-After as delta-seconds, or -1 for anything else, an HTTP-date
+// included, so that the caller's own backoff applies.  Capped at a day,
+// which keeps it well clear of overflowing once in milliseconds.
+static int parseRetryAfter(const std::string &value) {
+	size_t end = value.find_last_not_of(" \t");
+	if (end == std::string::npos)
+		return -1;
+	for (size_t i = 0; i <= end; i++) {
+		if (!isdigit((unsigned char)value[i]))
+			return -1;
+	}
+	if (end >= 5)
+		return 86400;
+	int seconds = atoi(value.c_str());
+	return seconds < 86400 ? seconds : 86400;
+}
+
+
+bool HttpUrl::parse(const std::string &url) {
+	const std::string scheme = "http://";
+	if (url.compare(0, scheme.size(), scheme) != 0)
+		return false;
+
+	std::string rest = url.substr(scheme.size());
+	size_t slash = rest.find('/');
+	std::string authority = rest.substr(0, slash);
+	path = slash == std::string::npos ? "" : rest.substr(slash);
+	while (!path.empty() && path[path.size() - 1] == '/')
+		path.erase(path.size() - 1);
+
+	size_t colon = authority.rfind(':');
+	if (colon != std::string::npos && authority.find(']', colon) == std::string::npos) {
+		host = authority.substr(0, colon);
+		port = authority.substr(colon + 1);
+	}
+	else {
+		host = authority;
+		port = "80";
+	}
+	if (host.size() > 2 && host[0] == '[' && host[host.size() - 1] == ']')
+		host = host.substr(1, host.size() - 2);
+
+	return !host.empty() && !port.empty();
+}
+
+
+HttpClient::HttpClient(const HttpUrl &url, int timeoutMs) : target(url), timeoutMs(timeoutMs), fd(-1), inPos(0) {
+}
+
+
+HttpClient::~HttpClient() {
+	disconnect();
+}
+
+
+void HttpClient::disconnect() {
+	if (fd >= 0)
+		close(fd);
+	fd = -1;
+	in.clear();
+	inPos = 0;
+}
+
+
+bool HttpClient::connectSocket() {
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	struct addrinfo *addrs = nullptr;
+	if (getaddrinfo(target.host.c_str(), target.port.c_str(), &hints, &addrs) != 0)
+		return false;
+
+	for (struct addrinfo *a = addrs; a != nullptr; a = a->ai_next) {
+		fd = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+		if (fd < 0)
+			continue;
+
+		struct timeval tv;
+		tv.tv_sec = timeoutMs / 1000;
+		tv.tv_usec = (timeoutMs % 1000) * 1000;
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		if (connect(fd, a->ai_addr, a->ai_addrlen) == 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(addrs);
+	return fd >= 0;
+}
+
+
+bool HttpClient::sendAll(const char *data, size_t len) {
+	while (len > 0) {
+		ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		data += n;
+		len -= n;
+	}
+	return true;
+}
+
+
+bool HttpClient::fill() {
+	if (inPos > 0) {
+		in.erase(0, inPos);
+		inPos = 0;
+	}
+	char buf[4096];
+	for (;;) {
+		ssize_t n = recv(fd, buf, sizeof(buf), 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		in.append(buf, n);
+		return true;
+	}
+}
+
+
+bool HttpClient::readLine(std::string &line) {
+	size_t eol;
+	while ((eol = in.find("\r\n", inPos)) == std::string::npos) {
+		if (!fill())
+			return false;
+	}
+	line.assign(in, inPos, eol - inPos);
+	inPos = eol + 2;
+	return true;
+}
+
+
+bool HttpClient::readBytes(size_t n, std::string &out) {
+	while (in.size() - inPos < n) {
+		if (!fill())
+			return false;
+	}
+	out.append(in, inPos, n);
+	inPos += n;
+	return true;
+}
+
+
+bool HttpClient::readResponse(HttpResponse &response, bool &keepAlive) {
+	std::string line;
+	if (!readLine(line) || line.compare(0, 5, "HTTP/") != 0)
+		return false;
+	size_t space = line.find(' ');
+	if (space == std::string::npos)
+		return false;
+	response.status = atoi(line.c_str() + space + 1);
+	keepAlive = line.compare(0, 8, "HTTP/1.0") != 0;
+
+	long long contentLength = -1;
+	bool chunked = false;
+	while (readLine(line) && !line.empty()) {
+		size_t colon = line.find(':');
+		if (colon == std::string::npos)
+			continue;
+		std::string name = line.substr(0, colon);
+		size_t v = line.find_first_not_of(" \t", colon + 1);
+		std::string value = v == std::string::npos ? "" : line.substr(v);
+
+		if (strcasecmp(name.c_str(), "Content-Length") == 0)
+			contentLength = atoll(value.c_str());
+		else if (strcasecmp(name.c_str(), "Transfer-Encoding") == 0)
+			chunked = strcasestr(value.c_str(), "chunked") != nullptr;
+		else if (strcasecmp(name.c_str(), "Connection") == 0)
+			keepAlive = strcasecmp(value.c_str(), "close") != 0;
+		else if (strcasecmp(name.c_str(), "Retry-After") == 0)
+			response.retryAfter = parseRetryAfter(value);
+	}
+	if (!line.empty())
+		return false;
+
+	if (response.status == 204 || response.status == 304 || response.status / 100 == 1)
+		return true;
+
+	if (chunked) {
+		for (;;) {
+			if (!readLine(line))
+				return false;
+			size_t size = strtoul(line.c_str(), nullptr, 16);
+			if (size == 0)
+				break;
+			if (!readBytes(size, response.body) || !readLine(line))
+				return false;
+		}
+		// trailers
+		while (readLine(line) && !line.empty())
+			;
+		return true;
+	}
+
+	if (contentLength >= 0)
+		return readBytes((size_t)contentLength, response.body);
+
+	// no length, the body runs until the server closes
+	keepAlive = false;
+	response.body.append(in, inPos, std::string::npos);
+	while (fill())
+		;
+	response.body.append(in, inPos, std::string::npos);
+	return true;
+}
+
+
+HttpResponse HttpClient::post(const std::string &path, const std::string &extraHeaders, const char *body, size_t len) {
+	HttpResponse response;
+
+	std::string head = "POST " + target.path + path + " HTTP/1.1\r\n"
+		"Host: " + target.host + ":" + target.port + "\r\n"
+		"Content-Length: " + std::to_string((unsigned long long)len) + "\r\n"
+		"Connection: keep-alive\r\n" +
+		extraHeaders +
+		"\r\n";
+
+	// A kept-alive connection may have been closed by the server while idle,
+	// so a failure on a reused socket gets one more try on a fresh one.
+	for (int attempt = 0; attempt < 2; attempt++) {
+		response.status = -1;
+		response.retryAfter = -1;
+		response.body.clear();
+
+		bool reused = fd >= 0;
+		if (!reused && !connectSocket())
+			return response;
+
+		bool keepAlive = false;
+		if (sendAll(head.data(), head.size()) && sendAll(body, len) && readResponse(response, keepAlive)) {
+			if (!keepAlive)
+				disconnect();
+			return response;
+		}
+
+		disconnect();
+		if (!reused)
+			break;
+	}
+	response.status = -1;
+	return response;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <string>
+
+/*
+
+    HttpClient
+
+    Just enough HTTP/1.1 to POST to a write endpoint over one kept-alive
+    connection.  Plain http:// only; put a local TLS proxy in front of a
+    remote https:// endpoint.
+
+*/
+
+
+struct HttpUrl {
+	std::string host;
+	std::string port;
+	std::string path;	// without a trailing slash
+
+	// Parses http://host[:port][/path].  Returns false for anything else.
+	bool parse(const std::string &url);
+};
+
+
+struct HttpResponse {
+	int status;		// -1 if the request never got a response
+	int retryAfter;		// seconds from a Retry-After header, or -1
+	std::string body;
+};
+
+
+class HttpClient {
+public:
+	HttpClient(const HttpUrl &url, int timeoutMs);
+	~HttpClient();
+
+	// POSTs body to target (path and query) on the open connection, opening a
+	// new one if the server closed it.  extraHeaders is a block of complete
+	// "Name: value\r\n" lines.
+	HttpResponse post(const std::string &target, const std::string &extraHeaders, const char *body, size_t len);
+
+	void disconnect();
+
+	const HttpUrl &url() const { return target; }
+
+private:
+	bool connectSocket();
+	bool sendAll(const char *data, size_t len);
+	bool fill();
+	bool readLine(std::string &line);
+	bool readBytes(size_t n, std::string &out);
+	bool readResponse(HttpResponse &response, bool &keepAlive);
+
+	HttpUrl target;
+	int timeoutMs;
+	int fd;
+	std::string in;
+	size_t inPos;
+};
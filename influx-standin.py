@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+"""
+    influx-standin
+
+    Stands in for the InfluxDB v2 write endpoint so that InfluxSink can be
+    tried without a database.  Every body accepted is un-gzipped and appended
+    to --out.  --fail N=STATUS[:RETRY-AFTER] answers the Nth request with
+    STATUS instead, with a Retry-After header if one is given; it can be
+    repeated.  Each injected failure is logged with how long the client
+    waited before trying again.
+
+    make influx-check runs wipry-lp against it.
+"""
+
+import argparse
+import gzip
+import http.server
+import signal
+import sys
+import time
+
+
+def parseFailure(spec):
+    number, _, answer = spec.partition('=')
+    status, _, retryAfter = answer.partition(':')
+    return int(number), (int(status), retryAfter or None)
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+
+    def log_message(self, *args):
+        pass
+
+    def answer(self, status, body=b'', headers=()):
+        self.send_response(status)
+        for name, value in headers:
+            self.send_header(name, value)
+        self.send_header('Content-Length', str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def do_POST(self):
+        state = self.server.state
+        length = int(self.headers.get('Content-Length', 0))
+        body = self.rfile.read(length)
+        state['requests'] += 1
+        number = state['requests']
+
+        now = time.monotonic()
+        if state['failedAt'] is not None:
+            sys.stderr.write('request %d came %.0f ms after the failure\n' % (number, (now - state['failedAt']) * 1000))
+            state['failedAt'] = None
+
+        if not self.path.startswith('/api/v2/write?'):
+            self.answer(404, b'{"message":"not found"}')
+            return
+
+        failure = state['failures'].get(number)
+        if failure is not None:
+            status, retryAfter = failure
+            sys.stderr.write('request %d: answering %d%s\n' % (number, status, ', Retry-After: ' + retryAfter if retryAfter else ''))
+            state['failed'] += 1
+            state['failedAt'] = now
+            self.answer(status, b'{"message":"injected"}', [('Retry-After', retryAfter)] if retryAfter else [])
+            return
+
+        if self.headers.get('Content-Encoding') == 'gzip':
+            body = gzip.decompress(body)
+        with open(state['out'], 'ab') as out:
+            out.write(body)
+        state['lines'] += body.count(b'\n')
+        self.answer(204)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Stand-in for the InfluxDB v2 write endpoint.')
+    parser.add_argument('--port', type=int, default=8086)
+    parser.add_argument('--out', required=True, help='file the accepted line protocol is appended to')
+    parser.add_argument('--fail', action='append', default=[], metavar='N=STATUS[:RETRY-AFTER]')
+    args = parser.parse_args()
+
+    server = http.server.HTTPServer(('127.0.0.1', args.port), Handler)
+    server.state = {
+        'out': args.out,
+        'failures': dict(parseFailure(spec) for spec in args.fail),
+        'requests': 0,
+        'failed': 0,
+        'lines': 0,
+        'failedAt': None,
+    }
+    open(args.out, 'wb').close()
+
+    def stop(signum, frame):
+        state = server.state
+        sys.stderr.write('%d requests, %d failed on purpose, %d lines accepted\n' % (state['requests'], state['failed'], state['lines']))
+        sys.exit(0)
+
+    signal.signal(signal.SIGTERM, stop)
+    signal.signal(signal.SIGINT, stop)
+    server.serve_forever()
+
+
+if __name__ == '__main__':
+    main()
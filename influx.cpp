@@ -0,0 +1,369 @@
+#include "influx.h"
+#include <cctype>
+#include <cstring>
+#include <iostream>
+
+
+// retries per batch once the sink is being shut down
+#define INFLUX_SHUTDOWN_ATTEMPTS 3
+
+// spool record flag: the payload is already gzipped
+#define INFLUX_SPOOL_GZIP 1
+
+
+static std::string urlEncode(const std::string &s) {
+	static const char hex[] = "0123456789ABCDEF";
+	std::string out;
+	for (size_t i = 0; i < s.size(); i++) {
+		unsigned char c = s[i];
+		if (isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~')
+			out += (char)c;
+		else {
+			out += '%';
+			out += hex[c >> 4];
+			out += hex[c & 15];
+		}
+	}
+	return out;
+}
+
+
+InfluxSink::InfluxSink(const InfluxConfig &aConfig)
+	: config(aConfig), client(aConfig.url, aConfig.timeoutMs), zsReady(false),
+	batches((aConfig.maxBatches > 0 ? aConfig.maxBatches : 1) + 1), current(nullptr),
+	running(false), stopping(false), spool(nullptr), endpointUp(true), probeDelayMs(aConfig.retryMinMs), replayAllowance(0),
+	sent(0), failed(0), retried(0), wireBytes(0), rawBytes(0) {
+
+	if (config.batchLines == 0)
+		config.batchLines = 1;
+
+	path = "/api/v2/write?org=" + urlEncode(config.org) + "&bucket=" + urlEncode(config.bucket) + "&precision=ns";
+
+	headers = "Content-Type: text/plain; charset=utf-8\r\n";
+	if (!config.token.empty())
+		headers += "Authorization: Token " + config.token + "\r\n";
+
+	if (config.gzipLevel != 0) {
+		memset(&zs, 0, sizeof(zs));
+		// 16 + MAX_WBITS asks zlib for a gzip wrapper instead of raw zlib
+		zsReady = deflateInit2(&zs, config.gzipLevel, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+		if (!zsReady)
+			std::cerr << "Unable to initialise gzip, sending uncompressed." << std::endl;
+	}
+	gzipHeaders = headers + "Content-Encoding: gzip\r\n";
+
+	if (!config.spoolDir.empty()) {
+		spool = new Spool(config.spoolDir, config.spoolSegmentBytes, config.spoolMaxBytes);
+		if (!spool->open()) {
+			std::cerr << "Spooling disabled." << std::endl;
+			delete spool;
+			spool = nullptr;
+		}
+	}
+
+	for (size_t i = 0; i + 1 < batches.size(); i++) {
+		batches[i].count = 0;
+		freeBatches.push_back(&batches[i]);
+	}
+	current = &batches.back();
+	current->count = 0;
+}
+
+
+InfluxSink::~InfluxSink() {
+	stop();
+	if (zsReady)
+		deflateEnd(&zs);
+	delete spool;
+}
+
+
+void InfluxSink::start() {
+	std::lock_guard<std::mutex> lock(mtx);
+	if (running)
+		return;
+	running = true;
+	stopping = false;
+	thread = std::thread(&InfluxSink::threadMain, this);
+}
+
+
+void InfluxSink::stop() {
+	shutdown();
+	flush();
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		running = false;
+	}
+	readyCv.notify_all();
+	if (thread.joinable())
+		thread.join();
+}
+
+
+void InfluxSink::shutdown() {
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		stopping = true;
+	}
+	readyCv.notify_all();
+}
+
+
+LineBuffer &InfluxSink::buffer() {
+	return current->lines;
+}
+
+
+void InfluxSink::linesAdded(unsigned int lines) {
+	if (lines == 0)
+		return;
+	if (current->count == 0)
+		firstPending = std::chrono::steady_clock::now();
+	current->count += lines;
+
+	if (current->count >= config.batchLines)
+		submit();
+	else
+		poll();
+}
+
+
+void InfluxSink::poll() {
+	if (current->count == 0 || config.flushMs == 0)
+		return;
+	if (std::chrono::steady_clock::now() - firstPending >= std::chrono::milliseconds(config.flushMs))
+		submit();
+}
+
+
+void InfluxSink::submit() {
+	std::unique_lock<std::mutex> lock(mtx);
+	// This is where backpressure happens: with every batch queued or in
+	// flight the writer thread waits here and the frame ring absorbs it.
+	freeCv.wait(lock, [this] { return !freeBatches.empty(); });
+	readyBatches.push_back(current);
+	current = freeBatches.back();
+	freeBatches.pop_back();
+	lock.unlock();
+	readyCv.notify_one();
+}
+
+
+bool InfluxSink::flush() {
+	if (current->count > 0)
+		submit();
+
+	std::unique_lock<std::mutex> lock(mtx);
+	if (running)
+		freeCv.wait(lock, [this] { return readyBatches.empty(); });
+	return failed.load() == 0;
+}
+
+
+bool InfluxSink::sleepFor(unsigned int ms) {
+	std::unique_lock<std::mutex> lock(mtx);
+	return !readyCv.wait_for(lock, std::chrono::milliseconds(ms), [this] { return stopping; });
+}
+
+
+bool InfluxSink::compress(const LineBuffer &lines) {
+	if (deflateReset(&zs) != Z_OK)
+		return false;
+	gz.resize(deflateBound(&zs, lines.size()));
+	zs.next_in = (Bytef *)lines.data();
+	zs.avail_in = (uInt)lines.size();
+	zs.next_out = (Bytef *)gz.data();
+	zs.avail_out = (uInt)gz.size();
+	if (deflate(&zs, Z_FINISH) != Z_STREAM_END)
+		return false;
+	gz.resize(zs.total_out);
+	return true;
+}
+
+
+InfluxSink::PostResult InfluxSink::post(const char *body, size_t len, bool gzipped, unsigned int lines, int &retryAfter) {
+	HttpResponse response = client.post(path, gzipped ? gzipHeaders : headers, body, len);
+	retryAfter = response.retryAfter;
+
+	if (response.status / 100 == 2) {
+		sent.fetch_add(1, std::memory_order_relaxed);
+		wireBytes.fetch_add(len, std::memory_order_relaxed);
+		return Sent;
+	}
+
+	if (response.status < 0 || response.status == 429 || response.status >= 500)
+		return Retry;
+
+	std::cerr << "InfluxDB rejected batch";
+	if (lines > 0)
+		std::cerr << " of " << lines << " lines";
+	std::cerr << " with status " << response.status << ": " << response.body.substr(0, 200) << std::endl;
+	failed.fetch_add(1, std::memory_order_relaxed);
+	return Rejected;
+}
+
+
+bool InfluxSink::send(Batch &batch) {
+	const char *body = batch.lines.data();
+	size_t len = batch.lines.size();
+	if (zsReady) {
+		if (!compress(batch.lines)) {
+			std::cerr << "gzip failed, dropping batch of " << batch.count << " lines." << std::endl;
+			failed.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		body = gz.data();
+		len = gz.size();
+	}
+	rawBytes.fetch_add(batch.lines.size(), std::memory_order_relaxed);
+
+	int retryAfter;
+	if (spool != nullptr) {
+		if (endpointUp) {
+			PostResult result = post(body, len, zsReady, batch.count, retryAfter);
+			if (result != Retry)
+				return result == Sent;
+			endpointDown(retryAfter);
+		}
+		if (!spool->append(body, len, zsReady ? INFLUX_SPOOL_GZIP : 0)) {
+			failed.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		return true;
+	}
+
+	unsigned int delayMs = config.retryMinMs;
+	for (int attempt = 1; ; attempt++) {
+		PostResult result = post(body, len, zsReady, batch.count, retryAfter);
+		if (result != Retry)
+			return result == Sent;
+
+		bool giveUp;
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			giveUp = stopping && attempt >= INFLUX_SHUTDOWN_ATTEMPTS;
+		}
+		if (giveUp) {
+			std::cerr << "Giving up on batch of " << batch.count << " lines." << std::endl;
+			failed.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		unsigned int waitMs = retryAfter >= 0 ? retryAfter * 1000 : delayMs;
+		if (waitMs > config.retryMaxMs)
+			waitMs = config.retryMaxMs;
+		std::cerr << "InfluxDB write failed, retrying in " << waitMs << " ms" << std::endl;
+		retried.fetch_add(1, std::memory_order_relaxed);
+
+		sleepFor(waitMs);
+		delayMs = delayMs * 2 < config.retryMaxMs ? delayMs * 2 : config.retryMaxMs;
+	}
+}
+
+
+void InfluxSink::endpointDown(int retryAfter) {
+	if (endpointUp)
+		std::cerr << "InfluxDB unavailable, spooling to " << config.spoolDir << std::endl;
+	endpointUp = false;
+	retried.fetch_add(1, std::memory_order_relaxed);
+
+	unsigned int waitMs = retryAfter >= 0 ? retryAfter * 1000 : probeDelayMs;
+	if (waitMs > config.retryMaxMs)
+		waitMs = config.retryMaxMs;
+	nextProbe = std::chrono::steady_clock::now() + std::chrono::milliseconds(waitMs);
+	probeDelayMs = probeDelayMs * 2 < config.retryMaxMs ? probeDelayMs * 2 : config.retryMaxMs;
+}
+
+
+std::chrono::steady_clock::time_point InfluxSink::spoolWakeTime() {
+	const char *data;
+	size_t len;
+	uint32_t flags;
+	if (spool == nullptr || !spool->peek(data, len, flags))
+		return std::chrono::steady_clock::time_point::max();
+	if (!endpointUp)
+		return nextProbe;
+	if (replayAllowance >= len || config.replayBytesPerSec == 0)
+		return std::chrono::steady_clock::now();
+	double seconds = (len - replayAllowance) / config.replayBytesPerSec;
+	return lastRefill + std::chrono::microseconds((long long)(seconds * 1e6) + 1);
+}
+
+
+// Probes a down endpoint with the oldest spooled batch, or replays it if the
+// endpoint is up and the catch-up rate allows.  Sender thread only.
+void InfluxSink::serviceSpool() {
+	const char *data;
+	size_t len;
+	uint32_t flags;
+	if (spool == nullptr || !spool->peek(data, len, flags))
+		return;
+
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (!endpointUp) {
+		if (now < nextProbe)
+			return;
+	}
+	else if (config.replayBytesPerSec > 0) {
+		// token bucket, never holding more than a second's worth or one batch
+		replayAllowance += std::chrono::duration<double>(now - lastRefill).count() * config.replayBytesPerSec;
+		double cap = len > config.replayBytesPerSec ? len : config.replayBytesPerSec;
+		if (replayAllowance > cap)
+			replayAllowance = cap;
+		lastRefill = now;
+		if (replayAllowance < len)
+			return;
+	}
+
+	int retryAfter;
+	PostResult result = post(data, len, (flags & INFLUX_SPOOL_GZIP) != 0, 0, retryAfter);
+	if (result == Retry) {
+		endpointDown(retryAfter);
+		return;
+	}
+
+	if (!endpointUp) {
+		std::cerr << "InfluxDB is back, replaying " << spool->recordsPending() << " spooled batches." << std::endl;
+		endpointUp = true;
+		probeDelayMs = config.retryMinMs;
+		replayAllowance = 0;
+		lastRefill = now;
+	}
+	else
+		replayAllowance -= len;
+	spool->consume();
+}
+
+
+void InfluxSink::threadMain() {
+	std::unique_lock<std::mutex> lock(mtx);
+	for (;;) {
+		if (readyBatches.empty() && running) {
+			std::chrono::steady_clock::time_point wake = spoolWakeTime();
+			if (wake == std::chrono::steady_clock::time_point::max())
+				readyCv.wait(lock, [this] { return !readyBatches.empty() || !running; });
+			else
+				readyCv.wait_until(lock, wake, [this] { return !readyBatches.empty() || !running; });
+		}
+		// whatever is still spooled stays on disk for the next run
+		if (readyBatches.empty() && !running)
+			break;
+
+		Batch *batch = readyBatches.empty() ? nullptr : readyBatches.front();
+		lock.unlock();
+
+		if (batch != nullptr)
+			send(*batch);
+		serviceSpool();
+
+		lock.lock();
+		if (batch != nullptr) {
+			readyBatches.erase(readyBatches.begin());
+			batch->lines.clear();
+			batch->count = 0;
+			freeBatches.push_back(batch);
+			freeCv.notify_all();
+		}
+	}
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#include "sink.h"
+#include "http.h"
+#include "spool.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <zlib.h>
+
+/*
+
+    InfluxSink
+
+    Ships batches of line protocol to an InfluxDB v2 /api/v2/write endpoint.
+
+    The writer thread fills the current batch; once it holds batchLines lines
+    or its oldest line is flushMs old it is queued for the sender thread,
+    which gzips it and POSTs it over a kept-alive connection.  429, 5xx and
+    network errors are retried with exponential backoff (or the server's
+    Retry-After); other 4xx responses drop the batch.
+
+    Only maxBatches batches can be queued.  When they are all in flight the
+    writer thread blocks in linesAdded(), the FrameWriter ring fills up and its
+    overflow policy decides which sweeps are lost.  The device callback never
+    waits on the network.
+
+    With a spool directory configured, a batch that fails with a retryable
+    error is written to the Spool instead, and so is every batch after it
+    until a probe of the oldest spooled batch succeeds.  Spooled batches are
+    then replayed oldest first, limited to replayBytesPerSec, alongside the
+    live ones.
+
+*/
+
+
+struct InfluxConfig {
+	HttpUrl url;
+	std::string org;
+	std::string bucket;
+	std::string token;
+
+	unsigned int batchLines;
+	unsigned int flushMs;
+	unsigned int maxBatches;
+	int gzipLevel;			// 0 sends the batch uncompressed
+
+	unsigned int retryMinMs;
+	unsigned int retryMaxMs;
+	int timeoutMs;
+
+	std::string spoolDir;		// empty disables spooling
+	size_t spoolSegmentBytes;
+	size_t spoolMaxBytes;
+	size_t replayBytesPerSec;
+
+	InfluxConfig() : batchLines(1000), flushMs(1000), maxBatches(4), gzipLevel(Z_DEFAULT_COMPRESSION),
+		retryMinMs(250), retryMaxMs(30000), timeoutMs(10000),
+		spoolSegmentBytes(16 << 20), spoolMaxBytes(256 << 20), replayBytesPerSec(1 << 20) {}
+};
+
+
+class InfluxSink : public Sink {
+public:
+	explicit InfluxSink(const InfluxConfig &config);
+	~InfluxSink();
+
+	void start();
+
+	// From here on a failing endpoint only gets a few more tries per batch, so
+	// that a writer thread blocked on a dead endpoint can finish.  Safe to call
+	// from any thread.
+	void shutdown();
+
+	// Shuts down, waits for the queued batches to be sent and stops the
+	// sender thread.  Batches that still fail are given up after a few tries.
+	void stop();
+
+	LineBuffer &buffer();
+	void linesAdded(unsigned int lines);
+	void poll();
+	// Waits for every batch so far to be sent or given up; retries as
+	// usual unless shutdown() was called.
+	bool flush();
+	unsigned long long bytesOut() const { return bytesSent(); }
+
+	unsigned long long batchesSent() const { return sent.load(std::memory_order_relaxed); }
+	unsigned long long batchesDropped() const { return failed.load(std::memory_order_relaxed); }
+	unsigned long long retries() const { return retried.load(std::memory_order_relaxed); }
+	unsigned long long bytesSent() const { return wireBytes.load(std::memory_order_relaxed); }
+	unsigned long long bytesBeforeGzip() const { return rawBytes.load(std::memory_order_relaxed); }
+
+	// nullptr without a spool directory
+	const Spool *spoolStore() const { return spool; }
+
+private:
+	struct Batch {
+		LineBuffer lines;
+		unsigned int count;
+	};
+
+	enum PostResult {
+		Sent,
+		Rejected,
+		Retry
+	};
+
+	void submit();
+	void threadMain();
+	bool send(Batch &batch);
+	PostResult post(const char *body, size_t len, bool gzipped, unsigned int lines, int &retryAfter);
+	bool compress(const LineBuffer &lines);
+	bool sleepFor(unsigned int ms);
+
+	void endpointDown(int retryAfter);
+	void serviceSpool();
+	std::chrono::steady_clock::time_point spoolWakeTime();
+
+	InfluxConfig config;
+	std::string path;
+	std::string headers;
+	std::string gzipHeaders;
+	HttpClient client;
+	z_stream zs;
+	bool zsReady;
+	std::vector<char> gz;
+
+	std::vector<Batch> batches;
+	std::vector<Batch *> freeBatches;
+	std::vector<Batch *> readyBatches;	// oldest first
+	Batch *current;
+	std::chrono::steady_clock::time_point firstPending;
+
+	std::thread thread;
+	std::mutex mtx;
+	std::condition_variable readyCv;
+	std::condition_variable freeCv;
+	bool running;
+	bool stopping;
+
+	// spool state, sender thread only
+	Spool *spool;
+	bool endpointUp;
+	unsigned int probeDelayMs;
+	std::chrono::steady_clock::time_point nextProbe;
+	double replayAllowance;
+	std::chrono::steady_clock::time_point lastRefill;
+
+	std::atomic<unsigned long long> sent;
+	std::atomic<unsigned long long> failed;
+	std::atomic<unsigned long long> retried;
+	std::atomic<unsigned long long> wireBytes;
+	std::atomic<unsigned long long> rawBytes;
+};
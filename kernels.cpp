@@ -0,0 +1,293 @@
+#include "kernels.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define KERNELS_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define KERNELS_NEON 1
+#endif
+
+
+static inline int8_t saturate8(int v) {
+	return (int8_t)(v < -128 ? -128 : v > 127 ? 127 : v);
+}
+
+
+void scalarQuantize8(const float *in, int8_t *out, unsigned int n) {
+	for (unsigned int i = 0; i < n; i++)
+		out[i] = saturate8((int)in[i]);
+}
+
+
+void scalarStats(const int8_t *in, unsigned int n, float evenFloor, float oddFloor, KernelStats &stats) {
+	int min = in[0], max = in[0], sum = 0;
+	unsigned int above = 0;
+	for (unsigned int i = 0; i < n; i++) {
+		int v = in[i];
+		if (v < min)
+			min = v;
+		if (v > max)
+			max = v;
+		sum += v;
+		if (v > ((i & 1) ? oddFloor : evenFloor))
+			above++;
+	}
+	stats.min = min;
+	stats.max = max;
+	stats.sum = sum;
+	stats.above = above;
+}
+
+
+#if defined(KERNELS_X86) || defined(KERNELS_NEON)
+
+// The tail of a vector loop, from index i on, folded into stats.
+static void finishStats(const int8_t *in, unsigned int i, unsigned int n, float evenFloor, float oddFloor, KernelStats &stats) {
+	for (; i < n; i++) {
+		int v = in[i];
+		if (v < stats.min)
+			stats.min = v;
+		if (v > stats.max)
+			stats.max = v;
+		stats.sum += v;
+		if (v > ((i & 1) ? oddFloor : evenFloor))
+			stats.above++;
+	}
+}
+
+
+// The byte the vector compares use for a floor: v > floor is v > threshold
+// for whole dB.  False for a floor below -128 or NaN, which has none.
+static bool threshold8(float floor, int8_t &threshold) {
+	if (!(floor >= -128.0f))
+		return false;
+	threshold = floor >= 127.0f ? 127 : (int8_t)floorf(floor);
+	return true;
+}
+
+#endif
+
+
+#ifdef KERNELS_X86
+
+static void sse2Quantize8(const float *in, int8_t *out, unsigned int n) {
+	unsigned int i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m128i a = _mm_cvttps_epi32(_mm_loadu_ps(in + i));
+		__m128i b = _mm_cvttps_epi32(_mm_loadu_ps(in + i + 4));
+		__m128i c = _mm_cvttps_epi32(_mm_loadu_ps(in + i + 8));
+		__m128i d = _mm_cvttps_epi32(_mm_loadu_ps(in + i + 12));
+		// both packs saturate, which is the clamp
+		__m128i bytes = _mm_packs_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+		_mm_storeu_si128((__m128i *)(out + i), bytes);
+	}
+	scalarQuantize8(in + i, out + i, n - i);
+}
+
+
+static void sse2Stats(const int8_t *in, unsigned int n, float evenFloor, float oddFloor, KernelStats &stats) {
+	int8_t evenThreshold, oddThreshold;
+	if (n < 16 || !threshold8(evenFloor, evenThreshold) || !threshold8(oddFloor, oddThreshold)) {
+		scalarStats(in, n, evenFloor, oddFloor, stats);
+		return;
+	}
+	// SSE2 has min, max and sums of unsigned bytes only, flipping the sign bit
+	// maps -128..127 onto 0..255 in order
+	const __m128i bias = _mm_set1_epi8((char)0x80);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i floor = _mm_set1_epi16((short)((uint8_t)evenThreshold | ((uint8_t)oddThreshold << 8)));
+	__m128i min = _mm_set1_epi8((char)0xff), max = zero, sum = zero;
+	unsigned int above = 0;
+	unsigned int i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+		__m128i u = _mm_xor_si128(v, bias);
+		min = _mm_min_epu8(min, u);
+		max = _mm_max_epu8(max, u);
+		sum = _mm_add_epi64(sum, _mm_sad_epu8(u, zero));
+		above += __builtin_popcount(_mm_movemask_epi8(_mm_cmpgt_epi8(v, floor)));
+	}
+	uint8_t lanes[16];
+	_mm_storeu_si128((__m128i *)lanes, min);
+	uint8_t low = lanes[0];
+	for (int l = 1; l < 16; l++)
+		low = lanes[l] < low ? lanes[l] : low;
+	_mm_storeu_si128((__m128i *)lanes, max);
+	uint8_t high = lanes[0];
+	for (int l = 1; l < 16; l++)
+		high = lanes[l] > high ? lanes[l] : high;
+	long long sums[2];
+	_mm_storeu_si128((__m128i *)sums, sum);
+	stats.min = (int)low - 128;
+	stats.max = (int)high - 128;
+	stats.sum = (int)(sums[0] + sums[1] - 128LL * i);
+	stats.above = above;
+	finishStats(in, i, n, evenFloor, oddFloor, stats);
+}
+
+
+__attribute__((target("avx2")))
+static void avx2Quantize8(const float *in, int8_t *out, unsigned int n) {
+	// the packs work within 128-bit lanes, this puts the 4-byte groups back in order
+	const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	unsigned int i = 0;
+	for (; i + 32 <= n; i += 32) {
+		__m256i a = _mm256_cvttps_epi32(_mm256_loadu_ps(in + i));
+		__m256i b = _mm256_cvttps_epi32(_mm256_loadu_ps(in + i + 8));
+		__m256i c = _mm256_cvttps_epi32(_mm256_loadu_ps(in + i + 16));
+		__m256i d = _mm256_cvttps_epi32(_mm256_loadu_ps(in + i + 24));
+		__m256i bytes = _mm256_packs_epi16(_mm256_packs_epi32(a, b), _mm256_packs_epi32(c, d));
+		_mm256_storeu_si256((__m256i *)(out + i), _mm256_permutevar8x32_epi32(bytes, order));
+	}
+	// the tails run non-VEX code, clear the upper halves first to avoid the transition stall
+	_mm256_zeroupper();
+	sse2Quantize8(in + i, out + i, n - i);
+}
+
+
+__attribute__((target("avx2,popcnt")))
+static void avx2Stats(const int8_t *in, unsigned int n, float evenFloor, float oddFloor, KernelStats &stats) {
+	int8_t evenThreshold, oddThreshold;
+	if (n < 32 || !threshold8(evenFloor, evenThreshold) || !threshold8(oddFloor, oddThreshold)) {
+		sse2Stats(in, n, evenFloor, oddFloor, stats);
+		return;
+	}
+	// the sums still go through the unsigned bytes of psadbw
+	const __m256i bias = _mm256_set1_epi8((char)0x80);
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i floor = _mm256_set1_epi16((short)((uint8_t)evenThreshold | ((uint8_t)oddThreshold << 8)));
+	__m256i min = _mm256_loadu_si256((const __m256i *)in), max = min, sum = zero;
+	unsigned int above = 0;
+	unsigned int i = 0;
+	for (; i + 32 <= n; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(in + i));
+		min = _mm256_min_epi8(min, v);
+		max = _mm256_max_epi8(max, v);
+		sum = _mm256_add_epi64(sum, _mm256_sad_epu8(_mm256_xor_si256(v, bias), zero));
+		above += _mm_popcnt_u32((unsigned int)_mm256_movemask_epi8(_mm256_cmpgt_epi8(v, floor)));
+	}
+	int8_t lanes[32];
+	_mm256_storeu_si256((__m256i *)lanes, min);
+	int low = lanes[0];
+	for (int l = 1; l < 32; l++)
+		low = lanes[l] < low ? lanes[l] : low;
+	_mm256_storeu_si256((__m256i *)lanes, max);
+	int high = lanes[0];
+	for (int l = 1; l < 32; l++)
+		high = lanes[l] > high ? lanes[l] : high;
+	long long sums[4];
+	_mm256_storeu_si256((__m256i *)sums, sum);
+	stats.min = low;
+	stats.max = high;
+	stats.sum = (int)(sums[0] + sums[1] + sums[2] + sums[3] - 128LL * i);
+	stats.above = above;
+	_mm256_zeroupper();
+	finishStats(in, i, n, evenFloor, oddFloor, stats);
+}
+
+#endif
+
+
+#ifdef KERNELS_NEON
+
+static void neonQuantize8(const float *in, int8_t *out, unsigned int n) {
+	unsigned int i = 0;
+	for (; i + 16 <= n; i += 16) {
+		int32x4_t a = vcvtq_s32_f32(vld1q_f32(in + i));
+		int32x4_t b = vcvtq_s32_f32(vld1q_f32(in + i + 4));
+		int32x4_t c = vcvtq_s32_f32(vld1q_f32(in + i + 8));
+		int32x4_t d = vcvtq_s32_f32(vld1q_f32(in + i + 12));
+		// the saturating narrows are the clamp
+		int16x8_t ab = vcombine_s16(vqmovn_s32(a), vqmovn_s32(b));
+		int16x8_t cd = vcombine_s16(vqmovn_s32(c), vqmovn_s32(d));
+		vst1q_s8(out + i, vcombine_s8(vqmovn_s16(ab), vqmovn_s16(cd)));
+	}
+	scalarQuantize8(in + i, out + i, n - i);
+}
+
+
+static void neonStats(const int8_t *in, unsigned int n, float evenFloor, float oddFloor, KernelStats &stats) {
+	int8_t evenThreshold, oddThreshold;
+	if (n < 16 || !threshold8(evenFloor, evenThreshold) || !threshold8(oddFloor, oddThreshold)) {
+		scalarStats(in, n, evenFloor, oddFloor, stats);
+		return;
+	}
+	int8_t floors[16];
+	for (int l = 0; l < 16; l += 2) {
+		floors[l] = evenThreshold;
+		floors[l + 1] = oddThreshold;
+	}
+	int8x16_t floor = vld1q_s8(floors);
+	int8x16_t min = vld1q_s8(in), max = min;
+	int32x4_t sum = vdupq_n_s32(0);
+	unsigned int above = 0;
+	unsigned int i = 0;
+	for (; i + 16 <= n; i += 16) {
+		int8x16_t v = vld1q_s8(in + i);
+		min = vminq_s8(min, v);
+		max = vmaxq_s8(max, v);
+		sum = vpadalq_s16(sum, vpaddlq_s8(v));
+		// a true compare is all ones, its top bit counts one
+		above += vaddvq_u8(vshrq_n_u8(vcgtq_s8(v, floor), 7));
+	}
+	stats.min = vminvq_s8(min);
+	stats.max = vmaxvq_s8(max);
+	stats.sum = vaddvq_s32(sum);
+	stats.above = above;
+	finishStats(in, i, n, evenFloor, oddFloor, stats);
+}
+
+#endif
+
+
+struct KernelTable {
+	const char *name;
+	void (*quantize8)(const float *, int8_t *, unsigned int);
+	void (*stats)(const int8_t *, unsigned int, float, float, KernelStats &);
+};
+
+
+static KernelTable pickKernels() {
+	const char *forced = getenv("WIPRY_KERNELS");
+	if (forced == nullptr || strcmp(forced, "scalar") != 0) {
+#if defined(KERNELS_X86)
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+			KernelTable table = { "avx2", avx2Quantize8, avx2Stats };
+			return table;
+		}
+		KernelTable table = { "sse2", sse2Quantize8, sse2Stats };
+		return table;
+#elif defined(KERNELS_NEON)
+		KernelTable table = { "neon", neonQuantize8, neonStats };
+		return table;
+#endif
+	}
+	KernelTable table = { "scalar", scalarQuantize8, scalarStats };
+	return table;
+}
+
+
+static const KernelTable &kernels() {
+	static const KernelTable table = pickKernels();
+	return table;
+}
+
+
+const char *kernelName() {
+	return kernels().name;
+}
+
+
+void kernelQuantize8(const float *in, int8_t *out, unsigned int n) {
+	kernels().quantize8(in, out, n);
+}
+
+
+void kernelStats(const int8_t *in, unsigned int n, float evenFloor, float oddFloor, KernelStats &stats) {
+	kernels().stats(in, n, evenFloor, oddFloor, stats);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+
+    Kernels
+
+    The per-bin loops of the output path: the library's RSSI floats
+    quantized to the int8 frames everything after the queue works on, and
+    min/max/sum/above-floor reductions over a range of those bins.
+
+    Each has a scalar version and vector versions for NEON (arm64) and
+    SSE2/AVX2 (x86-64).  The kernel* functions use the best one for the CPU,
+    picked once at first use; AVX2 is detected at run time, so the same
+    binary runs on older x86 machines.  Setting WIPRY_KERNELS=scalar in the
+    environment forces the scalar versions.
+
+    Every path gives the same results, the sums of whole dB included.
+
+*/
+
+
+struct KernelStats {
+	int min;
+	int max;
+	int sum;
+	unsigned int above;	// values greater than their noise floor
+};
+
+
+// "avx2", "sse2", "neon" or "scalar".
+const char *kernelName();
+
+// out[i] = (int)in[i] clamped to -128..127
+void kernelQuantize8(const float *in, int8_t *out, unsigned int n);
+
+// Stats of in[0..n).  in[0], in[2], ... are compared with evenFloor, the
+// others with oddFloor; swap them for a range that starts on an odd bin.
+// n must be at least 1.
+void kernelStats(const int8_t *in, unsigned int n, float evenFloor, float oddFloor, KernelStats &stats);
+
+
+// The scalar versions, always available.
+void scalarQuantize8(const float *in, int8_t *out, unsigned int n);
+void scalarStats(const int8_t *in, unsigned int n, float evenFloor, float oddFloor, KernelStats &stats);
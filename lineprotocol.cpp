@@ -0,0 +1,435 @@
+#include "lineprotocol.h"
+#include <cstdio>
+
+
+static const char digitPairs[201] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+
+char *formatInt(char *p, long long v) {
+	unsigned long long u;
+	if (v < 0) {
+		*p++ = '-';
+		u = 0ULL - (unsigned long long)v;
+	}
+	else
+		u = (unsigned long long)v;
+
+	// RSSI values are one to three digits, handle those without the loop below
+	if (u < 10) {
+		*p++ = (char)('0' + u);
+		return p;
+	}
+	if (u < 100) {
+		memcpy(p, &digitPairs[u * 2], 2);
+		return p + 2;
+	}
+
+	char tmp[20];
+	char *t = tmp + sizeof(tmp);
+	while (u >= 100) {
+		t -= 2;
+		memcpy(t, &digitPairs[(u % 100) * 2], 2);
+		u /= 100;
+	}
+	if (u >= 10) {
+		t -= 2;
+		memcpy(t, &digitPairs[u * 2], 2);
+	}
+	else
+		*--t = (char)('0' + u);
+
+	size_t n = tmp + sizeof(tmp) - t;
+	memcpy(p, t, n);
+	return p + n;
+}
+
+
+void LineBuffer::appendInt(long long v) {
+	char *p = reserve(20);
+	len += formatInt(p, v) - p;
+}
+
+
+bool parseLineSchema(const std::string &name, LineSchema &schema) {
+	if (name == "wide")
+		schema = LineSchema::Wide;
+	else if (name == "narrow")
+		schema = LineSchema::Narrow;
+	else if (name == "packed")
+		schema = LineSchema::Packed;
+	else
+		return false;
+	return true;
+}
+
+
+static const char base64Digits[65] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Writes n bytes as padded base64 at p and returns the end.  p needs 4 * ((n + 2) / 3) bytes.
+static char *formatBase64(char *p, const uint8_t *in, size_t n) {
+	size_t i = 0;
+	for (; i + 3 <= n; i += 3) {
+		uint32_t v = (uint32_t)in[i] << 16 | (uint32_t)in[i + 1] << 8 | in[i + 2];
+		p[0] = base64Digits[v >> 18];
+		p[1] = base64Digits[(v >> 12) & 63];
+		p[2] = base64Digits[(v >> 6) & 63];
+		p[3] = base64Digits[v & 63];
+		p += 4;
+	}
+	if (i < n) {
+		uint32_t v = (uint32_t)in[i] << 16 | (i + 1 < n ? (uint32_t)in[i + 1] << 8 : 0);
+		p[0] = base64Digits[v >> 18];
+		p[1] = base64Digits[(v >> 12) & 63];
+		p[2] = i + 1 < n ? base64Digits[(v >> 6) & 63] : '=';
+		p[3] = '=';
+		p += 4;
+	}
+	return p;
+}
+
+
+LineProtocolSerializer::LineProtocolSerializer() : schema(LineSchema::Wide), sweepFields(false), frame(nullptr), dualSplit(0), dualCount(0), dualPoints2(0),
+	deadband(-1), keyframeSweeps(0), keyframeNs(0), fieldsSeen(0), fieldsWritten(0), keyframesWritten(0), linesSkipped(0) {
+	const char names[3] = { '2', '5', '6' };
+	for (int i = 0; i < 3; i++) {
+		bands[i].name = names[i];
+		bands[i].valid = false;
+		bands[i].freqLow = 0;
+		bands[i].freqHigh = 0;
+		bands[i].count = 0;
+		bands[i].windowFirst = 0;
+		bands[i].windowWidth = 0;
+		bands[i].sinceKeyframe = 0;
+		bands[i].keyframeTimens = 0;
+	}
+}
+
+
+void LineProtocolSerializer::setSerial(const std::string &aSerial) {
+	serial = aSerial;
+	for (int i = 0; i < 3; i++)
+		bands[i].count = 0;
+	dualCount = 0;
+}
+
+
+void LineProtocolSerializer::setSchema(LineSchema aSchema) {
+	schema = aSchema;
+	for (int i = 0; i < 3; i++)
+		bands[i].count = 0;
+}
+
+
+void LineProtocolSerializer::setDeadband(float dB, unsigned int aKeyframeSweeps, unsigned int keyframeMs) {
+	// values are whole dB, so |change| > dB is |change| > floor(dB)
+	deadband = dB < 0 ? -1 : (int)dB;
+	keyframeSweeps = aKeyframeSweeps;
+	keyframeNs = (long long)keyframeMs * 1000000;
+	for (int i = 0; i < 3; i++)
+		bands[i].lastSent.clear();
+}
+
+
+void LineProtocolSerializer::setDualSplit(unsigned int points) {
+	dualSplit = points;
+	dualCount = 0;
+}
+
+
+void LineProtocolSerializer::setBoundary(oscium::WiPryClarity::DataType dataType, float freqLow, float freqHigh) {
+	BandKeys *band = bandFor(dataType);
+	if (band == nullptr)
+		return;
+	band->valid = true;
+	band->freqLow = freqLow;
+	band->freqHigh = freqHigh;
+	band->count = 0;
+	dualCount = 0;
+}
+
+
+void LineProtocolSerializer::setWindow(oscium::WiPryClarity::DataType dataType, unsigned int first, unsigned int width) {
+	BandKeys *band = bandFor(dataType);
+	if (band == nullptr)
+		return;
+	band->windowFirst = first;
+	band->windowWidth = width;
+	// the packed prefix starts at the window
+	band->count = 0;
+}
+
+
+LineProtocolSerializer::BandKeys *LineProtocolSerializer::bandFor(oscium::WiPryClarity::DataType dataType) {
+	switch (dataType)
+	{
+		case oscium::WiPryClarity::DataType::RSSI_2_4GHZ:
+			return &bands[0];
+		case oscium::WiPryClarity::DataType::RSSI_5GHZ:
+			return &bands[1];
+		case oscium::WiPryClarity::DataType::RSSI_6E:
+			return &bands[2];
+		default:
+			return nullptr;
+	}
+}
+
+
+void LineProtocolSerializer::buildKeys(BandKeys &band, unsigned int count) {
+	switch (schema) {
+		case LineSchema::Wide:
+			band.prefix = "wipry,serial=" + serial + ",band=" + band.name + " ";
+			break;
+		case LineSchema::Narrow:
+			band.prefix = "wipry_bin,serial=" + serial + ",band=" + band.name + ",bin=";
+			break;
+		case LineSchema::Packed:
+			band.prefix = "wipry_packed,serial=" + serial + ",band=" + band.name + " start=";
+			break;
+	}
+	band.lastSent.clear();
+	band.keys.clear();
+	band.offsets.clear();
+	band.offsets.push_back(0);
+
+	// Same arithmetic and the same "%g" rendering std::ostream gives a float,
+	// so the keys match the original per-point formatting byte for byte.
+	// The volatile keeps the compiler from fusing the multiply-add, which
+	// would round differently on arm64.
+	float stepsize = ( (band.freqHigh - band.freqLow) / (int)count );
+	char key[64];
+	if (schema == LineSchema::Packed) {
+		// only the first bin's frequency and the step, the keys stay empty
+		volatile float offset = (band.windowWidth != 0 ? band.windowFirst : 0) * stepsize;
+		float freq = band.freqLow + offset;
+		int n = snprintf(key, sizeof(key), "%g,step=%g,rssi=\"", (double)freq, (double)stepsize);
+		band.prefix.append(key, n);
+		band.count = count;
+		return;
+	}
+	for (int p = 0; p < (int)count; p++) {
+		volatile float offset = p * stepsize;
+		float freq = band.freqLow + offset;
+		int n = schema == LineSchema::Narrow
+			? snprintf(key, sizeof(key), "%d freq=%g,rssi=", p, (double)freq)
+			: snprintf(key, sizeof(key), "%g=", (double)freq);
+		band.keys.insert(band.keys.end(), key, key + n);
+		band.offsets.push_back((unsigned int)band.keys.size());
+	}
+	band.count = count;
+}
+
+
+// Returns the lines written, none if the band's window lies outside the sweep
+// or no bin passed the deadband.
+unsigned int LineProtocolSerializer::writeLine(BandKeys &band, const int8_t *points, unsigned int count, long long timens, LineBuffer &out) {
+	unsigned int first = 0, end = count;
+	if (band.windowWidth != 0) {
+		first = band.windowFirst;
+		end = first + band.windowWidth;
+		if (end > count)
+			end = count;
+		if (first >= end)
+			return 0;
+	}
+	if (band.count != count)
+		buildKeys(band, count);
+	if (schema == LineSchema::Packed)
+		return writePacked(band, points, first, end, timens, out);
+
+	const int8_t *value = points;
+	const char *keys = band.keys.data();
+	const unsigned int *offsets = band.offsets.data();
+
+	// longest key, longest value and a comma per point, plus prefix, sweep fields and timestamp
+	size_t worst = band.prefix.size() + (band.offsets[end] - band.offsets[first]) + (end - first) * 13 + 24 + (sweepFields ? 80 : 0);
+	char *start = out.reserve(worst);
+	char *p = start;
+
+	memcpy(p, band.prefix.data(), band.prefix.size());
+	p += band.prefix.size();
+
+	bool keyframe = true;
+	if (deadband >= 0) {
+		fieldsSeen += end - first;
+		band.sinceKeyframe++;
+		keyframe = band.lastSent.size() != count
+			|| (keyframeSweeps != 0 && band.sinceKeyframe >= keyframeSweeps)
+			|| (keyframeNs != 0 && timens - band.keyframeTimens >= keyframeNs);
+	}
+	if (schema == LineSchema::Narrow)
+		return writeNarrow(band, points, first, end, keyframe, timens, out);
+
+	if (keyframe) {
+		for (unsigned int i = first; i < end; i++) {
+			unsigned int keyLen = offsets[i + 1] - offsets[i];
+			memcpy(p, keys + offsets[i], keyLen);
+			p = formatInt(p + keyLen, value[i]);
+			*p++ = ',';
+		}
+		if (deadband >= 0) {
+			band.lastSent.resize(count);
+			memcpy(&band.lastSent[first], &value[first], end - first);
+			band.sinceKeyframe = 0;
+			band.keyframeTimens = timens;
+			fieldsWritten += end - first;
+			keyframesWritten++;
+		}
+	}
+	else {
+		int8_t *last = band.lastSent.data();
+		unsigned int written = 0;
+		for (unsigned int i = first; i < end; i++) {
+			int32_t change = value[i] - last[i];
+			if (change <= deadband && change >= -deadband)
+				continue;
+			last[i] = value[i];
+			unsigned int keyLen = offsets[i + 1] - offsets[i];
+			memcpy(p, keys + offsets[i], keyLen);
+			p = formatInt(p + keyLen, value[i]);
+			*p++ = ',';
+			written++;
+		}
+		fieldsWritten += written;
+		if (written == 0) {
+			// nothing moved, the line is dropped before it is committed
+			linesSkipped++;
+			return 0;
+		}
+	}
+	if (sweepFields) {
+		p = writeSweepFields(p);
+		*p++ = ',';
+	}
+	// the last field has no trailing comma
+	p[-1] = ' ';
+	p = formatInt(p, timens);
+	*p++ = '\n';
+
+	out.commit(p - start);
+	return 1;
+}
+
+
+// "seq=<n>,sweep_start=<ns>,sweep_end=<ns>" of the frame being serialized.
+char *LineProtocolSerializer::writeSweepFields(char *p) const {
+	memcpy(p, "seq=", 4);
+	p = formatInt(p + 4, (long long)frame->sequence);
+	memcpy(p, ",sweep_start=", 13);
+	p = formatInt(p + 13, frame->startns);
+	memcpy(p, ",sweep_end=", 11);
+	return formatInt(p + 11, frame->timens);
+}
+
+
+// One line per bin of points[first, end), in deadband mode only the bins that moved.
+unsigned int LineProtocolSerializer::writeNarrow(BandKeys &band, const int8_t *points, unsigned int first, unsigned int end, bool keyframe, long long timens, LineBuffer &out) {
+	char stamp[24];
+	stamp[0] = ' ';
+	char *stampEnd = formatInt(stamp + 1, timens);
+	*stampEnd++ = '\n';
+	size_t stampLen = stampEnd - stamp;
+
+	size_t worst = (band.prefix.size() + 12 + stampLen) * (end - first) + (band.offsets[end] - band.offsets[first]);
+	char *start = out.reserve(worst);
+	char *p = start;
+
+	const int8_t *value = points;
+	const char *keys = band.keys.data();
+	const unsigned int *offsets = band.offsets.data();
+	int8_t *last = deadband >= 0 && !keyframe ? band.lastSent.data() : nullptr;
+	unsigned int lines = 0;
+	for (unsigned int i = first; i < end; i++) {
+		if (last != nullptr) {
+			int32_t change = value[i] - last[i];
+			if (change <= deadband && change >= -deadband)
+				continue;
+			last[i] = value[i];
+		}
+		memcpy(p, band.prefix.data(), band.prefix.size());
+		p += band.prefix.size();
+		unsigned int keyLen = offsets[i + 1] - offsets[i];
+		memcpy(p, keys + offsets[i], keyLen);
+		p = formatInt(p + keyLen, value[i]);
+		memcpy(p, stamp, stampLen);
+		p += stampLen;
+		lines++;
+	}
+	out.commit(p - start);
+
+	if (deadband >= 0) {
+		fieldsWritten += lines;
+		if (keyframe) {
+			band.lastSent.resize(band.count);
+			memcpy(&band.lastSent[first], &value[first], end - first);
+			band.sinceKeyframe = 0;
+			band.keyframeTimens = timens;
+			keyframesWritten++;
+		}
+		else if (lines == 0)
+			linesSkipped++;
+	}
+	return lines;
+}
+
+
+// The bins of points[first, end), base64 encoded into one field.
+unsigned int LineProtocolSerializer::writePacked(BandKeys &band, const int8_t *points, unsigned int first, unsigned int end, long long timens, LineBuffer &out) {
+	unsigned int n = end - first;
+
+	size_t worst = band.prefix.size() + 4 * ((n + 2) / 3) + 24 + (sweepFields ? 80 : 0);
+	char *start = out.reserve(worst);
+	char *p = start;
+	memcpy(p, band.prefix.data(), band.prefix.size());
+	p += band.prefix.size();
+	p = formatBase64(p, (const uint8_t *)points + first, n);
+	*p++ = '"';
+	if (sweepFields) {
+		*p++ = ',';
+		p = writeSweepFields(p);
+	}
+	*p++ = ' ';
+	p = formatInt(p, timens);
+	*p++ = '\n';
+	out.commit(p - start);
+	return 1;
+}
+
+
+unsigned int LineProtocolSerializer::serialize(const RssiFrame &frame, LineBuffer &out) {
+	if (frame.count == 0)
+		return 0;
+	this->frame = &frame;
+
+	if (frame.dataType == oscium::WiPryClarity::DataType::RSSI_DUAL25) {
+		// worked out once per frame size, the frame is then written as two
+		// lines straight from its two halves
+		if (dualCount != frame.count) {
+			dualPoints2 = dualSplit != 0 ? dualSplit : frame.count / 2;
+			dualCount = frame.count;
+		}
+		if (dualPoints2 == 0 || dualPoints2 >= frame.count)
+			return 0;
+
+		unsigned int lines = 0;
+		if (bands[0].valid)
+			lines += writeLine(bands[0], frame.points, dualPoints2, frame.timens, out);
+		if (bands[1].valid)
+			lines += writeLine(bands[1], frame.points + dualPoints2, frame.count - dualPoints2, frame.timens, out);
+		return lines;
+	}
+
+	BandKeys *band = bandFor(frame.dataType);
+	if (band == nullptr || !band->valid)
+		return 0;
+	return writeLine(*band, frame.points, frame.count, frame.timens, out);
+}
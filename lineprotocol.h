@@ -0,0 +1,172 @@
+#pragma once
+
+#include "WiPryClarity.h"
+#include "writer.h"
+#include <cstring>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*
+
+    LineProtocolSerializer
+
+    Turns one RssiFrame into one line of Influx line protocol:
+
+        wipry,serial=<serial>,band=<2|5|6> <freq>=<rssi>,... <timens>\n
+
+    The frequency keys only depend on the band boundaries and the number of
+    points in the sweep, so they are formatted once per band and cached.  Per
+    frame only the integer RSSI values and the timestamp are formatted, into a
+    reusable buffer that stops growing after the first few frames.
+
+    In deadband mode a line carries only the bins that changed noticeably
+    since they were last written, with a full keyframe now and then.
+
+    Two other layouts trade that shape for cheaper indexing and smaller
+    writes:
+
+        wipry_bin,serial=<serial>,band=<n>,bin=<i> freq=<freq>,rssi=<rssi> <timens>\n
+
+    one line per bin, the bin index a tag so the lines of one sweep do not
+    overwrite each other, and
+
+        wipry_packed,serial=<serial>,band=<n> start=<freq>,step=<MHz>,rssi="<base64>" <timens>\n
+
+    with the sweep as int8 bins, base64 encoded, the first at start MHz.
+
+    Wide and packed lines can also carry the frame's sequence number and
+    the wall clock times the sweep started and ended, as the fields
+    seq=<n>,sweep_start=<ns>,sweep_end=<ns>.
+
+*/
+
+
+// Line layouts, see above.
+enum class LineSchema {
+	Wide,			// wipry, one field per bin
+	Narrow,			// wipry_bin, one line per bin
+	Packed			// wipry_packed, the sweep in one string field
+};
+
+// "wide", "narrow" or "packed".
+bool parseLineSchema(const std::string &name, LineSchema &schema);
+
+
+// Growable byte buffer that is reused frame after frame.
+class LineBuffer {
+public:
+	LineBuffer() : len(0) {}
+
+	void clear() { len = 0; }
+	const char *data() const { return buf.data(); }
+	size_t size() const { return len; }
+
+	// Makes room for n more bytes and returns where to write them.
+	char *reserve(size_t n) {
+		if (len + n > buf.size())
+			buf.resize((len + n) * 2);
+		return &buf[len];
+	}
+	void commit(size_t n) { len += n; }
+
+	void append(const char *s, size_t n) {
+		memcpy(reserve(n), s, n);
+		len += n;
+	}
+	void append(char c) {
+		*reserve(1) = c;
+		len++;
+	}
+	void appendInt(long long v);
+
+private:
+	std::vector<char> buf;
+	size_t len;
+};
+
+
+// Writes the decimal form of v at p and returns the end.  p needs 20 bytes.
+char *formatInt(char *p, long long v);
+
+
+class LineProtocolSerializer {
+public:
+	LineProtocolSerializer();
+
+	void setSerial(const std::string &serial);
+
+	// Sets a band's frequency range in MHz and drops its cached keys.
+	void setBoundary(oscium::WiPryClarity::DataType dataType, float freqLow, float freqHigh);
+
+	// Writes only bins [first, first + width) of the band's sweeps, the rest of
+	// a zoomed frame holds no data.  A width of 0 writes the whole sweep.
+	void setWindow(oscium::WiPryClarity::DataType dataType, unsigned int first, unsigned int width);
+
+	// Where a RSSI_DUAL25 frame ends its 2.4GHz bins and starts its 5GHz ones.
+	// 0, the default, splits the frame in half, the device sends as many bins
+	// for each band.
+	void setDualSplit(unsigned int points);
+
+	// Wide by default.  Deadband mode applies to wide and narrow lines.
+	void setSchema(LineSchema schema);
+
+	// Adds seq, sweep_start and sweep_end to wide and packed lines.
+	void setSweepFields(bool on) { sweepFields = on; }
+
+	// Deadband mode: a line holds only the bins that moved by more than dB
+	// from the value last written for them, and a sweep where none did writes
+	// no line.  Every keyframeSweeps sweeps or keyframeMs of frame time,
+	// whichever comes first (0 turns either off), a band writes all its bins
+	// so that last() downstream is never older than that.  A negative dB
+	// writes every bin of every sweep, the default.
+	void setDeadband(float dB, unsigned int keyframeSweeps, unsigned int keyframeMs);
+
+	// Appends the lines for frame to out and returns how many there are: one,
+	// two for a dual-band frame (band=2 and band=5), one per bin with the
+	// narrow schema, none if the band has no frequency axis or deadband mode
+	// left nothing to write.
+	unsigned int serialize(const RssiFrame &frame, LineBuffer &out);
+
+	// Deadband counters: bins in the sweeps serialized and bins written.
+	unsigned long long fieldsIn() const { return fieldsSeen; }
+	unsigned long long fieldsOut() const { return fieldsWritten; }
+	unsigned long long keyframes() const { return keyframesWritten; }
+	unsigned long long linesSuppressed() const { return linesSkipped; }
+
+private:
+	struct BandKeys {
+		char name;
+		bool valid;
+		float freqLow, freqHigh;
+		unsigned int count;
+		unsigned int windowFirst, windowWidth;
+		std::string prefix;			// "wipry,serial=...,band=N ", the narrow and packed equivalents
+		std::vector<char> keys;			// every "<freq>=", or "<bin> freq=<freq>,rssi=", back to back
+		std::vector<unsigned int> offsets;	// count + 1 offsets into keys
+		std::vector<int8_t> lastSent;		// deadband: value last written per bin, empty until a keyframe
+		unsigned int sinceKeyframe;
+		long long keyframeTimens;
+	};
+
+	BandKeys *bandFor(oscium::WiPryClarity::DataType dataType);
+	void buildKeys(BandKeys &band, unsigned int count);
+	unsigned int writeLine(BandKeys &band, const int8_t *points, unsigned int count, long long timens, LineBuffer &out);
+	unsigned int writeNarrow(BandKeys &band, const int8_t *points, unsigned int first, unsigned int end, bool keyframe, long long timens, LineBuffer &out);
+	unsigned int writePacked(BandKeys &band, const int8_t *points, unsigned int first, unsigned int end, long long timens, LineBuffer &out);
+	char *writeSweepFields(char *p) const;
+
+	std::string serial;
+	BandKeys bands[3];
+	LineSchema schema;
+	bool sweepFields;
+	const RssiFrame *frame;		// being serialized
+	unsigned int dualSplit;		// as set, 0 for automatic
+	unsigned int dualCount;		// frame size the split below was worked out for
+	unsigned int dualPoints2;	// 2.4GHz bins at the front of a dual frame
+
+	int deadband;			// bins move when |change| > deadband, -1 when off
+	unsigned int keyframeSweeps;
+	long long keyframeNs;
+	unsigned long long fieldsSeen, fieldsWritten, keyframesWritten, linesSkipped;
+};
@@ -1,9 +1,32 @@
 #include "WiPryClarity.h"
+#include "device.h"
+#include "writer.h"
+#include "session.h"
+#include "telemetry.h"
+#include "events.h"
+#include "lineprotocol.h"
+#include "output.h"
+#include "influx.h"
+#include "fanout.h"
+#include "control.h"
+#include "capture.h"
+#include "scheduler.h"
+#include "zoom.h"
+#include "channels.h"
+#include "spectrogram.h"
+#include "peaks.h"
 #include <iostream>
 #include <chrono>
 #include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
 #include <signal.h>
 #include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
 
 /*
 
@@ -15,201 +38,358 @@
 
 */
 
-
 std::string VERSION = "v1.1.0";
 
 
 using namespace oscium;
-WiPryClarity* wipryClarity = nullptr;
 
 sig_atomic_t signaled = 0;
-bool run = true;
-unsigned int band;
-std::string serial;
+volatile sig_atomic_t run = true;
+EventLoop* events = nullptr;	// what the main thread waits on
+std::vector<unsigned int> bands;	// one WiPry per band given
+std::vector<Session*> sessions;
 
-bool isConnected = false; // flag denoting that there is a successful connection
-bool connectionProcessComplete = true; // flag denoting that the connection process has completed
-unsigned int rssi2_4GHzFrameCount;
-unsigned int rssi5GHzFrameCount;
-unsigned int rssi6EFrameCount;
+unsigned int dualSplit = 0;
+LineSchema schema = LineSchema::Wide;
+float deadband = -1;		// dB, -1 writes every bin
+unsigned int keyframeSweeps = 0;
+unsigned int keyframeMs = 60000;
+int channelWindowMs = -1;	// -1 writes every bin
+bool channelsPscOnly = false;
+float peakProminence = -1;	// dB, -1 writes every bin
+unsigned int peakHoldSweeps = 3;
+int summaryMs = -1;			// -1 writes no summaries
+unsigned int summarySweeps = 900;
+bool sweepFields = false;
+std::string zoomSpec;
+std::string zoomChannels;
+BandDwell dwell[3];
 
+FrameWriter* frameWriter = nullptr;
+size_t queueFrames = 64;
+OverflowPolicy overflowPolicy = OverflowPolicy::DropOldest;
 
-float even_min, even_max, even_noisefloor;
-float odd_min, odd_max, odd_noisefloor;
 
-float freqLow2, freqHigh2;
-float freqLow5, freqHigh5;
-float freqLow6, freqHigh6;
+Sink* output = nullptr;
+BatchedOutput* stdoutOutput = nullptr;	// output, when it is plain stdout
+InfluxSink* influxSink = nullptr;
+FanOut* fanOut = nullptr;
+std::vector<FanOutTarget*> sinkTargets;	// --sink, in the order given
+std::vector<std::string> sinkSpecs;		// the same as given, a reload keeps them
+int batchLines = -1;	// -1 until set, the default depends on the output
+int flushMs = -1;		// -1 until set, 0 for batches by size alone
+int gzipLevel = 0;		// stdout and file output, 0 writes it uncompressed
+std::string influxUrl;
+InfluxConfig influxConfig;
 
+Telemetry telemetry;
+int telemetryMs = 0;		// 0 leaves wipry_internal out of the output
+int metricsPort = 0;
+MetricsServer* metricsServer = nullptr;
+std::chrono::steady_clock::time_point nextTelemetry;
 
-// This the delegate class that receives the events from the WiPryClarity object.
- class MyDelegate : public WiPryClarityDelegate {
-public:
-	void wipryClarityDidConnect(WiPryClarity *aWipryClarity) {
-		std::cerr << "Connected to device." << std::endl;
-		isConnected = true;
-		connectionProcessComplete = true;
+SyntheticConfig syntheticConfig;
+bool synthetic = false;
+std::string replayPath;
+double replaySpeed = 1.0;
 
-		float min, max, noisefloor;
-		float freqLow, freqHigh;
-		bool result;
+std::string recordPath;
+CaptureEncoding recordEncoding = CaptureDelta;
+CaptureWriter* captureWriter = nullptr;
+int recordFd = -1;
 
-		result = aWipryClarity->getEvenRssiLimts(&min, &max, &noisefloor);
-		if (result) {
-			std::cerr << "Even Min:" << min << "dBm Max:" << max << "dBm Noise Floor:" << noisefloor << "dBm" << std::endl;
-			even_min = min;
-			even_max = max;
-			even_noisefloor = noisefloor;
-		}
-		else
-			std::cerr << "Unable to get limits" << std::endl;
+std::string configPath;
+std::string controlPath;
+ControlServer* controlServer = nullptr;
 
-		result = aWipryClarity->getOddRssiLimts(&min, &max, &noisefloor);
-		if (result) {
-			std::cerr << " Odd Min:" << min << "dBm Max:" << max << "dBm Noise Floor:" << noisefloor << "dBm" << std::endl;
-			odd_min = min;
-			odd_max = max;
-			odd_noisefloor = noisefloor;
-		}
-		else
-			std::cerr << "Unable to get limits" << std::endl;
 
-		result = aWipryClarity->get2_4GHzBoundary(&freqLow, &freqHigh);
-		if (result) {
-			std::cerr << "2.4GHz Low:" << freqLow << "MHz High:" << freqHigh << "MHz" << std::endl;
-			freqLow2 = freqLow;
-			freqHigh2 = freqHigh;
-		}
-		else
-			std::cerr << "Unable to get 2.4GHz frequency limits" << std::endl;
+// Runs on the writer thread.  Appends the wipry_internal lines when they are due.
+void writeTelemetry() {
+	if (telemetryMs <= 0)
+		return;
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (now < nextTelemetry)
+		return;
+	nextTelemetry = now + std::chrono::milliseconds(telemetryMs);
+	long long timens = std::chrono::time_point_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now()).time_since_epoch().count();
+	output->linesAdded(telemetry.writeLines(output->buffer(), timens));
+}
 
-		result = aWipryClarity->get5GHzBoundary(&freqLow, &freqHigh);
-		if (result) {
-			std::cerr << "  5GHz Low:" << freqLow << "MHz High:" << freqHigh << "MHz" << std::endl;
-			freqLow5 = freqLow;
-			freqHigh5 = freqHigh;
-		}
-		else
-			std::cerr << "Unable to get 5GHz frequency limits" << std::endl;
 
-		result = aWipryClarity->get6EBoundary(&freqLow, &freqHigh);
-		if (result) {
-			std::cerr << "    6E Low:" << freqLow << "MHz High:" << freqHigh << "MHz" << std::endl;
-			freqLow6 = freqLow;
-			freqHigh6 = freqHigh;
-		}
-		else
-			std::cerr << "Unable to get 6E frequency limits" << std::endl;
+// Runs on the writer thread.  The queue a sweep came through tells which WiPry sent it.
+void writeFrame(const RssiFrame &frame) {
+	sessions[frame.source]->writeFrame(frame, output);
+	writeTelemetry();
+}
+
 
-		rssi2_4GHzFrameCount = 0;
-		rssi5GHzFrameCount = 0;
-		rssi6EFrameCount = 0;
+// Opens the capture file for appending.  A new file gets a header, an
+// existing one must be a capture of the same band and loses any frame a
+// crash cut short.  Returns the descriptor, or -1.
+int openCapture(const std::string &path, CaptureHeader &header, bool &isNew) {
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		std::cerr << "Unable to open " << path << ": " << strerror(errno) << std::endl;
+		return -1;
+	}
+	off_t end = lseek(fd, 0, SEEK_END);
+	isNew = end == 0;
+	if (!isNew) {
+		CaptureReader reader;
+		if (!reader.open(path)) {
+			std::cerr << path << " exists and is not a capture file!" << std::endl;
+			close(fd);
+			return -1;
+		}
+		if (reader.header().band != header.band) {
+			std::cerr << path << " is a capture of band " << (int)reader.header().band << "!" << std::endl;
+			close(fd);
+			return -1;
+		}
+		RssiFrame *frame = new RssiFrame;
+		while (reader.next(*frame))
+			;
+		delete frame;
+		if ((off_t)reader.position() != end && ftruncate(fd, reader.position()) != 0) {
+			std::cerr << "Unable to truncate " << path << ": " << strerror(errno) << std::endl;
+			close(fd);
+			return -1;
+		}
+		lseek(fd, reader.position(), SEEK_SET);
 	}
+	return fd;
+}
+
+
+// "LOW-HIGH", "channels C,C..." or "off" for band.
+bool parseZoom(const std::string &spec, unsigned int band, ZoomRange &zoom) {
+	zoom = ZoomRange();
+	if (spec == "off")
+		return true;
+	if (spec.compare(0, 9, "channels ") == 0)
+		return zoom.parseChannels(spec.substr(9), band);
+	return zoom.parse(spec);
+}
+
 
-	void wipryClarityUnableToConnect(WiPryClarity *wipryClarity, WiPryClarity::ErrorCode errorCode) {
-		std::cerr << "Disconnected from Accessory with Error Code : " << (int)errorCode << std::endl;
-		// delete the global WiPry Clarity object
-		if (wipryClarity != nullptr)
-		{
-			if (wipryClarity->didStartCommunication())
-				wipryClarity->endCommunication();
+// The runtime settings, see control.h.  Main thread; each returns an empty
+// string or why it could not be done.
 
-			// NOTE: Do not delete the wipry2500 object here or it will cause a crash. Delete it somewhere else.
-			// delete wipryClarity;
-			// wipryClarity = nullptr;
+std::string switchBand(unsigned int band, const ZoomRange &zoom) {
+	if (sessions.size() != 1)
+		return "the band can only be changed with one WiPry";
+	Session *session = sessions[0];
+	if (band == session->band() && zoom.lowMHz == session->zoom().lowMHz && zoom.highMHz == session->zoom().highMHz)
+		return "";
+	if (!recordPath.empty())
+		return "a capture file holds one band";
+	if (!zoom.empty() && band != 2 && band != 5 && band != 6)
+		return "zoom needs band 2, 5 or 6";
+	if (!session->linkUp())
+		return "the WiPry is not connected";
+	if (!session->reconfigure(band, zoom))
+		return "the zoom range is outside the band";
+	return "";
+}
+
+
+std::string switchSchema(LineSchema newSchema) {
+	if (newSchema == schema)
+		return "";
+	if (!recordPath.empty() || channelWindowMs >= 0 || peakProminence >= 0)
+		return "the schema applies to per-bin line protocol only";
+	if (newSchema == LineSchema::Packed && deadband >= 0)
+		return "--deadband needs the wide or narrow schema";
+	if (newSchema == LineSchema::Narrow && sweepFields)
+		return "--sweep-times needs the wide or packed schema";
+	schema = newSchema;
+	for (size_t s = 0; s < sessions.size(); s++)
+		sessions[s]->setSchema(schema);
+	return "";
+}
 
-			connectionProcessComplete = true;
-			isConnected = false;
+
+std::string addSink(const std::string &spec) {
+	if (fanOut == nullptr)
+		return "not writing to sinks";
+	FanOutTarget *target = makeFanOutTarget(spec, gzipLevel);
+	if (target == nullptr)
+		return "invalid sink " + spec;
+	std::string name = target->name();
+	std::vector<std::string> names = fanOut->targetNames();
+	for (size_t t = 0; t < names.size(); t++) {
+		if (names[t] == name) {
+			delete target;
+			return "already writing to " + name;
 		}
 	}
+	if (!fanOut->attach(target))
+		return "unable to open " + name;
+	std::cerr << "Writing to " << name << std::endl;
+	return "";
+}
+
+
+std::string removeSink(const std::string &name) {
+	if (fanOut == nullptr)
+		return "not writing to sinks";
+	if (fanOut->targetNames().size() == 1)
+		return "the last sink can not be removed";
+	if (!fanOut->detach(name))
+		return "no sink " + name;
+	std::cerr << "Stopped writing to " << name << std::endl;
+	return "";
+}
+
+
+// Makes the sinks those given with --sink plus those of the config file,
+// adding before removing so the output is never without one.  InfluxDB
+// stays as it is.
+std::string syncSinks(const std::vector<std::string> &fileSinks) {
+	std::vector<std::string> wanted = sinkSpecs;
+	wanted.insert(wanted.end(), fileSinks.begin(), fileSinks.end());
+	if (wanted.empty())
+		wanted.push_back("stdout");
+
+	std::vector<std::string> wantedNames;
+	for (size_t w = 0; w < wanted.size(); w++) {
+		FanOutTarget *target = makeFanOutTarget(wanted[w], gzipLevel);
+		if (target == nullptr)
+			return "invalid sink " + wanted[w];
+		wantedNames.push_back(target->name());
+		delete target;
+	}
 
-	//Not Implemented in library
-	/*
-	void wipryClarityDidReceiveBeaconCaptureData(WiPryClarity *wipryClarity, std::vector<uint8_t> beaconCaptures) {
-		if (beaconCaptures.size() > 0) {
-			std::cerr<<"Got " << beaconCaptures.size() << " beacons!" << std::endl;
+	std::string error;
+	std::vector<std::string> current = fanOut->targetNames();
+	for (size_t w = 0; w < wanted.size(); w++) {
+		if (std::find(current.begin(), current.end(), wantedNames[w]) == current.end()) {
+			std::string e = addSink(wanted[w]);
+			if (error.empty())
+				error = e;
+		}
+	}
+	for (size_t c = 0; c < current.size(); c++) {
+		if (current[c] != "influx" && std::find(wantedNames.begin(), wantedNames.end(), current[c]) == wantedNames.end()) {
+			std::string e = removeSink(current[c]);
+			if (error.empty())
+				error = e;
 		}
 	}
-	*/
+	return error;
+}
 
 
-	void wipryClarityDidReceiveRSSIData(WiPryClarity *aWipryClarity, WiPryClarity::DataType dataType, std::vector<float> rssiData) {
-                long long timens = std::chrono::time_point_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now()).time_since_epoch().count();
-		switch (dataType)
-		{
-			case oscium::WiPryClarity::DataType::RSSI_2_4GHZ:
-			{
-				std::cerr << "2.4 GHz rssi data with " << (int)rssiData.size() << " points" << std::endl;
-				float stepsize = ( (freqHigh2 - freqLow2) / (int)rssiData.size() );
-				std::cout << "wipry,serial=" << serial << ",band=2 ";
-				for (int p=0; p < (int)rssiData.size(); p++) {
-					//std::cerr << rssiData[p] << " ";
-					//Truncate
-					if (p < ((int)rssiData.size() - 1))
-						std::cout << (freqLow2 + p * stepsize) << "=" <<(int)rssiData[p] << ",";
-					else
-						std::cout << (freqLow2 + p * stepsize) << "=" <<(int)rssiData[p];
-				}
-                                std::cout << " " << timens << std::endl;
-			}
-			break;
-			case oscium::WiPryClarity::DataType::RSSI_5GHZ:
-			{
-				std::cerr << "5 GHz rssi data with " << (int)rssiData.size() << " points" << std::endl;
-				float stepsize = ( (freqHigh5 - freqLow5) / (int)rssiData.size() );
-				std::cout << "wipry,serial=" << serial << ",band=5 ";
-				for (int p=0; p < (int)rssiData.size(); p++) {
-					//std::cerr << rssiData[p] << " ";
-					//Truncate
-					if (p < ((int)rssiData.size() - 1))
-						std::cout << (freqLow5 + p * stepsize) << "=" <<(int)rssiData[p] << ",";
-					else
-						std::cout << (freqLow5 + p * stepsize) << "=" <<(int)rssiData[p];
-				}
-                                std::cout << " " << timens << std::endl;
-			}
-			break;
-/*
-			case oscium::WiPryClarity::DataType::RSSI_DUAL25:
-			{
-				std::cerr << "Dual band rssi data with " << (int)rssiData.size() << " points" << std::endl;
-				for (int p=0; p < (int)rssiData.size(); p++) {
-					//std::cerr << rssiData[p] << " ";
-					//Truncate
-					std::cerr << (int)rssiData[p] << " ";
-				}
-                                std::cout << " " << timens << std::endl;
-			}
-			break;
-*/
-			case oscium::WiPryClarity::DataType::RSSI_6E:
-			{
-				std::cerr << "6 GHz rssi data with " << (int)rssiData.size() << " points" << std::endl;
-				float stepsize = ( (freqHigh6 - freqLow6) / (int)rssiData.size() );
-				std::cout << "wipry,serial=" << serial << ",band=6 ";
-				for (int p=0; p < (int)rssiData.size(); p++) {
-					//std::cerr << rssiData[p] << " ";
-					//Truncate
-					if (p < ((int)rssiData.size() - 1))
-						std::cout << (freqLow6 + p * stepsize) << "=" <<(int)rssiData[p] << ",";
-					else
-						std::cout << (freqLow6 + p * stepsize) << "=" <<(int)rssiData[p];
-				}
-                                std::cout << " " << timens << std::endl;
-			}
-			break;
+std::string reloadConfig() {
+	if (configPath.empty())
+		return "no config file, start with --config";
+	std::cerr << "Reloading " << configPath << std::endl;
+	RuntimeConfig file;
+	if (!loadRuntimeConfig(configPath, file))
+		return "unable to read " + configPath;
+
+	// everything that can be applied is, the first problem is reported
+	std::string error, e;
+	if (file.band != 0 || !file.zoom.empty()) {
+		// a band without a zoom streams the whole band, one switch for both
+		unsigned int band = file.band != 0 ? file.band : sessions[0]->band();
+		ZoomRange zoom;
+		if (!file.zoom.empty() && !parseZoom(file.zoom, band, zoom))
+			e = "invalid zoom range";
+		else
+			e = switchBand(band, zoom);
+		if (error.empty())
+			error = e;
+	}
+	if (file.hasSchema) {
+		e = switchSchema(file.schema);
+		if (error.empty())
+			error = e;
+	}
+	if (fanOut != nullptr)
+		e = syncSinks(file.sinks);
+	else
+		e = file.sinks.empty() ? "" : "not writing to sinks, the config file's sinks are left out";
+	if (error.empty())
+		error = e;
+	return error;
+}
 
-			default:
-				break;
-		}
 
+// A line from the control socket, answered with "ok" or "error: ".
+std::string controlCommand(const std::string &line) {
+	std::cerr << "Control: " << line << std::endl;
+	size_t space = line.find(' ');
+	std::string verb = line.substr(0, space);
+	std::string arg = space != std::string::npos ? line.substr(space + 1) : std::string();
+
+	std::string error;
+	std::string done = "ok";
+	if (verb == "band" || verb == "zoom") {
+		unsigned int band;
+		ZoomRange zoom;
+		if (verb == "band") {
+			band = parseBand(arg);
+			if (band == 0)
+				return "error: invalid band";
+		}
+		else {
+			if (sessions.size() != 1)
+				return "error: the zoom can only be changed with one WiPry";
+			band = sessions[0]->band();
+			if (!parseZoom(arg, band, zoom))
+				return "error: invalid zoom range";
+		}
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		error = switchBand(band, zoom);
+		done += " switched in " + std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count()) + "ms";
+	}
+	else if (verb == "schema") {
+		LineSchema newSchema;
+		if (!parseLineSchema(arg, newSchema))
+			return "error: invalid schema";
+		error = switchSchema(newSchema);
+	}
+	else if (verb == "sink" && arg.compare(0, 4, "add ") == 0)
+		error = addSink(arg.substr(4));
+	else if (verb == "sink" && arg.compare(0, 7, "remove ") == 0)
+		error = removeSink(arg.substr(7));
+	else if (verb == "reload")
+		error = reloadConfig();
+	else if (verb == "status") {
+		const char *schemaNames[3] = { "wide", "narrow", "packed" };
+		done += " band=";
+		for (size_t s = 0; s < sessions.size(); s++)
+			done += std::string(s != 0 ? "," : "") + bandName(sessions[s]->band());
+		if (sessions.size() == 1 && !sessions[0]->zoom().empty()) {
+			char range[64];
+			snprintf(range, sizeof(range), " zoom=%g-%g", sessions[0]->zoom().lowMHz, sessions[0]->zoom().highMHz);
+			done += range;
+		}
+		done += std::string(" schema=") + schemaNames[(int)schema];
+		if (fanOut != nullptr) {
+			std::vector<std::string> names = fanOut->targetNames();
+			done += " sinks=";
+			for (size_t t = 0; t < names.size(); t++)
+				done += (t != 0 ? "," : "") + names[t];
+		}
+		if (sessions.size() == 1 && sessions[0]->switches() != 0) {
+			char gap[96];
+			snprintf(gap, sizeof(gap), " switches=%llu last_switch_gap_ms=%.1f", sessions[0]->switches(), sessions[0]->lastSwitchGapMs());
+			done += gap;
+		}
 	}
-};
+	else
+		return "error: unknown command";
+	return error.empty() ? done : "error: " + error;
+}
 
 
 void sig_handler (int param)
 {
   run = false;
+  if (events != nullptr)
+    events->notify();
 }
 
 
@@ -218,17 +398,74 @@ void helptext() {
         std::cout << std::endl;
 	std::cout << "Usage:" << std::endl;
 	std::cout << std::endl;
-        std::cout << "    wipry-lp -[2|5|6]" << std::endl;
+        std::cout << "    wipry-lp -[2|5|6|D|T]... [options]" << std::endl;
         std::cout << std::endl;
         std::cout << "Options:" << std::endl;
 	std::cout << "	-2		Run on the 2.4GHz Band" << std::endl;
 	std::cout << "	-5		Run on the 5GHz Band" << std::endl;
 	std::cout << "	-6		Run on the 6GHz Band" << std::endl;
-        //Not yet implemented.  Supported by libWiPryClarity, but requires special handling of non-contiguous spectrum data
-	//std::cout << "	-D		Run on both the 2.4GHz and 5GHz Band" << std::endl;
-        //Not yet implemented.  ToDo: Requires logic to manually switch between bands while running
-	//std::cout << "	-T		Run on all three bands" << std::endl;
+	std::cout << "	-D		Run on both the 2.4GHz and 5GHz Band, written as separate band=2 and band=5 lines" << std::endl;
+	std::cout << "	-T		Run on all three bands, switching between them" << std::endl;
+	std::cout << "			Give several bands, or one band more than once, to run one WiPry for each" << std::endl;
 	std::cout << "	-h		Print this help text and exit." << std::endl;
+	std::cout << std::endl;
+	std::cout << "	--zoom LOW-HIGH		Scan only LOW to HIGH MHz of the band, at most 255 bins" << std::endl;
+	std::cout << "	--zoom-channels C,C...	Scan only the given 20MHz Wi-Fi channels of the band" << std::endl;
+	std::cout << "	--schema wide|narrow|packed	One line per sweep with a field per bin (default), one line per bin," << std::endl;
+	std::cout << "				or one line per sweep with the bins packed into a base64 string" << std::endl;
+	std::cout << "	--sweep-times		Add the sweep's sequence number, start and end to every wide or packed line" << std::endl;
+	std::cout << "	--deadband DB		Write only bins that moved by more than DB dB since they were last written" << std::endl;
+	std::cout << "	--keyframe-sweeps N	With --deadband, write every bin every N sweeps (default off)" << std::endl;
+	std::cout << "	--keyframe-ms T		With --deadband, write every bin every T ms, 0 for never (default 60000)" << std::endl;
+	std::cout << "	--channels T		Write max, mean and duty cycle per Wi-Fi channel every T ms instead of every bin," << std::endl;
+	std::cout << "				0 for every sweep" << std::endl;
+	std::cout << "	--channels-6e psc|all	6E channels to report (default all)" << std::endl;
+	std::cout << "	--peaks DB		Write start and stop events of peaks rising DB dB above their surroundings" << std::endl;
+	std::cout << "				and the noise floor instead of every bin" << std::endl;
+	std::cout << "	--peaks-hold N		Sweeps a peak may be missing before it stops (default 3)" << std::endl;
+	std::cout << "	--summary-ms T		Also write the median, 95th percentile and maximum of every bin every T ms" << std::endl;
+	std::cout << "	--summary-sweeps N	Sweeps of each band the summary covers (default 900)" << std::endl;
+	std::cout << "	--dual-split N		Bins of a -D sweep that belong to 2.4GHz (default half of the sweep)" << std::endl;
+	std::cout << "	--dwell D		How long -T stays on each band: N sweeps, or a time as Nms or Ns (default 10)" << std::endl;
+	std::cout << "	--dwell-2 D, --dwell-5 D, --dwell-6 D	The same for one band, 0 leaves the band out" << std::endl;
+	std::cout << std::endl;
+	std::cout << "	--config FILE		Read band, zoom, schema and sinks from FILE, and again on SIGHUP" << std::endl;
+	std::cout << "	--control PATH		Take commands to change them on the Unix socket PATH, see control.h" << std::endl;
+	std::cout << std::endl;
+	std::cout << "	--queue-frames N		Sweeps buffered between the device and the writer (default 64, shared by all WiPrys)" << std::endl;
+	std::cout << "	--overflow drop-oldest|drop-newest	What to discard when the buffer is full (default drop-oldest)" << std::endl;
+	std::cout << "	--batch-lines N		Write output in batches of N lines (default 1, 1000 with --influx-url)" << std::endl;
+	std::cout << "	--flush-ms T		Write a partial batch once its oldest line is T ms old, 0 for never (default 1000 with --batch-lines above 1 or --influx-url)" << std::endl;
+	std::cout << "	--telemetry-ms T	Write wipry_internal pipeline metrics every T ms (default off)" << std::endl;
+	std::cout << "	--metrics-port P	Serve the same metrics for Prometheus on 127.0.0.1:P" << std::endl;
+	std::cout << std::endl;
+	std::cout << "	--sink S		Write to S instead of stdout, give several to write to all of them at once:" << std::endl;
+	std::cout << "				stdout, file:PATH, udp:HOST:PORT or unix:PATH, each optionally followed by" << std::endl;
+	std::cout << "				,queue=N batches (default 64) ,drop=oldest|newest (default oldest)," << std::endl;
+	std::cout << "				and for a file ,max-mb=N to rotate at (default 100, 0 never) ,keep=N old files (default 5)," << std::endl;
+	std::cout << "				and for stdout or a file ,gzip=L as --gzip" << std::endl;
+	std::cout << "	--gzip L		Compress stdout and file output with gzip level 1-9, flushed after every batch (default 0, off)" << std::endl;
+	std::cout << std::endl;
+	std::cout << "	--influx-url URL	POST to InfluxDB v2 at http://host:port instead of printing to stdout, or as well as to --sink" << std::endl;
+	std::cout << "	--influx-org ORG	Organization to write to" << std::endl;
+	std::cout << "	--influx-bucket B	Bucket to write to" << std::endl;
+	std::cout << "	--influx-token T	API token, defaults to $INFLUX_TOKEN" << std::endl;
+	std::cout << "	--influx-batches N	Batches queued for sending before the output backs up (default 4)" << std::endl;
+	std::cout << "	--influx-gzip L		gzip level 0-9, 0 sends uncompressed (default 6)" << std::endl;
+	std::cout << "	--spool-dir DIR		Keep batches InfluxDB could not take in DIR and replay them later" << std::endl;
+	std::cout << "	--spool-max-mb N	Disk space the spool may use before dropping the oldest data (default 256)" << std::endl;
+	std::cout << "	--spool-segment-mb N	Size of each spool file (default 16)" << std::endl;
+	std::cout << "	--spool-replay-kbs N	Replay spooled data at up to N KiB/s, 0 for no limit (default 1024)" << std::endl;
+	std::cout << std::endl;
+	std::cout << "	--synthetic RATE	Use generated sweeps at RATE sweeps/s instead of a WiPry" << std::endl;
+	std::cout << "	--synthetic-points N	Points per generated sweep (default 1000)" << std::endl;
+	std::cout << "	--synthetic-drop N	Let the generated device drop off every N sweeps, to exercise reconnecting" << std::endl;
+	std::cout << "	--replay FILE		Play back line protocol recorded by wipry-lp instead of using a WiPry" << std::endl;
+	std::cout << "	--replay-speed X	Playback speed, 0 for as fast as possible (default 1)" << std::endl;
+	std::cout << std::endl;
+	std::cout << "	--record FILE		Append sweeps to FILE in a compact binary format instead of writing line protocol," << std::endl;
+	std::cout << "				wipry-convert turns it into line protocol later" << std::endl;
+	std::cout << "	--record-raw		Store every sweep in full rather than as a difference to the previous one" << std::endl;
 
         std::cout << std::endl;
         std::cout << std::endl;
@@ -240,8 +477,6 @@ void helptext() {
 }
 
 
-MyDelegate delegate;
-
 int main(int argc, char *argv[]) {
 
 	if (argc <= 1) {
@@ -250,127 +485,750 @@ int main(int argc, char *argv[]) {
 		return 1;
 	}
 
-	if (argc > 2) {
-		std::cerr << "Specify only one argument!" << std::endl;
-		helptext();
-		return 1;
-	}
+	for (int i = 1; i < argc; i++) {
+		unsigned int argBand = 0;
 
-	if (argc == 2) {
-		if (strcmp(argv[1], "-h") == 0) {
+		if (strcmp(argv[i], "-h") == 0) {
 			helptext();
 			return 0;
 		}
-		else if (strcmp(argv[1], "-2") == 0) {
-			band = 2;
+		else if (strcmp(argv[i], "-2") == 0) {
+			argBand = 2;
+		}
+		else if (strcmp(argv[i], "-5") == 0) {
+			argBand = 5;
+		}
+		else if (strcmp(argv[i], "-6") == 0) {
+			argBand = 6;
+		}
+		else if (strcmp(argv[i], "-D") == 0) {
+			argBand = 25;
+		}
+		else if (strcmp(argv[i], "-T") == 0) {
+			argBand = 256;
+		}
+		else if (strcmp(argv[i], "--zoom") == 0 && i + 1 < argc) {
+			zoomSpec = argv[++i];
+		}
+		else if (strcmp(argv[i], "--zoom-channels") == 0 && i + 1 < argc) {
+			zoomChannels = argv[++i];
+		}
+		else if (strcmp(argv[i], "--schema") == 0 && i + 1 < argc) {
+			if (!parseLineSchema(argv[++i], schema)) {
+				std::cerr << "Invalid schema!" << std::endl;
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--sweep-times") == 0) {
+			sweepFields = true;
+		}
+		else if (strcmp(argv[i], "--deadband") == 0 && i + 1 < argc) {
+			deadband = atof(argv[++i]);
+			if (deadband < 0) {
+				std::cerr << "Invalid deadband!" << std::endl;
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--keyframe-sweeps") == 0 && i + 1 < argc) {
+			int n = atoi(argv[++i]);
+			if (n < 0) {
+				std::cerr << "Invalid keyframe interval!" << std::endl;
+				return 1;
+			}
+			keyframeSweeps = n;
+		}
+		else if (strcmp(argv[i], "--keyframe-ms") == 0 && i + 1 < argc) {
+			int n = atoi(argv[++i]);
+			if (n < 0) {
+				std::cerr << "Invalid keyframe interval!" << std::endl;
+				return 1;
+			}
+			keyframeMs = n;
+		}
+		else if (strcmp(argv[i], "--channels") == 0 && i + 1 < argc) {
+			int n = atoi(argv[++i]);
+			if (n < 0) {
+				std::cerr << "Invalid channel window!" << std::endl;
+				return 1;
+			}
+			channelWindowMs = n;
+		}
+		else if (strcmp(argv[i], "--peaks") == 0 && i + 1 < argc) {
+			peakProminence = atof(argv[++i]);
+			if (peakProminence <= 0) {
+				std::cerr << "Invalid peak prominence!" << std::endl;
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--peaks-hold") == 0 && i + 1 < argc) {
+			int n = atoi(argv[++i]);
+			if (n <= 0) {
+				std::cerr << "Invalid peak hold!" << std::endl;
+				return 1;
+			}
+			peakHoldSweeps = n;
+		}
+		else if (strcmp(argv[i], "--summary-ms") == 0 && i + 1 < argc) {
+			int n = atoi(argv[++i]);
+			if (n <= 0) {
+				std::cerr << "Invalid summary interval!" << std::endl;
+				return 1;
+			}
+			summaryMs = n;
+		}
+		else if (strcmp(argv[i], "--summary-sweeps") == 0 && i + 1 < argc) {
+			int n = atoi(argv[++i]);
+			if (n <= 0 || n > SPECTROGRAM_MAX_SWEEPS) {
+				std::cerr << "Invalid summary window!" << std::endl;
+				return 1;
+			}
+			summarySweeps = n;
+		}
+		else if (strcmp(argv[i], "--channels-6e") == 0 && i + 1 < argc) {
+			i++;
+			if (strcmp(argv[i], "psc") == 0)
+				channelsPscOnly = true;
+			else if (strcmp(argv[i], "all") == 0)
+				channelsPscOnly = false;
+			else {
+				std::cerr << "Invalid 6E channel set!" << std::endl;
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--dual-split") == 0 && i + 1 < argc) {
+			int n = atoi(argv[++i]);
+			if (n < 0) {
+				std::cerr << "Invalid dual-band split!" << std::endl;
+				return 1;
+			}
+			dualSplit = n;
+		}
+		else if (strncmp(argv[i], "--dwell", 7) == 0 && i + 1 < argc) {
+			int which;
+			if (strcmp(argv[i], "--dwell") == 0)
+				which = -1;
+			else if (strcmp(argv[i], "--dwell-2") == 0)
+				which = 0;
+			else if (strcmp(argv[i], "--dwell-5") == 0)
+				which = 1;
+			else if (strcmp(argv[i], "--dwell-6") == 0)
+				which = 2;
+			else {
+				std::cerr << "Invalid Argument Specified!" << std::endl;
+				helptext();
+				return 1;
+			}
+			BandDwell d;
+			if (!d.parse(argv[++i])) {
+				std::cerr << "Invalid dwell!" << std::endl;
+				return 1;
+			}
+			for (int b = 0; b < 3; b++)
+				if (which < 0 || which == b)
+					dwell[b] = d;
+		}
+		else if (strcmp(argv[i], "--queue-frames") == 0 && i + 1 < argc) {
+			int n = atoi(argv[++i]);
+			if (n <= 0) {
+				std::cerr << "Invalid queue size!" << std::endl;
+				return 1;
+			}
+			queueFrames = n;
+		}
+		else if (strcmp(argv[i], "--overflow") == 0 && i + 1 < argc) {
+			i++;
+			if (strcmp(argv[i], "drop-oldest") == 0)
+				overflowPolicy = OverflowPolicy::DropOldest;
+			else if (strcmp(argv[i], "drop-newest") == 0)
+				overflowPolicy = OverflowPolicy::DropNewest;
+			else {
+				std::cerr << "Invalid overflow policy!" << std::endl;
+				helptext();
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--batch-lines") == 0 && i + 1 < argc) {
+			int n = atoi(argv[++i]);
+			if (n <= 0) {
+				std::cerr << "Invalid batch size!" << std::endl;
+				return 1;
+			}
+			batchLines = n;
+		}
+		else if (strcmp(argv[i], "--flush-ms") == 0 && i + 1 < argc) {
+			int n = atoi(argv[++i]);
+			if (n < 0) {
+				std::cerr << "Invalid flush interval!" << std::endl;
+				return 1;
+			}
+			flushMs = n;
+		}
+		else if (strcmp(argv[i], "--sink") == 0 && i + 1 < argc) {
+			// made once --gzip is known, which may come later
+			FanOutTarget *target = makeFanOutTarget(argv[++i]);
+			if (target == nullptr) {
+				std::cerr << "Invalid sink!" << std::endl;
+				return 1;
+			}
+			delete target;
+			sinkSpecs.push_back(argv[i]);
+		}
+		else if (strcmp(argv[i], "--gzip") == 0 && i + 1 < argc) {
+			int n = atoi(argv[++i]);
+			if (n < 0 || n > 9) {
+				std::cerr << "Invalid gzip level!" << std::endl;
+				return 1;
+			}
+			gzipLevel = n;
+		}
+		else if (strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
+			configPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--control") == 0 && i + 1 < argc) {
+			controlPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--influx-url") == 0 && i + 1 < argc) {
+			influxUrl = argv[++i];
+			if (!influxConfig.url.parse(influxUrl)) {
+				std::cerr << "Invalid InfluxDB URL, only http://host[:port] is supported!" << std::endl;
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--influx-org") == 0 && i + 1 < argc) {
+			influxConfig.org = argv[++i];
+		}
+		else if (strcmp(argv[i], "--influx-bucket") == 0 && i + 1 < argc) {
+			influxConfig.bucket = argv[++i];
+		}
+		else if (strcmp(argv[i], "--influx-token") == 0 && i + 1 < argc) {
+			influxConfig.token = argv[++i];
 		}
-		else if (strcmp(argv[1], "-5") == 0) {
-			band = 5;
+		else if (strcmp(argv[i], "--influx-batches") == 0 && i + 1 < argc) {
+			int n = atoi(argv[++i]);
+			if (n <= 0) {
+				std::cerr << "Invalid number of batches!" << std::endl;
+				return 1;
+			}
+			influxConfig.maxBatches = n;
+		}
+		else if (strcmp(argv[i], "--influx-gzip") == 0 && i + 1 < argc) {
+			int n = atoi(argv[++i]);
+			if (n < 0 || n > 9) {
+				std::cerr << "Invalid gzip level!" << std::endl;
+				return 1;
+			}
+			influxConfig.gzipLevel = n;
+		}
+		else if (strcmp(argv[i], "--spool-dir") == 0 && i + 1 < argc) {
+			influxConfig.spoolDir = argv[++i];
+		}
+		else if (strcmp(argv[i], "--spool-max-mb") == 0 && i + 1 < argc) {
+			int n = atoi(argv[++i]);
+			if (n <= 0) {
+				std::cerr << "Invalid spool size!" << std::endl;
+				return 1;
+			}
+			influxConfig.spoolMaxBytes = (size_t)n << 20;
+		}
+		else if (strcmp(argv[i], "--spool-segment-mb") == 0 && i + 1 < argc) {
+			int n = atoi(argv[++i]);
+			if (n <= 0) {
+				std::cerr << "Invalid spool segment size!" << std::endl;
+				return 1;
+			}
+			influxConfig.spoolSegmentBytes = (size_t)n << 20;
+		}
+		else if (strcmp(argv[i], "--spool-replay-kbs") == 0 && i + 1 < argc) {
+			int n = atoi(argv[++i]);
+			if (n < 0) {
+				std::cerr << "Invalid replay rate!" << std::endl;
+				return 1;
+			}
+			influxConfig.replayBytesPerSec = (size_t)n << 10;
+		}
+		else if (strcmp(argv[i], "--telemetry-ms") == 0 && i + 1 < argc) {
+			telemetryMs = atoi(argv[++i]);
+			if (telemetryMs < 0) {
+				std::cerr << "Invalid telemetry interval!" << std::endl;
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--metrics-port") == 0 && i + 1 < argc) {
+			metricsPort = atoi(argv[++i]);
+			if (metricsPort <= 0 || metricsPort > 65535) {
+				std::cerr << "Invalid metrics port!" << std::endl;
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--synthetic") == 0 && i + 1 < argc) {
+			char *end;
+			double rate = strtod(argv[++i], &end);
+			if (end == argv[i] || *end != '\0' || !(rate >= 0)) {
+				std::cerr << "Invalid sweep rate!" << std::endl;
+				return 1;
+			}
+			synthetic = true;
+			syntheticConfig.sweepsPerSecond = rate;
 		}
-		else if (strcmp(argv[1], "-6") == 0) {
-			band = 6;
+		else if (strcmp(argv[i], "--synthetic-points") == 0 && i + 1 < argc) {
+			int n = atoi(argv[++i]);
+			if (n <= 0 || n > WIPRY_MAX_POINTS) {
+				std::cerr << "Invalid number of points!" << std::endl;
+				return 1;
+			}
+			for (int t = 0; t < 3; t++)
+				syntheticConfig.points[t] = n;
+			syntheticConfig.points[3] = 2 * n;
+		}
+		else if (strcmp(argv[i], "--synthetic-drop") == 0 && i + 1 < argc) {
+			int n = atoi(argv[++i]);
+			if (n < 0) {
+				std::cerr << "Invalid number of sweeps!" << std::endl;
+				return 1;
+			}
+			syntheticConfig.dropEvery = n;
+		}
+		else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+			replayPath = argv[++i];
 		}
-		else if (strcmp(argv[1], "-D") == 0) {
-			band = 25;
+		else if (strcmp(argv[i], "--replay-speed") == 0 && i + 1 < argc) {
+			replaySpeed = atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+			recordPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--record-raw") == 0) {
+			recordEncoding = CaptureRaw;
 		}
-		//else if (strcmp(argv[1], "-T") == 0) {
-		//	band = 256;
-		//	std::cerr << "Not Yet Implemented!" << std::endl;
-		//	return 2;
-		//}
 		else {
 			std::cerr << "Invalid Argument Specified!" << std::endl;
 			helptext();
 			return 1;
 		}
+
+		if (argBand != 0)
+			bands.push_back(argBand);
+	}
+
+	for (size_t s = 0; s < sinkSpecs.size(); s++) {
+		FanOutTarget *target = makeFanOutTarget(sinkSpecs[s], gzipLevel);
+		if (target == nullptr) {
+			std::cerr << "Unable to initialise gzip!" << std::endl;
+			return 1;
+		}
+		sinkTargets.push_back(target);
+	}
+
+	// the config file's settings come on top of the command line
+	if (!configPath.empty()) {
+		RuntimeConfig file;
+		if (!loadRuntimeConfig(configPath, file))
+			return 1;
+		if (file.band != 0) {
+			if (bands.size() > 1) {
+				std::cerr << "A band in the config file needs a single WiPry!" << std::endl;
+				return 1;
+			}
+			bands.assign(1, file.band);
+		}
+		if (!file.zoom.empty()) {
+			zoomSpec.clear();
+			zoomChannels.clear();
+			if (file.zoom.compare(0, 9, "channels ") == 0)
+				zoomChannels = file.zoom.substr(9);
+			else if (file.zoom != "off")
+				zoomSpec = file.zoom;
+		}
+		if (file.hasSchema)
+			schema = file.schema;
+		for (size_t s = 0; s < file.sinks.size(); s++) {
+			FanOutTarget *target = makeFanOutTarget(file.sinks[s], gzipLevel);
+			if (target == nullptr) {
+				std::cerr << "Invalid sink in " << configPath << "!" << std::endl;
+				return 1;
+			}
+			sinkTargets.push_back(target);
+		}
+	}
+
+	if (bands.empty()) {
+		std::cerr << "No band specified!" << std::endl;
+		helptext();
+		return 1;
+	}
+
+	if (!influxUrl.empty()) {
+		if (influxConfig.bucket.empty()) {
+			std::cerr << "--influx-url needs --influx-bucket!" << std::endl;
+			return 1;
+		}
+		if (influxConfig.token.empty() && getenv("INFLUX_TOKEN") != nullptr)
+			influxConfig.token = getenv("INFLUX_TOKEN");
+	}
+	else if (!influxConfig.spoolDir.empty()) {
+		std::cerr << "--spool-dir needs --influx-url!" << std::endl;
+		return 1;
+	}
+
+	if (deadband >= 0 && (!recordPath.empty() || channelWindowMs >= 0 || peakProminence >= 0)) {
+		std::cerr << "--deadband applies to per-bin line protocol only!" << std::endl;
+		return 1;
 	}
 
-	wipryClarity = new WiPryClarity();
-	wipryClarity->setDelegate(&delegate);
+	if (schema != LineSchema::Wide && (!recordPath.empty() || channelWindowMs >= 0 || peakProminence >= 0)) {
+		std::cerr << "--schema applies to per-bin line protocol only!" << std::endl;
+		return 1;
+	}
 
+	if (sweepFields && (!recordPath.empty() || channelWindowMs >= 0 || peakProminence >= 0 || schema == LineSchema::Narrow)) {
+		std::cerr << "--sweep-times needs the wide or packed schema!" << std::endl;
+		return 1;
+	}
 
-	// start the connection
-	std::cerr<< "Starting connection process." << std::endl;
-	connectionProcessComplete = false;
-	isConnected =false;
+	if (schema == LineSchema::Packed && deadband >= 0) {
+		std::cerr << "--deadband needs the wide or narrow schema!" << std::endl;
+		return 1;
+	}
 
-	bool result = wipryClarity->startCommunication();
-	if (result == false) {
-		std::cerr<< "Error: Unable to connect to the WiPryClarity. Make sure that the device has been connected." << std::endl;
-		delete wipryClarity;
-		wipryClarity = nullptr;
-		return -1;
+	if (peakProminence >= 0 && (!recordPath.empty() || channelWindowMs >= 0)) {
+		std::cerr << "Use only one of --record, --channels and --peaks!" << std::endl;
+		return 1;
 	}
 
-	// wait for the connection prcoess to complete
-	while(!connectionProcessComplete) {
-		std::chrono::milliseconds duration(100);
-		std::this_thread::sleep_for(duration);
+	if (summaryMs >= 0 && !recordPath.empty()) {
+		std::cerr << "--summary-ms writes line protocol, it can not be used with --record!" << std::endl;
+		return 1;
 	}
 
-	if ( isConnected )
-	{
-		std::cerr<< "Connection Success." << std::endl;
-		serial = wipryClarity->getSerialNumber();
-		std::cerr<< "Serial Number: " << serial;
-	} else {
-		// connection failed
-		delete wipryClarity;
-		return -1;
+	if (channelWindowMs >= 0 && !recordPath.empty()) {
+		std::cerr << "Use either --record or --channels!" << std::endl;
+		return 1;
+	}
+
+	ZoomRange zoom;
+	if (!zoomSpec.empty() || !zoomChannels.empty()) {
+		if (bands.size() != 1 || (bands[0] != 2 && bands[0] != 5 && bands[0] != 6)) {
+			std::cerr << "Zoom needs one of -2, -5 or -6!" << std::endl;
+			return 1;
+		}
+		if (!zoomSpec.empty() && !zoomChannels.empty()) {
+			std::cerr << "Use either --zoom or --zoom-channels!" << std::endl;
+			return 1;
+		}
+		if (!zoomSpec.empty() ? !zoom.parse(zoomSpec) : !zoom.parseChannels(zoomChannels, bands[0])) {
+			std::cerr << "Invalid zoom range!" << std::endl;
+			return 1;
+		}
+	}
+
+	if (!recordPath.empty() && telemetryMs > 0) {
+		std::cerr << "--telemetry-ms writes line protocol, use --metrics-port with --record!" << std::endl;
+		return 1;
+	}
+
+	if (!recordPath.empty() && !influxUrl.empty()) {
+		std::cerr << "Use either --record or --influx-url!" << std::endl;
+		return 1;
+	}
+
+	if (!recordPath.empty() && !sinkTargets.empty()) {
+		std::cerr << "Use either --record or --sink!" << std::endl;
+		return 1;
+	}
+
+	if (gzipLevel > 0 && !recordPath.empty()) {
+		std::cerr << "--gzip applies to line protocol only!" << std::endl;
+		return 1;
 	}
 
-	[[maybe_unused]] void (*sigint_handler)(int);
-	sigint_handler = signal(SIGINT, sig_handler);
-	[[maybe_unused]] void (*sigterm_handler)(int);
-	sigterm_handler = signal(SIGTERM, sig_handler);
+	if (gzipLevel > 0 && !influxUrl.empty() && sinkTargets.empty()) {
+		std::cerr << "--gzip compresses stdout and files, use --influx-gzip for InfluxDB!" << std::endl;
+		return 1;
+	}
+
+	// sinks can only change when there are sinks
+	if ((!configPath.empty() || !controlPath.empty()) && recordPath.empty() && influxUrl.empty() && sinkTargets.empty()) {
+		FanOutTarget *target = makeFanOutTarget("stdout", gzipLevel);
+		if (target == nullptr) {
+			std::cerr << "Unable to initialise gzip!" << std::endl;
+			return 1;
+		}
+		sinkTargets.push_back(target);
+	}
+
+	if (synthetic && !replayPath.empty()) {
+		std::cerr << "Use either --synthetic or --replay!" << std::endl;
+		return 1;
+	}
+
+	if (bands.size() > 1 && (!replayPath.empty() || !recordPath.empty())) {
+		std::cerr << "--replay and --record take only one band!" << std::endl;
+		return 1;
+	}
+
+	SessionConfig config;
+	config.dualSplit = dualSplit;
+	config.schema = schema;
+	config.deadband = deadband;
+	config.keyframeSweeps = keyframeSweeps;
+	config.keyframeMs = keyframeMs;
+	config.channelWindowMs = channelWindowMs;
+	config.channelsPscOnly = channelsPscOnly;
+	config.peakProminence = peakProminence;
+	config.peakHoldSweeps = peakHoldSweeps;
+	config.summaryMs = summaryMs;
+	config.summarySweeps = summarySweeps;
+	config.sweepFields = sweepFields;
+	config.zoom = zoom;
+	for (int b = 0; b < 3; b++)
+		config.dwell[b] = dwell[b];
+
+	// before any thread exists, they all inherit the blocked signals
+	std::vector<int> signals = { SIGINT, SIGTERM };
+	if (!configPath.empty())
+		signals.push_back(SIGHUP);
+	events = new EventLoop(signals);
+	if (!events->ok()) {
+		std::cerr << "Unable to set up signal handling: " << strerror(errno) << std::endl;
+		return 1;
+	}
 	[[maybe_unused]] void (*sigabrt_handler)(int);
 	sigabrt_handler = signal(SIGABRT, sig_handler);
 
+	for (size_t s = 0; s < bands.size(); s++) {
+		Device *device;
+		if (synthetic) {
+			// every generated device gets its own serial and its own noise
+			SyntheticConfig deviceConfig = syntheticConfig;
+			if (bands.size() > 1) {
+				deviceConfig.serial += std::to_string(s + 1);
+				deviceConfig.seed += s;
+			}
+			device = new SyntheticDevice(deviceConfig);
+		}
+		else if (!replayPath.empty())
+			device = new ReplayDevice(replayPath, replaySpeed);
+		else
+			device = new WiPryDevice();
+		config.band = bands[s];
+		config.logPrefix = bands.size() > 1 ? "Device " + std::to_string(s + 1) + ": " : "";
+		sessions.push_back(new Session(device, config, events));
+	}
+
+	// connect one at a time, each WiPryClarity takes the next WiPry that is free
+	bool connected = true;
+	for (size_t s = 0; s < sessions.size() && connected; s++)
+		connected = sessions[s]->connect();
+	if (!connected) {
+		for (size_t s = 0; s < sessions.size(); s++)
+			delete sessions[s];
+		return -1;
+	}
+
+	for (size_t s = 0; s < sessions.size(); s++) {
+		if (!sessions[s]->prepareZoom()) {
+			for (size_t d = 0; d < sessions.size(); d++)
+				delete sessions[d];
+			return 1;
+		}
+	}
+
+	if (!recordPath.empty()) {
+		CaptureHeader header;
+		sessions[0]->fillCaptureHeader(header, recordEncoding);
 
-	if (band == 2) {
-		// start 2.4 Ghz Rssi data
-		std::cerr << "Starting 2.4 GHz rssi data stream." << std::endl;
-		wipryClarity->startRssiData(oscium::WiPryClarity::DataType::RSSI_2_4GHZ, 0, 0, 0);
+		bool isNew;
+		recordFd = openCapture(recordPath, header, isNew);
+		if (recordFd < 0) {
+			delete sessions[0];
+			return 1;
+		}
+		// frames are small, batch them by count rather than by line
+		if (batchLines < 0)
+			batchLines = 256;
+		if (flushMs < 0)
+			flushMs = 1000;
+		output = new BatchedOutput(recordFd, batchLines, flushMs);
+		captureWriter = new CaptureWriter(output, recordEncoding);
+		if (isNew)
+			captureWriter->writeHeader(header);
+		sessions[0]->setCaptureWriter(captureWriter);
+		std::cerr << "Recording to " << recordPath << std::endl;
+	}
+	else if (!sinkTargets.empty()) {
+		if (batchLines < 0)
+			batchLines = 1;
+		// a partial batch still goes out within a second unless --flush-ms 0 says otherwise
+		if (flushMs < 0)
+			flushMs = batchLines > 1 ? 1000 : 0;
+		fanOut = new FanOut(batchLines, flushMs);
+		for (size_t t = 0; t < sinkTargets.size(); t++)
+			fanOut->add(sinkTargets[t]);
+		sinkTargets.clear();
+		if (!influxUrl.empty()) {
+			// InfluxDB batches on its own with its defaults, the fan-out hands it every batch as it comes
+			influxSink = new InfluxSink(influxConfig);
+			influxSink->start();
+			fanOut->add(makeInfluxTarget(influxSink, influxConfig.flushMs));
+			std::cerr << "Writing to InfluxDB at " << influxUrl << std::endl;
+		}
+		if (!fanOut->start()) {
+			for (size_t s = 0; s < sessions.size(); s++)
+				delete sessions[s];
+			return 1;
+		}
+		output = fanOut;
+	}
+	else if (!influxUrl.empty()) {
+		influxConfig.batchLines = batchLines >= 0 ? batchLines : 1000;
+		influxConfig.flushMs = flushMs >= 0 ? flushMs : 1000;
+		influxSink = new InfluxSink(influxConfig);
+		influxSink->start();
+		output = influxSink;
+		std::cerr << "Writing to InfluxDB at " << influxUrl << std::endl;
+	}
+	else {
+		if (batchLines < 0)
+			batchLines = 1;
+		if (flushMs < 0)
+			flushMs = batchLines > 1 ? 1000 : 0;
+		stdoutOutput = new BatchedOutput(STDOUT_FILENO, batchLines, flushMs);
+		if (gzipLevel > 0 && !stdoutOutput->setGzip(gzipLevel)) {
+			std::cerr << "Unable to initialise gzip!" << std::endl;
+			delete stdoutOutput;
+			for (size_t s = 0; s < sessions.size(); s++)
+				delete sessions[s];
+			return 1;
+		}
+		output = stdoutOutput;
 	}
 
-	if (band == 5) {
-		// start 5 Ghz Rssi data
-		std::cerr << "Starting 5 GHz rssi data stream." << std::endl;
-		wipryClarity->startRssiData(oscium::WiPryClarity::DataType::RSSI_5GHZ, 0, 0, 0);
+	// --queue-frames is the budget for all devices, each gets an equal share of it
+	size_t perDevice = queueFrames / sessions.size();
+	if (perDevice < 4)
+		perDevice = 4;
+	frameWriter = new FrameWriter(perDevice, overflowPolicy, writeFrame, sessions.size());
+	frameWriter->setIdleHandler([] { writeTelemetry(); output->poll(); }, influxSink != nullptr && fanOut == nullptr ? influxConfig.flushMs : flushMs);
+	for (size_t s = 0; s < sessions.size(); s++)
+		sessions[s]->attach(frameWriter, s);
+
+	if (telemetryMs > 0 || metricsPort > 0) {
+		telemetry.setSources(frameWriter, output);
+		for (size_t s = 0; s < sessions.size(); s++)
+			sessions[s]->setTelemetry(&telemetry);
+		nextTelemetry = std::chrono::steady_clock::now() + std::chrono::milliseconds(telemetryMs);
+	}
+	if (metricsPort > 0) {
+		metricsServer = new MetricsServer(&telemetry, metricsPort);
+		if (metricsServer->start())
+			std::cerr << "Serving metrics on 127.0.0.1:" << metricsPort << std::endl;
 	}
+	frameWriter->start();
 
-	if (band == 6) {
-		// start 6 GHz Rssi data
-		std::cerr << "Starting 6 GHz rssi data stream." << std::endl;
-		wipryClarity->startRssiData(oscium::WiPryClarity::DataType::RSSI_6E, 0, 0, 0);
+	for (size_t s = 0; s < sessions.size() && run; s++) {
+		if (!sessions[s]->start())
+			run = false;
 	}
 
-	if (band == 25) {
-		// start Dual band RSSI data
-		std::cerr << "Starting Dual Band rssi data stream." << std::endl;
-		wipryClarity->startRssiData(oscium::WiPryClarity::DataType::RSSI_DUAL25, 0, 0, 0);
+	if (!controlPath.empty()) {
+		controlServer = new ControlServer(controlPath, events);
+		if (controlServer->start())
+			std::cerr << "Taking commands on " << controlPath << std::endl;
 	}
 
+	// sleep until something happens: a signal, a lost or reconnected device,
+	// the end of a replay, a command, or a reconnect attempt falling due
+	int timeoutMs = -1;
 	while (run) {
-	    std::this_thread::yield();
-            //Prevent CPU spinlock
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
-       }
+		int signal = events->wait(timeoutMs);
+		if (signal == SIGHUP) {
+			std::string error = reloadConfig();
+			if (!error.empty())
+				std::cerr << "Reload: " << error << "!" << std::endl;
+		}
+		else if (signal != 0)
+			break;
+		if (controlServer != nullptr)
+			controlServer->serve(controlCommand);
+
+		timeoutMs = -1;
+		bool ended = true;
+		for (size_t s = 0; s < sessions.size(); s++) {
+			int next = sessions[s]->supervise();
+			if (next >= 0 && (timeoutMs < 0 || next < timeoutMs))
+				timeoutMs = next;
+			ended = ended && sessions[s]->ended();
+		}
+		// a replay that ran out ends the run
+		if (ended)
+			run = false;
+	}
+
 
+	delete controlServer;
+	controlServer = nullptr;
 
-	// stop the data
-	std::cerr << "Stopping rssi data stream." << std::endl;
-	wipryClarity->stopRssiData();
+	// a dead InfluxDB must not keep the writer thread from finishing
+	if (influxSink != nullptr)
+		influxSink->shutdown();
 
-	// sleep for 500ms
-	std::this_thread::sleep_for(std::chrono::milliseconds(500));
+	// stop the data and close the connections, once the data threads are
+	// gone no more sweeps can come in
+	for (size_t s = 0; s < sessions.size(); s++)
+		sessions[s]->stop();
+	for (size_t s = 0; s < sessions.size(); s++)
+		sessions[s]->disconnect();
+
+	// flush whatever is still queued, the writer thread has exited so the
+	// partial batch can be written from here
+	frameWriter->stop();
+	for (size_t s = 0; s < sessions.size(); s++)
+		sessions[s]->flush(output);
+	// the final totals
+	nextTelemetry = std::chrono::steady_clock::time_point();
+	writeTelemetry();
+	output->flush();
+	// every sink writes what it still has queued, InfluxDB included
+	if (fanOut != nullptr)
+		fanOut->stop();
+	if (influxSink != nullptr) {
+		influxSink->stop();
+		std::cerr << "InfluxDB: " << influxSink->batchesSent() << " batches sent, " << influxSink->batchesDropped()
+			<< " dropped, " << influxSink->retries() << " retries, " << influxSink->bytesSent() << " bytes on the wire for "
+			<< influxSink->bytesBeforeGzip() << " bytes of line protocol." << std::endl;
+		const Spool *spool = influxSink->spoolStore();
+		if (spool != nullptr)
+			std::cerr << "Spool: " << spool->recordsSpooled() << " batches spooled, " << spool->recordsReplayed() << " replayed, "
+				<< spool->recordsEvicted() << " evicted, " << spool->recordsPending() << " left on disk." << std::endl;
+	}
+	if (fanOut != nullptr)
+		fanOut->report(std::cerr);
+	if (stdoutOutput != nullptr)
+		stdoutOutput->report(std::cerr);
+	for (size_t s = 0; s < sessions.size(); s++)
+		sessions[s]->report(std::cerr);
 
-	// closing connection
-	std::cerr<< "Closing connection to WiPry Clarity." << std::endl;
-	if (wipryClarity->didStartCommunication())
-		wipryClarity->endCommunication();
-	delete wipryClarity;
-	wipryClarity = nullptr;
+	for (size_t s = 0; s < sessions.size(); s++)
+		delete sessions[s];
+	sessions.clear();
+	delete metricsServer;
+	metricsServer = nullptr;
+	delete frameWriter;
+	frameWriter = nullptr;
+	delete captureWriter;
+	captureWriter = nullptr;
+	// with fan-out InfluxDB is one of its sinks rather than the output
+	if (fanOut != nullptr)
+		delete influxSink;
+	delete output;
+	output = nullptr;
+	stdoutOutput = nullptr;
+	fanOut = nullptr;
+	influxSink = nullptr;
+	if (recordFd >= 0)
+		close(recordFd);
+	delete events;
+	events = nullptr;
 
 
 	return 0;
@@ -0,0 +1,159 @@
+#include "output.h"
+#include <cerrno>
+#include <climits>
+#include <sys/uio.h>
+#include <unistd.h>
+
+
+// Start a new chunk once the current one holds this much; lines never straddle chunks.
+#define OUTPUT_CHUNK_BYTES (256 * 1024)
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+
+bool writeAll(int fd, const char *buf, size_t len) {
+	while (len > 0) {
+		ssize_t n = write(fd, buf, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		buf += n;
+		len -= n;
+	}
+	return true;
+}
+
+
+BatchedOutput::BatchedOutput(int fd, unsigned int batchLines, unsigned int flushMs)
+	: fd(fd), batchLines(batchLines > 0 ? batchLines : 1), flushMs(flushMs), chunks(1), active(0), pendingLines(0), written(0) {
+}
+
+
+LineBuffer &BatchedOutput::buffer() {
+	if (chunks[active].size() >= OUTPUT_CHUNK_BYTES) {
+		active++;
+		if (active == chunks.size())
+			chunks.push_back(LineBuffer());
+	}
+	return chunks[active];
+}
+
+
+void BatchedOutput::linesAdded(unsigned int lines) {
+	if (lines == 0)
+		return;
+	if (pendingLines == 0)
+		firstPending = std::chrono::steady_clock::now();
+	pendingLines += lines;
+
+	if (pendingLines >= batchLines)
+		send();
+	else
+		poll();
+}
+
+
+void BatchedOutput::poll() {
+	if (pendingLines == 0 || flushMs == 0)
+		return;
+	if (std::chrono::steady_clock::now() - firstPending >= std::chrono::milliseconds(flushMs))
+		send();
+}
+
+
+bool BatchedOutput::flush() {
+	if (gzip)
+		return sendCompressed(true);
+	return send();
+}
+
+
+bool BatchedOutput::setGzip(int level) {
+	gzip.reset(new GzipStream(level));
+	if (gzip->valid())
+		return true;
+	gzip.reset();
+	return false;
+}
+
+
+void BatchedOutput::report(std::ostream &out) const {
+	if (gzip)
+		gzip->report(out, "output");
+}
+
+
+bool BatchedOutput::send() {
+	if (gzip)
+		return sendCompressed(false);
+
+	bool ok = true;
+	struct iovec iov[IOV_MAX];
+	size_t c = 0;
+
+	while (c <= active && ok) {
+		int count = 0;
+		for (; c <= active && count < IOV_MAX; c++) {
+			if (chunks[c].size() == 0)
+				continue;
+			iov[count].iov_base = (void *)chunks[c].data();
+			iov[count].iov_len = chunks[c].size();
+			count++;
+		}
+
+		struct iovec *next = iov;
+		while (count > 0) {
+			ssize_t n = writev(fd, next, count);
+			if (n < 0) {
+				if (errno == EINTR)
+					continue;
+				ok = false;
+				break;
+			}
+			written.fetch_add(n, std::memory_order_relaxed);
+			// skip what was written, resuming mid-chunk after a short write
+			while (count > 0 && (size_t)n >= next->iov_len) {
+				n -= next->iov_len;
+				next++;
+				count--;
+			}
+			if (count > 0) {
+				next->iov_base = (char *)next->iov_base + n;
+				next->iov_len -= n;
+			}
+		}
+	}
+
+	for (c = 0; c <= active; c++)
+		chunks[c].clear();
+	active = 0;
+	pendingLines = 0;
+	return ok;
+}
+
+
+// The pending chunks through gzip and out with one write, ending on a sync
+// flush, or with end on the end of the gzip member.
+bool BatchedOutput::sendCompressed(bool end) {
+	bool ok = true;
+	for (size_t c = 0; c <= active; c++) {
+		ok = gzip->add(chunks[c].data(), chunks[c].size()) && ok;
+		chunks[c].clear();
+	}
+	active = 0;
+	pendingLines = 0;
+	ok = gzip->flush(end) && ok;
+
+	if (gzip->size() != 0) {
+		if (writeAll(fd, gzip->data(), gzip->size()))
+			written.fetch_add(gzip->size(), std::memory_order_relaxed);
+		else
+			ok = false;
+	}
+	gzip->clear();
+	return ok;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "sink.h"
+#include "gzip.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+/*
+
+    BatchedOutput
+
+    Collects complete lines in a few large chunks and hands them to the file
+    descriptor with one writev() once batchLines lines are pending or the
+    oldest pending line is flushMs old; a flushMs of 0 sets no age limit.
+    With batchLines of 1 every line is written as soon as it is added.
+
+    With gzip on, each batch is compressed on the way out and ends on a sync
+    flush, so a reader always has every line written so far; flush() closes
+    the gzip member.
+
+    Only the writer thread may touch it, except for flush() once that thread
+    has been stopped.
+
+*/
+
+
+// Writes all of buf to fd, retrying on short writes and signals.
+bool writeAll(int fd, const char *buf, size_t len);
+
+
+class BatchedOutput : public Sink {
+public:
+	BatchedOutput(int fd, unsigned int batchLines, unsigned int flushMs);
+
+	LineBuffer &buffer();
+	void linesAdded(unsigned int lines);
+	void poll();
+	bool flush();
+	unsigned long long bytesOut() const { return written.load(std::memory_order_relaxed); }
+
+	// Compresses everything written from now on, level 1-9.  False if zlib
+	// can not be set up.
+	bool setGzip(int level);
+
+	// The compression ratio and cost, nothing without gzip.
+	void report(std::ostream &out) const;
+
+private:
+	bool send();
+	bool sendCompressed(bool end);
+
+	int fd;
+	unsigned int batchLines;
+	unsigned int flushMs;
+
+	std::vector<LineBuffer> chunks;
+	size_t active;
+	unsigned int pendingLines;
+	std::chrono::steady_clock::time_point firstPending;
+	std::atomic<unsigned long long> written;
+	std::unique_ptr<GzipStream> gzip;
+};
@@ -0,0 +1,270 @@
+#include "peaks.h"
+#include <cstdio>
+
+
+// The bandwidth of a peak is measured this far below its maximum, at most.
+#define PEAKS_BANDWIDTH_DB 6.0f
+
+
+PeakDetector::PeakDetector(float prominence, unsigned int holdSweeps)
+	: prominence(prominence), holdSweeps(holdSweeps), evenNoiseFloor(-95), oddNoiseFloor(-95), dualSplit(0), closing(false), eventCount(0) {
+	const char *names[3] = { "2", "5", "6" };
+	for (int i = 0; i < 3; i++) {
+		bands[i].name = names[i];
+		bands[i].valid = false;
+		bands[i].freqLow = 0;
+		bands[i].freqHigh = 0;
+		bands[i].windowFirst = 0;
+		bands[i].windowWidth = 0;
+		bands[i].count = 0;
+		bands[i].tracksLow = 0;
+		bands[i].tracksStep = 0;
+		bands[i].trackCount = 0;
+		bands[i].nextId = 1;
+	}
+}
+
+
+void PeakDetector::setSerial(const std::string &aSerial) {
+	serial = aSerial;
+}
+
+
+void PeakDetector::setBoundary(oscium::WiPryClarity::DataType dataType, float freqLow, float freqHigh) {
+	Band *band = bandFor(dataType);
+	if (band == nullptr)
+		return;
+	band->valid = true;
+	band->freqLow = freqLow;
+	band->freqHigh = freqHigh;
+	band->count = 0;
+}
+
+
+void PeakDetector::setNoiseFloor(float even, float odd) {
+	evenNoiseFloor = even;
+	oddNoiseFloor = odd;
+}
+
+
+void PeakDetector::setWindow(oscium::WiPryClarity::DataType dataType, unsigned int first, unsigned int width) {
+	Band *band = bandFor(dataType);
+	if (band == nullptr)
+		return;
+	band->windowFirst = first;
+	band->windowWidth = width;
+	band->count = 0;
+}
+
+
+void PeakDetector::setDualSplit(unsigned int points) {
+	dualSplit = points;
+}
+
+
+PeakDetector::Band *PeakDetector::bandFor(oscium::WiPryClarity::DataType dataType) {
+	switch (dataType)
+	{
+		case oscium::WiPryClarity::DataType::RSSI_2_4GHZ:
+			return &bands[0];
+		case oscium::WiPryClarity::DataType::RSSI_5GHZ:
+			return &bands[1];
+		case oscium::WiPryClarity::DataType::RSSI_6E:
+			return &bands[2];
+		default:
+			return nullptr;
+	}
+}
+
+
+// The bins of a different sweep size mean different frequencies: open tracks
+// are stopped, still in the frequencies they were found in.
+unsigned int PeakDetector::reset(Band &band, unsigned int count, LineBuffer &out) {
+	unsigned int lines = endTracks(band, out);
+	band.count = count;
+	band.tracksLow = band.freqLow;
+	band.tracksStep = (band.freqHigh - band.freqLow) / (int)count;
+	return lines;
+}
+
+
+// Fills peaks with the peaks of points[first, end) and returns how many.
+// One pass, alternating between looking for a maximum that rises the
+// prominence above the last valley and a valley the prominence below it.
+unsigned int PeakDetector::detect(Band &band, const int8_t *points, unsigned int count) {
+	unsigned int first = 0, end = count;
+	if (band.windowWidth != 0) {
+		first = band.windowFirst < count ? band.windowFirst : count;
+		end = band.windowFirst + band.windowWidth < count ? band.windowFirst + band.windowWidth : count;
+	}
+
+	unsigned int found = 0;
+	float valley = evenNoiseFloor < oddNoiseFloor ? evenNoiseFloor : oddNoiseFloor;
+	float top = -1000;
+	unsigned int topBin = first;
+	bool rising = false;
+	for (unsigned int p = first; p <= end && found < PEAKS_MAX_PER_SWEEP; p++) {
+		// past the last bin the sweep falls back to the floor, which ends a peak still rising
+		float v = p < end ? points[p] : valley - prominence - 1;
+		if (!rising) {
+			if (v < valley)
+				valley = v;
+			else if (v >= valley + prominence) {
+				rising = true;
+				top = v;
+				topBin = p;
+			}
+			continue;
+		}
+		if (v > top) {
+			top = v;
+			topBin = p;
+			continue;
+		}
+		if (v > top - prominence)
+			continue;
+
+		rising = false;
+		valley = v;
+		float floor = (topBin & 1) ? oddNoiseFloor : evenNoiseFloor;
+		if (top <= floor)
+			continue;
+
+		float level = top - (prominence < PEAKS_BANDWIDTH_DB ? prominence : PEAKS_BANDWIDTH_DB);
+		unsigned int low = topBin, high = topBin;
+		while (low > first && points[low - 1] >= level)
+			low--;
+		while (high + 1 < end && points[high + 1] >= level)
+			high++;
+		peaks[found].low = low;
+		peaks[found].high = high;
+		peaks[found].dBm = top;
+		found++;
+	}
+	return found;
+}
+
+
+unsigned int PeakDetector::track(Band &band, const int8_t *points, unsigned int count, long long timens, LineBuffer &out) {
+	if (!band.valid)
+		return 0;
+	unsigned int lines = 0;
+	if (band.count != count)
+		lines += reset(band, count, out);
+
+	unsigned int found = detect(band, points, count);
+	for (unsigned int t = 0; t < band.trackCount; t++)
+		band.tracks[t].seen = false;
+
+	for (unsigned int i = 0; i < found; i++) {
+		const Peak &peak = peaks[i];
+		// the first open track whose span overlaps
+		unsigned int t = 0;
+		while (t < band.trackCount && (peak.high < band.tracks[t].low || peak.low > band.tracks[t].high))
+			t++;
+		if (t < band.trackCount) {
+			Track &match = band.tracks[t];
+			if (peak.low < match.low)
+				match.low = peak.low;
+			if (peak.high > match.high)
+				match.high = peak.high;
+			if (peak.dBm > match.dBm)
+				match.dBm = peak.dBm;
+			match.lastTimens = timens;
+			match.missed = 0;
+			match.seen = true;
+			continue;
+		}
+		if (band.trackCount == PEAKS_MAX_TRACKS)
+			continue;
+		Track &added = band.tracks[band.trackCount++];
+		added.id = band.nextId++;
+		added.low = peak.low;
+		added.high = peak.high;
+		added.dBm = peak.dBm;
+		added.startTimens = timens;
+		added.lastTimens = timens;
+		added.missed = 0;
+		added.seen = true;
+		writeEvent(band, added, true, out);
+		lines++;
+	}
+
+	// stop what has been missing long enough, keeping the rest in order
+	unsigned int kept = 0;
+	for (unsigned int t = 0; t < band.trackCount; t++) {
+		Track &open = band.tracks[t];
+		if (!open.seen && ++open.missed >= holdSweeps) {
+			writeEvent(band, open, false, out);
+			lines++;
+			continue;
+		}
+		if (kept != t)
+			band.tracks[kept] = open;
+		kept++;
+	}
+	band.trackCount = kept;
+	return lines;
+}
+
+
+unsigned int PeakDetector::endTracks(Band &band, LineBuffer &out) {
+	for (unsigned int t = 0; t < band.trackCount; t++)
+		writeEvent(band, band.tracks[t], false, out);
+	unsigned int lines = band.trackCount;
+	band.trackCount = 0;
+	return lines;
+}
+
+
+void PeakDetector::writeEvent(const Band &band, const Track &track, bool start, LineBuffer &out) {
+	// bin p covers freqLow + p * step onwards, as in the line protocol keys
+	float low = band.tracksLow + track.low * band.tracksStep;
+	float high = band.tracksLow + (track.high + 1) * band.tracksStep;
+
+	char line[512];
+	int n = snprintf(line, sizeof(line), "wipry_peak,serial=%s,band=%s,event=%s id=%u,center=%g,bandwidth=%g,peak=%d",
+		serial.c_str(), band.name, start ? "start" : "stop", track.id, (double)(low + high) / 2, (double)(high - low), (int)track.dBm);
+	if (n < 0 || n >= (int)sizeof(line))
+		return;
+	if (!start)
+		n += snprintf(line + n, sizeof(line) - n, ",duration_ms=%lld", (track.lastTimens - track.startTimens) / 1000000);
+	n += snprintf(line + n, sizeof(line) - n, " %lld\n", start ? track.startTimens : track.lastTimens);
+	out.append(line, n);
+	eventCount++;
+}
+
+
+void PeakDetector::endAll() {
+	closing = true;
+}
+
+
+unsigned int PeakDetector::add(const RssiFrame &frame, LineBuffer &out) {
+	unsigned int lines = 0;
+	if (closing) {
+		closing = false;
+		lines = flush(out);
+	}
+	if (frame.count == 0)
+		return lines;
+	if (frame.dataType == oscium::WiPryClarity::DataType::RSSI_DUAL25) {
+		unsigned int split = dualSplit != 0 ? dualSplit : frame.count / 2;
+		if (split >= frame.count)
+			return lines;
+		return lines + track(bands[0], frame.points, split, frame.timens, out)
+			+ track(bands[1], frame.points + split, frame.count - split, frame.timens, out);
+	}
+	Band *band = bandFor(frame.dataType);
+	if (band == nullptr)
+		return lines;
+	return lines + track(*band, frame.points, frame.count, frame.timens, out);
+}
+
+
+unsigned int PeakDetector::flush(LineBuffer &out) {
+	unsigned int lines = 0;
+	for (int i = 0; i < 3; i++)
+		lines += endTracks(bands[i], out);
+	return lines;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "WiPryClarity.h"
+#include "writer.h"
+#include "lineprotocol.h"
+#include <string>
+
+/*
+
+    PeakDetector
+
+    Finds transient energy, microwave ovens, video senders, radar, in the
+    sweeps and writes when it comes and goes instead of every bin:
+
+        wipry_peak,serial=<serial>,band=<2|5|6>,event=start id=<n>,center=<MHz>,bandwidth=<MHz>,peak=<dBm> <timens>\n
+        wipry_peak,serial=<serial>,band=<2|5|6>,event=stop id=<n>,center=<MHz>,bandwidth=<MHz>,peak=<dBm>,duration_ms=<ms> <timens>\n
+
+    A peak is a local maximum above the noise floor (the even limit for even
+    bins, the odd limit for odd bins) that rises at least the prominence
+    above the valleys on both sides of it.  Its bandwidth is the span of
+    bins around it within 6dB of the maximum, or within the prominence if
+    that is smaller, and its center the middle of that span.
+
+    Peaks are tracked from sweep to sweep by overlapping spans.  A track
+    starts with the first sweep it is seen in and stops once it has been
+    missing from holdSweeps sweeps of its band in a row; the stop carries
+    the union of the spans, the highest peak and the time it was last seen.
+    id pairs the start with its stop.  A change of band, zoom or band
+    boundaries stops every open track as well, so no start goes without
+    its stop.
+
+    Everything is in fixed arrays, no sweep allocates.
+
+*/
+
+
+// Peaks looked at per sweep and tracks per band, anything beyond is ignored.
+#define PEAKS_MAX_PER_SWEEP 64
+#define PEAKS_MAX_TRACKS 64
+
+
+class PeakDetector {
+public:
+	PeakDetector(float prominence, unsigned int holdSweeps);
+
+	void setSerial(const std::string &serial);
+	void setBoundary(oscium::WiPryClarity::DataType dataType, float freqLow, float freqHigh);
+	void setNoiseFloor(float even, float odd);
+
+	// As LineProtocolSerializer::setWindow and setDualSplit.
+	void setWindow(oscium::WiPryClarity::DataType dataType, unsigned int first, unsigned int width);
+	void setDualSplit(unsigned int points);
+
+	// Looks for peaks in frame and appends the events it causes.  Returns the
+	// number of lines appended.
+	unsigned int add(const RssiFrame &frame, LineBuffer &out);
+
+	// Appends a stop for every track still open.
+	unsigned int flush(LineBuffer &out);
+
+	// The next add() stops every open track first: the sweeps after a band
+	// or zoom change do not continue them.  Only while the writer thread
+	// keeps off the detector, as for setWindow().
+	void endAll();
+
+	unsigned long long events() const { return eventCount; }
+
+private:
+	struct Peak {
+		unsigned int low, high;		// bins, inclusive
+		float dBm;
+	};
+
+	struct Track {
+		unsigned int id;
+		unsigned int low, high;		// union of the spans seen
+		float dBm;					// highest peak seen
+		long long startTimens, lastTimens;
+		unsigned int missed;		// sweeps in a row without it
+		bool seen;					// matched in the current sweep
+	};
+
+	struct Band {
+		const char *name;
+		bool valid;
+		float freqLow, freqHigh;
+		unsigned int windowFirst, windowWidth;
+		unsigned int count;			// sweep size the tracks are for
+		float tracksLow, tracksStep;	// MHz of bin 0 and per bin when they were found
+		Track tracks[PEAKS_MAX_TRACKS];
+		unsigned int trackCount;
+		unsigned int nextId;
+	};
+
+	Band *bandFor(oscium::WiPryClarity::DataType dataType);
+	unsigned int reset(Band &band, unsigned int count, LineBuffer &out);
+	unsigned int detect(Band &band, const int8_t *points, unsigned int count);
+	unsigned int track(Band &band, const int8_t *points, unsigned int count, long long timens, LineBuffer &out);
+	unsigned int endTracks(Band &band, LineBuffer &out);
+	void writeEvent(const Band &band, const Track &track, bool start, LineBuffer &out);
+
+	float prominence;
+	unsigned int holdSweeps;
+	std::string serial;
+	float evenNoiseFloor, oddNoiseFloor;
+	unsigned int dualSplit;
+	Peak peaks[PEAKS_MAX_PER_SWEEP];
+	Band bands[3];
+	bool closing;				// endAll() was called
+	unsigned long long eventCount;
+};
@@ -0,0 +1,192 @@
+#include "device.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+
+static int bandIndex(int band) {
+	switch (band) {
+		case 2:
+			return 0;
+		case 5:
+			return 1;
+		case 6:
+			return 2;
+		default:
+			return -1;
+	}
+}
+
+
+ReplayDevice::ReplayDevice(const std::string &path, double speed) : path(path), speed(speed) {
+	for (int i = 0; i < 3; i++) {
+		haveBand[i] = false;
+		freqLow[i] = 0;
+		freqHigh[i] = 0;
+	}
+}
+
+
+ReplayDevice::~ReplayDevice() {
+	endCommunication();
+}
+
+
+// Splits "wipry,serial=S,band=N f=v,f=v,... timens" into its parts.  The
+// sweep values go to the sweep member, the frequency keys to keys if given.
+bool ReplayDevice::parseLine(const std::string &line, int &band, long long &timens, std::vector<float> *keys) {
+	if (line.compare(0, 6, "wipry,") != 0)
+		return false;
+	size_t fieldsStart = line.find(' ');
+	size_t fieldsEnd = line.rfind(' ');
+	if (fieldsStart == std::string::npos || fieldsEnd <= fieldsStart)
+		return false;
+
+	size_t bandTag = line.find(",band=");
+	if (bandTag == std::string::npos || bandTag > fieldsStart)
+		return false;
+	band = atoi(line.c_str() + bandTag + 6);
+	if (serial.empty()) {
+		size_t serialTag = line.find("serial=");
+		if (serialTag != std::string::npos && serialTag < fieldsStart) {
+			size_t end = line.find_first_of(", ", serialTag);
+			serial = line.substr(serialTag + 7, end - serialTag - 7);
+		}
+	}
+	timens = atoll(line.c_str() + fieldsEnd + 1);
+
+	sweep.clear();
+	const char *p = line.c_str() + fieldsStart + 1;
+	const char *end = line.c_str() + fieldsEnd;
+	while (p < end) {
+		char *next;
+		float key = strtof(p, &next);
+		if (*next != '=')
+			return false;
+		long value = strtol(next + 1, &next, 10);
+		if (keys != nullptr)
+			keys->push_back(key);
+		sweep.push_back((float)value);
+		p = next + 1;
+	}
+	return !sweep.empty();
+}
+
+
+bool ReplayDevice::open() {
+	std::ifstream in(path.c_str());
+	if (!in) {
+		std::cerr << "Unable to open " << path << std::endl;
+		return false;
+	}
+
+	// the first sweep of each band gives its frequency axis
+	std::string line;
+	int found = 0;
+	while (found < 3 && std::getline(in, line)) {
+		int band;
+		long long timens;
+		std::vector<float> keys;
+		if (!parseLine(line, band, timens, &keys))
+			continue;
+		int b = bandIndex(band);
+		if (b < 0 || haveBand[b])
+			continue;
+		float step = keys.size() > 1 ? (keys.back() - keys.front()) / (keys.size() - 1) : 1.0f;
+		freqLow[b] = keys.front();
+		freqHigh[b] = keys.front() + step * keys.size();
+		haveBand[b] = true;
+		found++;
+	}
+
+	if (found == 0) {
+		std::cerr << "No wipry sweeps in " << path << std::endl;
+		return false;
+	}
+	return true;
+}
+
+
+bool ReplayDevice::boundary(int b, float *minMHz, float *maxMHz) {
+	if (!haveBand[b])
+		return false;
+	*minMHz = freqLow[b];
+	*maxMHz = freqHigh[b];
+	return true;
+}
+
+
+bool ReplayDevice::getOddRssiLimts(float *min, float *max, float *noiseFloor) {
+	// not recorded in line protocol, these are typical values
+	*min = -110;
+	*max = -10;
+	*noiseFloor = -95;
+	return true;
+}
+
+
+bool ReplayDevice::getEvenRssiLimts(float *min, float *max, float *noiseFloor) {
+	return getOddRssiLimts(min, max, noiseFloor);
+}
+
+
+bool ReplayDevice::get2_4GHzBoundary(float *minMHz, float *maxMHz) {
+	return boundary(0, minMHz, maxMHz);
+}
+
+
+bool ReplayDevice::get5GHzBoundary(float *minMHz, float *maxMHz) {
+	return boundary(1, minMHz, maxMHz);
+}
+
+
+bool ReplayDevice::get6EBoundary(float *minMHz, float *maxMHz) {
+	return boundary(2, minMHz, maxMHz);
+}
+
+
+bool ReplayDevice::stream(oscium::WiPryClarity::DataType dataType) {
+	int wanted;
+	switch (dataType) {
+		case oscium::WiPryClarity::DataType::RSSI_2_4GHZ:
+			wanted = 2;
+			break;
+		case oscium::WiPryClarity::DataType::RSSI_5GHZ:
+			wanted = 5;
+			break;
+		case oscium::WiPryClarity::DataType::RSSI_6E:
+			wanted = 6;
+			break;
+		default:
+			std::cerr << "Replay has no data for this band." << std::endl;
+			return false;
+	}
+
+	std::ifstream in(path.c_str());
+	std::string line;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	long long firstTimens = -1;
+
+	while (keepStreaming(dataType)) {
+		if (!std::getline(in, line))
+			return false;
+
+		int band;
+		long long timens;
+		if (!parseLine(line, band, timens, nullptr) || band != wanted)
+			continue;
+
+		if (speed > 0) {
+			if (firstTimens < 0)
+				firstTimens = timens;
+			std::this_thread::sleep_until(start + std::chrono::nanoseconds((long long)((timens - firstTimens) / speed)));
+		}
+
+		if (delegate != nullptr)
+			delegate->deviceDidReceiveRSSIData(this, dataType, sweep);
+		frames.fetch_add(1, std::memory_order_relaxed);
+	}
+	return true;
+}
@@ -0,0 +1,207 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+/*
+
+    SpscRing
+
+    Preallocated, lock-free ring for exactly one producer thread (the
+    libWiPryClarity data thread) and one consumer thread (the writer).
+
+    When the ring is full the producer either refuses the new element
+    (DropNewest) or discards the oldest unread one (DropOldest).  Discarding
+    moves the consumer index, so the consumer copies a slot out first and only
+    then claims it with a CAS.  If the producer dropped that slot in the
+    meantime the CAS fails and the copy is thrown away.
+
+*/
+
+
+enum class OverflowPolicy {
+	DropNewest,
+	DropOldest
+};
+
+
+template <typename T>
+class SpscRing {
+public:
+	explicit SpscRing(size_t capacity) : slots(capacity < 1 ? 1 : capacity), head(0), tail(0) {}
+
+	size_t capacity() const { return slots.size(); }
+
+	size_t size() const {
+		return (size_t)(tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire));
+	}
+
+	// Producer: returns the slot to fill in, or nullptr if the ring is full and the
+	// policy is DropNewest.  droppedOldest is set when an unread element was discarded
+	// to make room.  A non-null slot must be published with commit().
+	T *reserve(OverflowPolicy policy, bool &droppedOldest) {
+		droppedOldest = false;
+		unsigned long long t = tail.load(std::memory_order_relaxed);
+		unsigned long long h = head.load(std::memory_order_acquire);
+		while (t - h >= slots.size()) {
+			if (policy == OverflowPolicy::DropNewest)
+				return nullptr;
+			if (head.compare_exchange_weak(h, h + 1, std::memory_order_acq_rel, std::memory_order_acquire)) {
+				droppedOldest = true;
+				break;
+			}
+		}
+		return &slots[t % slots.size()];
+	}
+
+	void commit() {
+		tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	// Consumer: copies the oldest element into out.  Returns false if the ring is empty.
+	bool pop(T &out) {
+		unsigned long long h = head.load(std::memory_order_acquire);
+		while (h != tail.load(std::memory_order_acquire)) {
+			out = slots[h % slots.size()];
+			if (head.compare_exchange_strong(h, h + 1, std::memory_order_acq_rel, std::memory_order_acquire))
+				return true;
+			// lost the slot to a DropOldest push, h now holds the new head
+		}
+		return false;
+	}
+
+private:
+	std::vector<T> slots;
+	// keep the two indices on separate cache lines
+	char pad0[64];
+	std::atomic<unsigned long long> head;
+	char pad1[64];
+	std::atomic<unsigned long long> tail;
+	char pad2[64];
+};
+
+
+/*
+
+    PooledRing
+
+    The same ring for frames too big to copy around twice.  Every frame is
+    allocated once, up front, each on its own cache lines; the ring and a
+    free list only pass pointers.  The producer fills a free frame in place
+    and publishes it, the consumer works on it where it is and hands it
+    back with release(), so a frame is written once and read once and
+    nothing is allocated while frames flow.
+
+    There are two frames more than the ring holds, one being filled and one
+    the consumer has not released yet, so the producer only ever finds the
+    free list empty if the consumer holds on to more than one frame.  A
+    frame dropped by DropOldest goes straight back to the producer.
+
+*/
+
+
+template <typename T>
+class PooledRing {
+public:
+	explicit PooledRing(size_t capacity)
+		: slots(capacity < 1 ? 1 : capacity), unused(slots.size() + 2), frameCount(slots.size() + 2), filling(nullptr), head(0), tail(0) {
+		// a frame per stride, starting on a cache line
+		stride = (sizeof(T) + 63) / 64 * 64;
+		void *block = nullptr;
+		if (posix_memalign(&block, 64, stride * frameCount) != 0)
+			throw std::bad_alloc();
+		frames = (char *)block;
+		for (size_t f = 0; f < frameCount; f++) {
+			bool dropped;
+			T **entry = unused.reserve(OverflowPolicy::DropNewest, dropped);
+			*entry = new (frames + f * stride) T();
+			unused.commit();
+		}
+	}
+
+	~PooledRing() {
+		for (size_t f = 0; f < frameCount; f++)
+			((T *)(frames + f * stride))->~T();
+		free(frames);
+	}
+
+	PooledRing(const PooledRing &) = delete;
+	PooledRing &operator=(const PooledRing &) = delete;
+
+	size_t capacity() const { return slots.size(); }
+
+	// Bytes held by the pool, every frame included.
+	size_t bytes() const { return stride * frameCount; }
+
+	size_t size() const {
+		return (size_t)(tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire));
+	}
+
+	// Producer: returns a frame to fill in, or nullptr if the ring is full and the
+	// policy is DropNewest.  droppedOldest is set when an unread frame was discarded
+	// to make room.  A non-null frame must be published with commit().
+	T *reserve(OverflowPolicy policy, bool &droppedOldest) {
+		droppedOldest = false;
+		T *frame = nullptr;
+		unsigned long long t = tail.load(std::memory_order_relaxed);
+		unsigned long long h = head.load(std::memory_order_acquire);
+		while (t - h >= slots.size()) {
+			if (policy == OverflowPolicy::DropNewest)
+				return nullptr;
+			if (head.compare_exchange_weak(h, h + 1, std::memory_order_acq_rel, std::memory_order_acquire)) {
+				// the consumer lost this one, it is ours to reuse
+				droppedOldest = true;
+				frame = slots[h % slots.size()].load(std::memory_order_relaxed);
+				break;
+			}
+		}
+		if (frame == nullptr && !unused.pop(frame))
+			return nullptr;
+		filling = frame;
+		return frame;
+	}
+
+	void commit() {
+		unsigned long long t = tail.load(std::memory_order_relaxed);
+		slots[t % slots.size()].store(filling, std::memory_order_relaxed);
+		tail.store(t + 1, std::memory_order_release);
+	}
+
+	// Consumer: takes the oldest frame, nullptr if the ring is empty.  The frame
+	// stays the consumer's until it is given back with release().
+	T *acquire() {
+		unsigned long long h = head.load(std::memory_order_acquire);
+		while (h != tail.load(std::memory_order_acquire)) {
+			T *frame = slots[h % slots.size()].load(std::memory_order_relaxed);
+			if (head.compare_exchange_strong(h, h + 1, std::memory_order_acq_rel, std::memory_order_acquire))
+				return frame;
+			// lost the frame to a DropOldest push, h now holds the new head
+		}
+		return nullptr;
+	}
+
+	void release(T *frame) {
+		bool dropped;
+		T **entry = unused.reserve(OverflowPolicy::DropNewest, dropped);
+		if (entry == nullptr)
+			return;
+		*entry = frame;
+		unused.commit();
+	}
+
+private:
+	std::vector<std::atomic<T *>> slots;
+	SpscRing<T *> unused;		// free frames, consumer to producer
+	size_t frameCount;
+	size_t stride;
+	char *frames;
+	T *filling;					// producer: reserved, not yet committed
+	char pad0[64];
+	std::atomic<unsigned long long> head;
+	char pad1[64];
+	std::atomic<unsigned long long> tail;
+	char pad2[64];
+};
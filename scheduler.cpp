@@ -0,0 +1,232 @@
+#include "scheduler.h"
+#include <cstdlib>
+#include <iostream>
+
+
+// A counted dwell that gets no sweeps for this long moves on anyway.
+#define SCHEDULER_STALL_MS 5000
+
+
+static double toMs(std::chrono::steady_clock::duration d) {
+	return std::chrono::duration<double, std::milli>(d).count();
+}
+
+
+bool BandDwell::parse(const std::string &spec) {
+	char *end;
+	long n = strtol(spec.c_str(), &end, 10);
+	if (end == spec.c_str() || n < 0)
+		return false;
+	std::string unit(end);
+	if (unit.empty()) {
+		sweeps = n;
+		ms = 0;
+	}
+	else if (unit == "ms" || unit == "s") {
+		sweeps = 0;
+		ms = unit == "s" ? n * 1000 : n;
+	}
+	else
+		return false;
+	return true;
+}
+
+
+BandScheduler::BandScheduler(Device *device)
+	: device(device), running(false), current(-1), sliceSweeps(0), awaitingFirst(false),
+	switches(0), gaps(0), reactions(0), lateFrames(0), gapTotal(0), gapMax(0), reactionTotal(0), switchCallTotal(0) {
+	const oscium::WiPryClarity::DataType types[3] = {
+		oscium::WiPryClarity::DataType::RSSI_2_4GHZ,
+		oscium::WiPryClarity::DataType::RSSI_5GHZ,
+		oscium::WiPryClarity::DataType::RSSI_6E
+	};
+	const char *names[3] = {"2.4GHz", "5GHz", "6E"};
+	for (int b = 0; b < 3; b++) {
+		bands[b].dataType = types[b];
+		bands[b].name = names[b];
+		bands[b].sweeps = 0;
+		bands[b].slices = 0;
+		bands[b].stalls = 0;
+		bands[b].active = Clock::duration(0);
+	}
+}
+
+
+BandScheduler::~BandScheduler() {
+	stop();
+}
+
+
+void BandScheduler::setDwell(int band, const BandDwell &dwell) {
+	bands[band].dwell = dwell;
+}
+
+
+int BandScheduler::nextBand(int from) const {
+	for (int i = 1; i <= 3; i++) {
+		int b = (from + i) % 3;
+		if (bands[b].dwell.sweeps != 0 || bands[b].dwell.ms != 0)
+			return b;
+	}
+	return -1;
+}
+
+
+bool BandScheduler::start() {
+	// started again after a stop, carry on with the band it stopped on
+	int first = current >= 0 ? current : nextBand(2);
+	if (first < 0)
+		return false;
+
+	std::unique_lock<std::mutex> lock(mutex);
+	current = first;
+	sliceSweeps = 0;
+	awaitingFirst = false;
+	running = true;
+	lock.unlock();
+
+	if (!device->startRssiData(bands[first].dataType, 0, 0, 0)) {
+		running = false;
+		return false;
+	}
+
+	lock.lock();
+	sliceStart = Clock::now();
+	if (switches == 0 && bands[first].slices == 0)
+		runStart = sliceStart;
+	bands[first].slices++;
+	lock.unlock();
+	thread = std::thread(&BandScheduler::threadMain, this);
+	return true;
+}
+
+
+void BandScheduler::stop() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!running)
+			return;
+		running = false;
+	}
+	wake.notify_one();
+	if (thread.joinable())
+		thread.join();
+
+	std::lock_guard<std::mutex> lock(mutex);
+	bands[current].active += Clock::now() - sliceStart;
+}
+
+
+void BandScheduler::frameReceived(oscium::WiPryClarity::DataType dataType) {
+	Clock::time_point now = Clock::now();
+	std::lock_guard<std::mutex> lock(mutex);
+	if (current < 0)
+		return;
+	Band &band = bands[current];
+	if (band.dataType != dataType) {
+		lateFrames++;
+		return;
+	}
+
+	if (awaitingFirst) {
+		Clock::duration gap = now - lastFrame;
+		gapTotal += gap;
+		if (gap > gapMax)
+			gapMax = gap;
+		gaps++;
+		awaitingFirst = false;
+	}
+	lastFrame = now;
+	band.sweeps++;
+	sliceSweeps++;
+	if (band.dwell.sweeps != 0 && sliceSweeps == band.dwell.sweeps) {
+		dwellReached = now;
+		wake.notify_one();
+	}
+}
+
+
+void BandScheduler::threadMain() {
+	std::unique_lock<std::mutex> lock(mutex);
+	while (running) {
+		Band &band = bands[current];
+		bool counted = band.dwell.sweeps != 0;
+		Clock::time_point deadline = sliceStart
+			+ std::chrono::milliseconds(counted ? SCHEDULER_STALL_MS : band.dwell.ms);
+
+		bool reached = wake.wait_until(lock, deadline, [&] {
+			return !running || (counted && sliceSweeps >= band.dwell.sweeps);
+		});
+		if (!running)
+			break;
+		if (counted && !reached) {
+			band.stalls++;
+			// keep waiting if this is the only band, there is nothing to switch to
+			if (nextBand(current) == current) {
+				sliceStart = Clock::now();
+				continue;
+			}
+		}
+
+		int next = nextBand(current);
+		if (next == current) {
+			// one band enabled, a new slice starts in place
+			band.active += Clock::now() - sliceStart;
+			sliceStart = Clock::now();
+			sliceSweeps = 0;
+			band.slices++;
+			continue;
+		}
+
+		// frames of the old band that still come in after this are late
+		Clock::time_point switchStart = Clock::now();
+		if (counted && reached) {
+			reactionTotal += switchStart - dwellReached;
+			reactions++;
+		}
+		band.active += switchStart - sliceStart;
+		current = next;
+		sliceSweeps = 0;
+		awaitingFirst = band.sweeps != 0;
+		lock.unlock();
+
+		device->stopRssiData();
+		bool started = device->startRssiData(bands[next].dataType, 0, 0, 0);
+
+		lock.lock();
+		Clock::time_point switchEnd = Clock::now();
+		switchCallTotal += switchEnd - switchStart;
+		sliceStart = switchEnd;
+		bands[next].slices++;
+		switches++;
+		if (!started)
+			std::cerr << "Unable to start " << bands[next].name << " rssi data stream." << std::endl;
+	}
+}
+
+
+void BandScheduler::report(std::ostream &out) {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (int b = 0; b < 3; b++) {
+		const Band &band = bands[b];
+		if (band.slices == 0)
+			continue;
+		double seconds = toMs(band.active) / 1000;
+		out << band.name << ": " << band.sweeps << " sweeps in " << band.slices << " dwells, "
+			<< (seconds > 0 ? band.sweeps / seconds : 0) << " sweeps/s while dwelling";
+		if (band.stalls != 0)
+			out << ", " << band.stalls << " dwells timed out";
+		out << std::endl;
+	}
+	if (switches == 0)
+		return;
+
+	double elapsed = toMs(Clock::now() - runStart);
+	out << "Band switches: " << switches << ", " << toMs(switchCallTotal) / switches << "ms in stop/start";
+	if (reactions != 0)
+		out << ", " << toMs(reactionTotal) / reactions << "ms to react";
+	if (gaps != 0)
+		out << ", gap between bands " << toMs(gapTotal) / gaps << "ms mean " << toMs(gapMax) << "ms max, "
+			<< 100 * toMs(gapTotal) / elapsed << "% of the run";
+	out << ", " << lateFrames << " late sweeps" << std::endl;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "device.h"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+
+/*
+
+    BandScheduler
+
+    Covers 2.4GHz, 5GHz and 6E with one WiPry by streaming each band in turn.
+    A band dwells for a number of sweeps or for a fixed time.  Counted dwells
+    end as soon as the last sweep arrives: the callback wakes the scheduler
+    thread, which stops the stream and starts the next band right away, so
+    the only time lost is what the device needs to retune.
+
+    The gap between the last sweep of one band and the first sweep of the
+    next is measured on every switch, along with the per-band sweep rate
+    while dwelling, so the dwell ratios can be tuned.
+
+*/
+
+
+// How long a band is streamed before moving on.  With sweeps set the band
+// moves on after that many sweeps, otherwise after ms milliseconds.  Both
+// zero leaves the band out.
+struct BandDwell {
+	unsigned int sweeps;
+	unsigned int ms;
+
+	BandDwell() : sweeps(10), ms(0) {}
+
+	// "N" for N sweeps, "Nms" or "Ns" for a time, "0" to skip the band.
+	bool parse(const std::string &spec);
+};
+
+
+class BandScheduler {
+public:
+	explicit BandScheduler(Device *device);
+	~BandScheduler();
+
+	// Index 0, 1, 2 for 2.4GHz, 5GHz and 6E.
+	void setDwell(int band, const BandDwell &dwell);
+
+	// Starts streaming the first band and the thread that rotates them, or
+	// after a stop() the band it stopped on.  False if no band is enabled or
+	// the device refuses to stream.
+	bool start();
+
+	// Stops rotating.  The current band keeps streaming until the caller stops it.
+	void stop();
+
+	// Called from the device callback for every sweep.
+	void frameReceived(oscium::WiPryClarity::DataType dataType);
+
+	void report(std::ostream &out);
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	struct Band {
+		oscium::WiPryClarity::DataType dataType;
+		const char *name;
+		BandDwell dwell;
+		unsigned long long sweeps;
+		unsigned long long slices;
+		unsigned long long stalls;		// counted dwells that timed out
+		Clock::duration active;
+	};
+
+	void threadMain();
+	int nextBand(int from) const;
+
+	Device *device;
+	Band bands[3];
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::thread thread;
+	bool running;
+
+	int current;
+	unsigned int sliceSweeps;
+	Clock::time_point sliceStart;
+	Clock::time_point lastFrame;
+	Clock::time_point dwellReached;
+	bool awaitingFirst;
+	Clock::time_point runStart;
+
+	unsigned long long switches;
+	unsigned long long gaps;
+	unsigned long long reactions;
+	unsigned long long lateFrames;		// sweeps of a band already switched away from
+	Clock::duration gapTotal, gapMax;
+	Clock::duration reactionTotal;		// last counted sweep to stopRssiData()
+	Clock::duration switchCallTotal;	// stopRssiData() + startRssiData()
+};
@@ -0,0 +1,588 @@
+#include "session.h"
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <signal.h>
+#include <unistd.h>
+
+
+// Wait before the second try at reconnecting a lost device, doubled after every failed try.
+#define SESSION_RECONNECT_MIN_MS 100
+#define SESSION_RECONNECT_MAX_MS 10000
+// A connection attempt without an answer is given up after this long.
+#define SESSION_CONNECT_TIMEOUT_MS 10000
+// prepareZoom() gives up on getting a sweep after this long.
+#define SESSION_PROBE_MS 10000
+
+
+static double toMs(std::chrono::steady_clock::duration d) {
+	return std::chrono::duration<double, std::milli>(d).count();
+}
+
+
+static oscium::WiPryClarity::DataType bandDataType(unsigned int band) {
+	return band == 2 ? oscium::WiPryClarity::DataType::RSSI_2_4GHZ
+		: band == 5 ? oscium::WiPryClarity::DataType::RSSI_5GHZ
+		: band == 6 ? oscium::WiPryClarity::DataType::RSSI_6E : oscium::WiPryClarity::DataType::RSSI_DUAL25;
+}
+
+
+Session::Session(Device *aDevice, const SessionConfig &aConfig, EventLoop *events)
+	: device(aDevice), events(events), config(aConfig), isConnected(false), connectionProcessComplete(true), dataEnded(false),
+	lost(false), lostAt(0), probing(false), sweepPoints(0), evenMin(0), evenMax(0), evenNoiseFloor(0), oddMin(0), oddMax(0), oddNoiseFloor(0),
+	zoomStart(0), zoomWidth(0), aggregator(nullptr), detector(nullptr), spectrogram(nullptr), captureWriter(nullptr), scheduler(nullptr), scheduling(false),
+	telemetry(nullptr), writer(nullptr), queue(0), lastTimedType(-1), pendingSchema(-1), lastSweepAt(0), switchPending(false), switchFrom(0),
+	switchCount(0), switchLastNs(0), switchTotalNs(0), switchMaxNs(0), link(LinkUp), streamingWanted(false), backoffMs(SESSION_RECONNECT_MIN_MS),
+	reconnects(0), reconnectAttempts(0), reconnectTotal(0), reconnectMax(0) {
+	for (int t = 0; t < 4; t++) {
+		frameCount[t] = 0;
+		bandPoints[t] = 0;
+	}
+	for (int b = 0; b < 3; b++)
+		freqLow[b] = freqHigh[b] = 0;
+
+	serializer.setDualSplit(config.dualSplit);
+	serializer.setSchema(config.schema);
+	serializer.setSweepFields(config.sweepFields);
+	if (config.deadband >= 0)
+		serializer.setDeadband(config.deadband, config.keyframeSweeps, config.keyframeMs);
+	if (config.channelWindowMs >= 0) {
+		aggregator = new ChannelAggregator(config.channelWindowMs);
+		aggregator->setPscOnly(config.channelsPscOnly);
+		aggregator->setDualSplit(config.dualSplit);
+	}
+	if (config.peakProminence >= 0) {
+		detector = new PeakDetector(config.peakProminence, config.peakHoldSweeps);
+		detector->setDualSplit(config.dualSplit);
+	}
+	if (config.summaryMs >= 0) {
+		spectrogram = new SpectrogramStore(config.summarySweeps, config.summaryMs);
+		spectrogram->setDualSplit(config.dualSplit);
+	}
+	device->setDelegate(this);
+}
+
+
+Session::~Session() {
+	delete scheduler;
+	delete device;
+	delete aggregator;
+	delete detector;
+	delete spectrogram;
+}
+
+
+bool Session::connect() {
+	std::cerr << config.logPrefix << "Starting connection process." << std::endl;
+	connectionProcessComplete = false;
+	isConnected = false;
+
+	if (!device->startCommunication()) {
+		std::cerr << config.logPrefix << "Error: Unable to connect to the WiPryClarity. Make sure that the device has been connected." << std::endl;
+		return false;
+	}
+
+	// wait for the connection process to complete; a config reload is not
+	// a reason to give up, it is raised again for the main loop afterwards
+	bool reload = false;
+	while (!connectionProcessComplete) {
+		int signal = events->wait(-1);
+		if (signal == SIGHUP)
+			reload = true;
+		else if (signal != 0)
+			return false;
+	}
+	if (reload)
+		kill(getpid(), SIGHUP);
+	if (!isConnected)
+		return false;
+
+	std::cerr << config.logPrefix << "Connection Success." << std::endl;
+	readSerial();
+	return true;
+}
+
+
+void Session::readSerial() {
+	std::string number = device->getSerialNumber();
+	if (number == serial)
+		return;
+	if (!serial.empty())
+		std::cerr << config.logPrefix << "A different WiPry answered, was " << serial << "." << std::endl;
+	serial = number;
+	serializer.setSerial(serial);
+	if (aggregator != nullptr)
+		aggregator->setSerial(serial);
+	if (detector != nullptr)
+		detector->setSerial(serial);
+	if (spectrogram != nullptr)
+		spectrogram->setSerial(serial);
+	std::cerr << config.logPrefix << "Serial Number: " << serial << std::endl;
+}
+
+
+bool Session::prepareZoom() {
+	if (config.zoom.empty())
+		return true;
+
+	// the window is given in bins of an unzoomed sweep, stream one to count
+	// them unless the band has streamed before
+	oscium::WiPryClarity::DataType dataType = bandDataType(config.band);
+	int b = (int)dataType;
+	unsigned int points = bandPoints[b];
+	if (points == 0) {
+		sweepPoints = 0;
+		probing = true;
+		if (device->startRssiData(dataType, 0, 0, 0)) {
+			Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(SESSION_PROBE_MS);
+			while (sweepPoints == 0 && !dataEnded && Clock::now() < deadline) {
+				int left = (int)std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+				if (int signal = events->wait(left + 1)) {
+					// raised again for the main loop, which waits on the same signals
+					kill(getpid(), signal);
+					break;
+				}
+			}
+			device->stopRssiData();
+			points = sweepPoints;
+		}
+		probing = false;
+	}
+	uint16_t first, width;
+	if (points == 0 || !zoomWindow(config.zoom, freqLow[b], freqHigh[b], points, first, width)) {
+		std::cerr << config.logPrefix << (points == 0 ? "No sweep to size the zoom window from!" : "Zoom range is outside the band!") << std::endl;
+		return false;
+	}
+	float step = (freqHigh[b] - freqLow[b]) / points;
+	std::cerr << config.logPrefix << "Zooming on bins " << first << " to " << first + width - 1 << " of " << points << ", "
+		<< freqLow[b] + first * step << " to " << freqLow[b] + (first + width) * step << " MHz" << std::endl;
+	setWindow(dataType, first, width);
+	return true;
+}
+
+
+void Session::setWindow(oscium::WiPryClarity::DataType dataType, uint16_t first, uint16_t width) {
+	zoomStart = first;
+	zoomWidth = width;
+	serializer.setWindow(dataType, first, width);
+	if (aggregator != nullptr)
+		aggregator->setWindow(dataType, first, width);
+	if (detector != nullptr)
+		detector->setWindow(dataType, first, width);
+	if (spectrogram != nullptr)
+		spectrogram->setWindow(dataType, first, width);
+}
+
+
+void Session::attach(FrameWriter *aWriter, unsigned int aQueue) {
+	queue = aQueue;
+	writer = aWriter;
+}
+
+
+void Session::fillCaptureHeader(CaptureHeader &header, CaptureEncoding encoding) const {
+	captureHeaderInit(header, config.band, encoding, serial);
+	for (int b = 0; b < 3; b++) {
+		header.freqLow[b] = freqLow[b];
+		header.freqHigh[b] = freqHigh[b];
+	}
+	header.evenMin = evenMin;
+	header.evenMax = evenMax;
+	header.evenNoiseFloor = evenNoiseFloor;
+	header.oddMin = oddMin;
+	header.oddMax = oddMax;
+	header.oddNoiseFloor = oddNoiseFloor;
+	header.dualSplit = config.dualSplit;
+	header.zoomStart = zoomStart;
+	header.zoomWidth = zoomWidth;
+}
+
+
+bool Session::start() {
+	streamingWanted = true;
+	lastTimedType = -2;
+	// the data thread may see scheduling as soon as it is set, and a trailing
+	// sweep of the band before can come in at any time: the scheduler has to
+	// exist by then
+	if (config.band == 256 && scheduler == nullptr) {
+		scheduler = new BandScheduler(device);
+		for (int b = 0; b < 3; b++)
+			scheduler->setDwell(b, config.dwell[b]);
+	}
+	scheduling.store(config.band == 256, std::memory_order_release);
+	switch (config.band) {
+		case 2:
+			std::cerr << config.logPrefix << "Starting 2.4 GHz rssi data stream." << std::endl;
+			break;
+		case 5:
+			std::cerr << config.logPrefix << "Starting 5 GHz rssi data stream." << std::endl;
+			break;
+		case 6:
+			std::cerr << config.logPrefix << "Starting 6 GHz rssi data stream." << std::endl;
+			break;
+		case 25:
+			std::cerr << config.logPrefix << "Starting Dual Band rssi data stream." << std::endl;
+			break;
+		default:
+			// rotate through all three bands
+			std::cerr << config.logPrefix << "Starting tri-band rssi data stream." << std::endl;
+			if (!scheduler->start()) {
+				std::cerr << config.logPrefix << "No band to stream!" << std::endl;
+				return false;
+			}
+			return true;
+	}
+	return device->startRssiData(bandDataType(config.band), zoomWidth != 0, zoomStart, zoomWidth);
+}
+
+
+void Session::stop() {
+	streamingWanted = false;
+	if (scheduler != nullptr)
+		scheduler->stop();
+	std::cerr << config.logPrefix << "Stopping rssi data stream." << std::endl;
+	device->stopRssiData();
+}
+
+
+bool Session::reconfigure(unsigned int band, const ZoomRange &zoom) {
+	unsigned int oldBand = config.band;
+	ZoomRange oldZoom = config.zoom;
+	bool streaming = streamingWanted;
+	if (streaming)
+		stop();
+	// the sweeps of the old band are written with the old window, then nothing
+	// on the writer thread touches this session until the stream starts again
+	if (writer != nullptr)
+		writer->sync();
+	switchFrom = lastSweepAt;
+	switchPending = streaming;
+	// peaks seen so far end here, whatever streams next
+	if (detector != nullptr)
+		detector->endAll();
+
+	if (zoomWidth != 0)
+		setWindow(bandDataType(config.band), 0, 0);
+	config.band = band;
+	config.zoom = zoom;
+	bool ok = prepareZoom();
+	if (!ok) {
+		config.band = oldBand;
+		config.zoom = oldZoom;
+		// the old band has streamed, this does not probe
+		prepareZoom();
+	}
+	if (streaming && !start())
+		std::cerr << config.logPrefix << "Unable to restart the rssi data stream." << std::endl;
+	return ok;
+}
+
+
+int Session::supervise() {
+	Clock::time_point now = Clock::now();
+
+	if (link == LinkUp) {
+		if (!lost.exchange(false))
+			return -1;
+		downSince = Clock::time_point(std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds(lostAt.load())));
+		std::cerr << config.logPrefix << "Lost the device, reconnecting." << std::endl;
+		if (scheduler != nullptr)
+			scheduler->stop();
+		device->endCommunication();
+		// the first try goes right away, a glitch may already be over
+		link = LinkDown;
+		backoffMs = SESSION_RECONNECT_MIN_MS / 2;
+		nextAttempt = now;
+	}
+
+	if (link == LinkDown) {
+		if (now < nextAttempt)
+			return (int)std::chrono::duration_cast<std::chrono::milliseconds>(nextAttempt - now).count() + 1;
+		reconnectAttempts++;
+		lost = false;
+		isConnected = false;
+		connectionProcessComplete = false;
+		attemptStart = now;
+		link = LinkConnecting;
+		if (!device->startCommunication())
+			connectionProcessComplete = true;
+	}
+
+	// LinkConnecting
+	if (connectionProcessComplete && isConnected) {
+		readSerial();
+		link = LinkUp;
+		if (streamingWanted && !start())
+			std::cerr << config.logPrefix << "Unable to restart the rssi data stream." << std::endl;
+		Clock::duration took = Clock::now() - downSince;
+		reconnects++;
+		reconnectTotal += took;
+		if (took > reconnectMax)
+			reconnectMax = took;
+		std::cerr << config.logPrefix << "Reconnected after " << toMs(took) << "ms." << std::endl;
+		return -1;
+	}
+	if (!connectionProcessComplete) {
+		Clock::duration waited = now - attemptStart;
+		if (waited < std::chrono::milliseconds(SESSION_CONNECT_TIMEOUT_MS))
+			return SESSION_CONNECT_TIMEOUT_MS - (int)std::chrono::duration_cast<std::chrono::milliseconds>(waited).count() + 1;
+	}
+
+	// failed or timed out, try again later
+	if (device->didStartCommunication())
+		device->endCommunication();
+	backoffMs = backoffMs * 2 < SESSION_RECONNECT_MAX_MS ? backoffMs * 2 : SESSION_RECONNECT_MAX_MS;
+	nextAttempt = now + std::chrono::milliseconds(backoffMs);
+	link = LinkDown;
+	return backoffMs + 1;
+}
+
+
+void Session::writeFrame(const RssiFrame &frame, Sink *output) {
+	if (pendingSchema.load(std::memory_order_relaxed) >= 0) {
+		int schema = pendingSchema.exchange(-1);
+		if (schema >= 0)
+			serializer.setSchema((LineSchema)schema);
+	}
+
+	switch (frame.dataType)
+	{
+		case oscium::WiPryClarity::DataType::RSSI_2_4GHZ:
+			std::cerr << config.logPrefix << "2.4 GHz rssi data with " << (int)frame.count << " points" << std::endl;
+			break;
+		case oscium::WiPryClarity::DataType::RSSI_5GHZ:
+			std::cerr << config.logPrefix << "5 GHz rssi data with " << (int)frame.count << " points" << std::endl;
+			break;
+		case oscium::WiPryClarity::DataType::RSSI_6E:
+			std::cerr << config.logPrefix << "6 GHz rssi data with " << (int)frame.count << " points" << std::endl;
+			break;
+		case oscium::WiPryClarity::DataType::RSSI_DUAL25:
+			std::cerr << config.logPrefix << "Dual band rssi data with " << (int)frame.count << " points" << std::endl;
+			break;
+		default:
+			break;
+	}
+
+	Telemetry::Clock::time_point start;
+	if (telemetry != nullptr)
+		start = Telemetry::Clock::now();
+
+	// the capture writer hands its frames to the output itself
+	unsigned int lines = 0;
+	if (captureWriter != nullptr)
+		captureWriter->write(frame);
+	else if (aggregator != nullptr)
+		lines = aggregator->add(frame, output->buffer());
+	else if (detector != nullptr)
+		lines = detector->add(frame, output->buffer());
+	else
+		lines = serializer.serialize(frame, output->buffer());
+	if (spectrogram != nullptr)
+		lines += spectrogram->add(frame, output->buffer());
+
+	if (telemetry != nullptr) {
+		telemetry->serialize.record(Telemetry::elapsedNs(start));
+		start = Telemetry::Clock::now();
+	}
+	if (lines != 0)
+		output->linesAdded(lines);
+	if (telemetry != nullptr) {
+		telemetry->write.record(Telemetry::elapsedNs(start));
+		telemetry->frameEmitted(frame.dataType);
+	}
+}
+
+
+void Session::flush(Sink *output) {
+	if (aggregator != nullptr) {
+		if (unsigned int lines = aggregator->flush(output->buffer()))
+			output->linesAdded(lines);
+	}
+	if (detector != nullptr) {
+		if (unsigned int lines = detector->flush(output->buffer()))
+			output->linesAdded(lines);
+	}
+	if (spectrogram != nullptr) {
+		if (unsigned int lines = spectrogram->flush(output->buffer()))
+			output->linesAdded(lines);
+	}
+}
+
+
+void Session::report(std::ostream &out) {
+	if (config.deadband >= 0 && serializer.fieldsOut() > 0)
+		out << config.logPrefix << "Deadband: wrote " << serializer.fieldsOut() << " of " << serializer.fieldsIn() << " bins, "
+			<< (double)serializer.fieldsIn() / serializer.fieldsOut() << "x fewer, " << serializer.keyframes() << " keyframes, "
+			<< serializer.linesSuppressed() << " sweeps without a change." << std::endl;
+	if (detector != nullptr)
+		out << config.logPrefix << "Peaks: wrote " << detector->events() << " start and stop events." << std::endl;
+	if (captureWriter != nullptr)
+		out << config.logPrefix << "Recorded " << captureWriter->frames() << " frames in " << captureWriter->bytes() << " bytes." << std::endl;
+	if (writer != nullptr)
+		out << config.logPrefix << "Dropped " << writer->droppedFrames(queue) << " frames." << std::endl;
+	if (scheduler != nullptr)
+		scheduler->report(out);
+	const char *bandNames[4] = { "2.4GHz", "5GHz", "6E", "Dual" };
+	for (int t = 0; t < 4; t++) {
+		const SweepClock &clock = clocks[t];
+		if (clock.sweeps() == 0)
+			continue;
+		out << config.logPrefix << bandNames[t] << " sweeps: " << clock.periodNs() / 1e6 << "ms period, "
+			<< clock.jitterMeanUs() << "us mean " << clock.jitterMaxUs() << "us max jitter, "
+			<< clock.gaps() << " gaps with " << clock.missed() << " sweeps missed, " << clock.steps() << " clock steps." << std::endl;
+	}
+	if (switchCount != 0)
+		out << config.logPrefix << "Switches: " << switchCount << ", " << switchTotalNs / 1e6 / switchCount << "ms mean "
+			<< switchMaxNs / 1e6 << "ms max from the last sweep before to the first sweep after." << std::endl;
+	if (reconnectAttempts != 0) {
+		out << config.logPrefix << "Reconnects: " << reconnects << " in " << reconnectAttempts << " attempts";
+		if (reconnects != 0)
+			out << ", " << toMs(reconnectTotal) / reconnects << "ms mean " << toMs(reconnectMax) << "ms max from losing the device to streaming again";
+		out << std::endl;
+	}
+}
+
+
+void Session::disconnect() {
+	std::cerr << config.logPrefix << "Closing connection to WiPry Clarity." << std::endl;
+	if (device->didStartCommunication())
+		device->endCommunication();
+}
+
+
+void Session::setBoundary(oscium::WiPryClarity::DataType dataType, float low, float high) {
+	// a reconnect reports the same boundaries again, keep the cached keys
+	if (freqLow[(int)dataType] == low && freqHigh[(int)dataType] == high)
+		return;
+	freqLow[(int)dataType] = low;
+	freqHigh[(int)dataType] = high;
+	serializer.setBoundary(dataType, low, high);
+	if (aggregator != nullptr)
+		aggregator->setBoundary(dataType, low, high);
+	if (detector != nullptr)
+		detector->setBoundary(dataType, low, high);
+	if (spectrogram != nullptr)
+		spectrogram->setBoundary(dataType, low, high);
+}
+
+
+void Session::deviceDidConnect(Device *aDevice) {
+	std::cerr << config.logPrefix << "Connected to device." << std::endl;
+
+	float min, max, noisefloor;
+	float low, high;
+
+	if (aDevice->getEvenRssiLimts(&min, &max, &noisefloor)) {
+		std::cerr << config.logPrefix << "Even Min:" << min << "dBm Max:" << max << "dBm Noise Floor:" << noisefloor << "dBm" << std::endl;
+		evenMin = min;
+		evenMax = max;
+		evenNoiseFloor = noisefloor;
+	}
+	else
+		std::cerr << config.logPrefix << "Unable to get limits" << std::endl;
+
+	if (aDevice->getOddRssiLimts(&min, &max, &noisefloor)) {
+		std::cerr << config.logPrefix << " Odd Min:" << min << "dBm Max:" << max << "dBm Noise Floor:" << noisefloor << "dBm" << std::endl;
+		oddMin = min;
+		oddMax = max;
+		oddNoiseFloor = noisefloor;
+	}
+	else
+		std::cerr << config.logPrefix << "Unable to get limits" << std::endl;
+
+	if (aDevice->get2_4GHzBoundary(&low, &high)) {
+		std::cerr << config.logPrefix << "2.4GHz Low:" << low << "MHz High:" << high << "MHz" << std::endl;
+		setBoundary(oscium::WiPryClarity::DataType::RSSI_2_4GHZ, low, high);
+	}
+	else
+		std::cerr << config.logPrefix << "Unable to get 2.4GHz frequency limits" << std::endl;
+
+	if (aDevice->get5GHzBoundary(&low, &high)) {
+		std::cerr << config.logPrefix << "  5GHz Low:" << low << "MHz High:" << high << "MHz" << std::endl;
+		setBoundary(oscium::WiPryClarity::DataType::RSSI_5GHZ, low, high);
+	}
+	else
+		std::cerr << config.logPrefix << "Unable to get 5GHz frequency limits" << std::endl;
+
+	if (aDevice->get6EBoundary(&low, &high)) {
+		std::cerr << config.logPrefix << "    6E Low:" << low << "MHz High:" << high << "MHz" << std::endl;
+		setBoundary(oscium::WiPryClarity::DataType::RSSI_6E, low, high);
+	}
+	else
+		std::cerr << config.logPrefix << "Unable to get 6E frequency limits" << std::endl;
+
+	if (aggregator != nullptr)
+		aggregator->setNoiseFloor(evenNoiseFloor, oddNoiseFloor);
+	if (detector != nullptr)
+		detector->setNoiseFloor(evenNoiseFloor, oddNoiseFloor);
+
+	isConnected = true;
+	connectionProcessComplete = true;
+	events->notify();
+}
+
+
+void Session::deviceUnableToConnect(Device *aDevice, oscium::WiPryClarity::ErrorCode errorCode) {
+	std::cerr << config.logPrefix << "Disconnected from Accessory with Error Code : " << (int)errorCode << std::endl;
+	if (aDevice != nullptr) {
+		if (aDevice->didStartCommunication())
+			aDevice->endCommunication();
+
+		// NOTE: Do not delete the device here or it will cause a crash, the session deletes it.
+		if (isConnected.exchange(false)) {
+			lostAt = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+			lost = true;
+		}
+		connectionProcessComplete = true;
+		events->notify();
+	}
+}
+
+
+void Session::deviceDidReceiveRSSIData(Device *aDevice, oscium::WiPryClarity::DataType dataType, const std::vector<float> &rssiData) {
+	Telemetry::Clock::time_point start;
+	if (telemetry != nullptr)
+		start = Telemetry::Clock::now();
+	long long steadyns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+	long long wallns = std::chrono::time_point_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now()).time_since_epoch().count();
+	int t = (int)dataType & 3;
+	if (switchPending.load(std::memory_order_relaxed) && switchPending.exchange(false)) {
+		long long gap = steadyns - switchFrom;
+		switchLastNs.store(gap, std::memory_order_relaxed);
+		switchTotalNs.store(switchTotalNs.load(std::memory_order_relaxed) + gap, std::memory_order_relaxed);
+		if (gap > switchMaxNs.load(std::memory_order_relaxed))
+			switchMaxNs.store(gap, std::memory_order_relaxed);
+		switchCount.fetch_add(1, std::memory_order_relaxed);
+	}
+	lastSweepAt.store(steadyns, std::memory_order_relaxed);
+	bandPoints[t].store(rssiData.size(), std::memory_order_relaxed);
+	int last = lastTimedType.exchange(t, std::memory_order_relaxed);
+	if (last == -2) {
+		for (int c = 0; c < 4; c++)
+			clocks[c].restart();
+	}
+	else if (last != t)
+		clocks[t].resume();
+	SweepTime sweep = clocks[t].arrived(steadyns, wallns);
+	sweepPoints.store(rssiData.size(), std::memory_order_relaxed);
+	if (probing.load(std::memory_order_relaxed))
+		events->notify();
+	frameCount[(int)dataType & 3].fetch_add(1, std::memory_order_relaxed);
+	if (scheduling.load(std::memory_order_acquire))
+		scheduler->frameReceived(dataType);
+	// Only copy the sweep into the ring here, the writer thread formats and prints it
+	if (writer != nullptr)
+		writer->push(queue, dataType, rssiData, sweep.endns, sweep.startns, sweep.sequence);
+	if (telemetry != nullptr) {
+		telemetry->frameReceived(dataType);
+		telemetry->sweepTimed(dataType, sweep.jitterns, sweep.missed);
+		telemetry->callback.record(Telemetry::elapsedNs(start));
+	}
+}
+
+
+void Session::deviceDidEndData(Device *aDevice) {
+	std::cerr << config.logPrefix << "End of replay." << std::endl;
+	dataEnded = true;
+	events->notify();
+}
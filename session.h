@@ -0,0 +1,228 @@
+#pragma once
+
+#include "WiPryClarity.h"
+#include "device.h"
+#include "writer.h"
+#include "lineprotocol.h"
+#include "channels.h"
+#include "spectrogram.h"
+#include "peaks.h"
+#include "capture.h"
+#include "scheduler.h"
+#include "zoom.h"
+#include "sink.h"
+#include "telemetry.h"
+#include "events.h"
+#include "timing.h"
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <string>
+
+/*
+
+    Session
+
+    Everything that belongs to one WiPry: the Device, its connection state,
+    limits and boundaries, the band it streams and the serializer or channel
+    aggregator that formats its sweeps.  Each session is the delegate of its
+    own device and pushes into its own FrameWriter queue, so several WiPrys
+    can share one writer thread and one output without sharing any state.
+
+    The callbacks run on the device's data thread, writeFrame() on the writer
+    thread, everything else on the main thread.  Connects, lost devices and
+    the end of a replay wake the main thread's EventLoop.
+
+    A device that goes away after connecting is reconnected in place by
+    supervise(): communication is restarted with backoff and streaming
+    resumes with the same band, zoom window and cached keys, while the
+    writer, its queue and the output carry on.  The time from losing the
+    device to streaming again is reported.
+
+    reconfigure() switches band and zoom window on the live connection: the
+    stream is stopped, the writer drained of the old sweeps and the stream
+    started again, without going through startCommunication() and the limit
+    queries.  The gap from the last sweep before a switch to the first one
+    after it is measured.  A new schema is taken up by the writer thread at
+    the next sweep, without stopping the stream.
+
+    Sweeps are stamped by a SweepClock per band rather than with the wall
+    clock of the callback, and numbered.  Each band's clock starts a new
+    run when streaming (re)starts or the scheduler switches bands, so
+    neither shows up as a gap.
+
+*/
+
+
+struct SessionConfig {
+	unsigned int band;			// as on the command line: 2, 5, 6, 25 or 256
+	unsigned int dualSplit;
+	LineSchema schema;
+	float deadband;				// -1 writes every bin
+	unsigned int keyframeSweeps;
+	unsigned int keyframeMs;
+	int channelWindowMs;		// -1 writes every bin
+	bool channelsPscOnly;
+	float peakProminence;		// -1 writes every bin
+	unsigned int peakHoldSweeps;
+	int summaryMs;				// -1 writes no summaries
+	unsigned int summarySweeps;
+	bool sweepFields;			// seq, sweep_start and sweep_end on every line
+	ZoomRange zoom;
+	BandDwell dwell[3];
+	std::string logPrefix;		// put in front of everything logged, to tell devices apart
+
+	SessionConfig() : band(0), dualSplit(0), schema(LineSchema::Wide), deadband(-1), keyframeSweeps(0), keyframeMs(60000),
+		channelWindowMs(-1), channelsPscOnly(false), peakProminence(-1), peakHoldSweeps(3), summaryMs(-1), summarySweeps(900), sweepFields(false) {}
+};
+
+
+class Session : public DeviceDelegate {
+public:
+	// Takes ownership of device.  Lifecycle events are signalled on events.
+	Session(Device *device, const SessionConfig &config, EventLoop *events);
+	~Session();
+
+	// Starts communication and waits for it to succeed or fail.  False on a
+	// failed connection or if a signal came first.
+	bool connect();
+
+	// Sizes the zoom window, if there is one, by streaming one sweep
+	// unzoomed.  After connect(), before start().
+	bool prepareZoom();
+
+	// Sweeps go to queue of writer from now on.
+	void attach(FrameWriter *writer, unsigned int queue);
+
+	// Counts and times this device's sweeps in telemetry.  Before start().
+	void setTelemetry(Telemetry *aTelemetry) { telemetry = aTelemetry; }
+
+	// With a capture writer the sweeps are recorded instead of formatted.
+	void setCaptureWriter(CaptureWriter *writer) { captureWriter = writer; }
+
+	// Fills in a capture header with this device's limits and boundaries.
+	void fillCaptureHeader(CaptureHeader &header, CaptureEncoding encoding) const;
+
+	// Starts streaming the configured band.
+	bool start();
+
+	// Stops streaming.  Sweeps already queued are still written.
+	void stop();
+
+	// Main thread, once attached: streams band with zoom from now on, an
+	// empty zoom for the whole band.  False if zoom misses the band, the
+	// previous band and zoom stream on then.
+	bool reconfigure(unsigned int band, const ZoomRange &zoom);
+
+	// Any thread: the lines of every sweep from the next one on use schema.
+	void setSchema(LineSchema schema) { pendingSchema = (int)schema; }
+
+	unsigned int band() const { return config.band; }
+	const ZoomRange &zoom() const { return config.zoom; }
+
+	// Switches made by reconfigure() and the gap of the latest, in ms.
+	unsigned long long switches() const { return switchCount.load(std::memory_order_relaxed); }
+	double lastSwitchGapMs() const { return switchLastNs.load(std::memory_order_relaxed) / 1e6; }
+
+	// Main thread, after every wakeup: reconnects a lost device.  Returns how
+	// many ms until it needs to be called again, -1 if only an event can
+	// change anything.
+	int supervise();
+
+	// Writer thread: formats one sweep into output.
+	void writeFrame(const RssiFrame &frame, Sink *output);
+
+	// Once the writer has stopped: writes what the aggregator still holds, the
+	// stop of every open peak and a last summary.
+	void flush(Sink *output);
+
+	void report(std::ostream &out);
+
+	// Ends communication.  No callback runs after this returns.
+	void disconnect();
+
+	// A replay ran out, or the device went away.
+	bool ended() const { return dataEnded; }
+
+	// Not lost or reconnecting.
+	bool linkUp() const { return link == LinkUp; }
+
+	const std::string &serialNumber() const { return serial; }
+	unsigned long long framesReceived(oscium::WiPryClarity::DataType dataType) const {
+		return frameCount[(int)dataType & 3].load(std::memory_order_relaxed);
+	}
+
+	// DeviceDelegate
+	void deviceDidConnect(Device *aDevice);
+	void deviceUnableToConnect(Device *aDevice, oscium::WiPryClarity::ErrorCode errorCode);
+	void deviceDidReceiveRSSIData(Device *aDevice, oscium::WiPryClarity::DataType dataType, const std::vector<float> &rssiData);
+	void deviceDidEndData(Device *aDevice);
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	// Where supervise() is with the device.
+	enum LinkState {
+		LinkUp,
+		LinkDown,			// lost, waiting for the next attempt
+		LinkConnecting
+	};
+
+	void setBoundary(oscium::WiPryClarity::DataType dataType, float freqLow, float freqHigh);
+	void setWindow(oscium::WiPryClarity::DataType dataType, uint16_t first, uint16_t width);
+	void readSerial();
+
+	Device *device;
+	EventLoop *events;
+	SessionConfig config;
+	std::string serial;
+
+	std::atomic<bool> isConnected;
+	std::atomic<bool> connectionProcessComplete;
+	std::atomic<bool> dataEnded;
+	std::atomic<bool> lost;
+	std::atomic<long long> lostAt;					// steady clock ns
+	std::atomic<bool> probing;						// prepareZoom() waits for a sweep
+	std::atomic<unsigned long long> frameCount[4];	// per DataType
+	std::atomic<unsigned int> sweepPoints;			// bins in the latest sweep
+	std::atomic<unsigned int> bandPoints[4];		// bins in an unzoomed sweep, per DataType
+
+	float evenMin, evenMax, evenNoiseFloor;
+	float oddMin, oddMax, oddNoiseFloor;
+	float freqLow[3], freqHigh[3];					// 2.4GHz, 5GHz, 6E
+	uint16_t zoomStart;
+	uint16_t zoomWidth;
+
+	LineProtocolSerializer serializer;
+	ChannelAggregator *aggregator;
+	PeakDetector *detector;
+	SpectrogramStore *spectrogram;
+	CaptureWriter *captureWriter;
+	BandScheduler *scheduler;
+	std::atomic<bool> scheduling;					// the scheduler is rotating bands
+	Telemetry *telemetry;
+
+	FrameWriter *writer;
+	unsigned int queue;
+
+	// data thread, but for start() resetting lastTimedType
+	SweepClock clocks[4];							// per DataType
+	std::atomic<int> lastTimedType;					// -2 restarts every band's clock
+
+	std::atomic<int> pendingSchema;					// -1, or the LineSchema writeFrame() takes up
+	std::atomic<long long> lastSweepAt;				// steady clock ns
+	std::atomic<bool> switchPending;				// the next sweep ends a switch
+	long long switchFrom;
+	std::atomic<unsigned long long> switchCount;
+	std::atomic<long long> switchLastNs, switchTotalNs, switchMaxNs;
+
+	LinkState link;
+	bool streamingWanted;
+	unsigned int backoffMs;
+	Clock::time_point downSince;
+	Clock::time_point nextAttempt;
+	Clock::time_point attemptStart;
+	unsigned long long reconnects;
+	unsigned long long reconnectAttempts;
+	Clock::duration reconnectTotal, reconnectMax;
+};
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "lineprotocol.h"
+
+/*
+
+    Sink
+
+    Where serialized lines go.  The writer thread appends complete lines to
+    buffer() and reports them with linesAdded(); the sink decides when to
+    push them out.  A sink may block in linesAdded() when it cannot keep up,
+    which backs the frames up into the FrameWriter ring instead of stalling
+    the device callback.
+
+*/
+
+
+class Sink {
+public:
+	virtual ~Sink() {}
+
+	// Buffer to append whole lines to, followed by a call to linesAdded().
+	virtual LineBuffer &buffer() = 0;
+
+	// Accounts for lines appended to buffer() and sends them if the batch is due.
+	virtual void linesAdded(unsigned int lines) = 0;
+
+	// Sends a partial batch that has waited long enough.  Called regularly by
+	// the writer thread while no lines are coming in.
+	virtual void poll() = 0;
+
+	// Sends everything pending.  Called once the writer thread has stopped.
+	virtual bool flush() = 0;
+
+	// Bytes actually written out so far.  Safe to call from any thread.
+	virtual unsigned long long bytesOut() const = 0;
+};
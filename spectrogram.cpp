@@ -0,0 +1,231 @@
+#include "spectrogram.h"
+#include <cstdio>
+
+
+SpectrogramStore::SpectrogramStore(unsigned int windowSweeps, unsigned int intervalMs)
+	: windowSweeps(windowSweeps), intervalNs((long long)intervalMs * 1000000), dualSplit(0) {
+	if (this->windowSweeps == 0)
+		this->windowSweeps = 1;
+	if (this->windowSweeps > SPECTROGRAM_MAX_SWEEPS)
+		this->windowSweeps = SPECTROGRAM_MAX_SWEEPS;
+	const char *names[3] = { "2", "5", "6" };
+	for (int i = 0; i < 3; i++) {
+		bands[i].name = names[i];
+		bands[i].valid = false;
+		bands[i].freqLow = 0;
+		bands[i].freqHigh = 0;
+		bands[i].windowFirst = 0;
+		bands[i].windowWidth = 0;
+		bands[i].count = 0;
+		bands[i].first = 0;
+		bands[i].bins = 0;
+		bands[i].slot = 0;
+		bands[i].filled = 0;
+		bands[i].nextSummary = -1;
+		bands[i].lastTimens = 0;
+	}
+}
+
+
+void SpectrogramStore::setSerial(const std::string &aSerial) {
+	serial = aSerial;
+	for (int i = 0; i < 3; i++)
+		bands[i].count = 0;
+}
+
+
+void SpectrogramStore::setBoundary(oscium::WiPryClarity::DataType dataType, float freqLow, float freqHigh) {
+	Band *band = bandFor(dataType);
+	if (band == nullptr)
+		return;
+	band->valid = true;
+	band->freqLow = freqLow;
+	band->freqHigh = freqHigh;
+	band->count = 0;
+}
+
+
+void SpectrogramStore::setWindow(oscium::WiPryClarity::DataType dataType, unsigned int first, unsigned int width) {
+	Band *band = bandFor(dataType);
+	if (band == nullptr)
+		return;
+	band->windowFirst = first;
+	band->windowWidth = width;
+	band->count = 0;
+}
+
+
+void SpectrogramStore::setDualSplit(unsigned int points) {
+	dualSplit = points;
+}
+
+
+SpectrogramStore::Band *SpectrogramStore::bandFor(oscium::WiPryClarity::DataType dataType) {
+	switch (dataType)
+	{
+		case oscium::WiPryClarity::DataType::RSSI_2_4GHZ:
+			return &bands[0];
+		case oscium::WiPryClarity::DataType::RSSI_5GHZ:
+			return &bands[1];
+		case oscium::WiPryClarity::DataType::RSSI_6E:
+			return &bands[2];
+		default:
+			return nullptr;
+	}
+}
+
+
+// Empties the history and builds the keys for sweeps of count bins.
+void SpectrogramStore::reset(Band &band, unsigned int count) {
+	band.count = count;
+	band.first = 0;
+	band.bins = count;
+	if (band.windowWidth != 0) {
+		band.first = band.windowFirst < count ? band.windowFirst : count;
+		unsigned int end = band.windowFirst + band.windowWidth < count ? band.windowFirst + band.windowWidth : count;
+		band.bins = end - band.first;
+	}
+	band.history.assign((size_t)band.bins * windowSweeps, 0);
+	band.histogram.assign((size_t)band.bins * 256, 0);
+	band.slot = 0;
+	band.filled = 0;
+	band.nextSummary = -1;
+
+	band.prefix = "wipry_summary,serial=" + serial + ",band=" + band.name + ",stat=";
+	band.keys.clear();
+	band.offsets.clear();
+	band.offsets.push_back(0);
+	// the same arithmetic as the line protocol keys, so the fields line up
+	float stepsize = ( (band.freqHigh - band.freqLow) / (int)count );
+	char key[32];
+	for (unsigned int p = band.first; p < band.first + band.bins; p++) {
+		volatile float offset = (int)p * stepsize;
+		float freq = band.freqLow + offset;
+		int n = snprintf(key, sizeof(key), "%g=", (double)freq);
+		band.keys.insert(band.keys.end(), key, key + n);
+		band.offsets.push_back((unsigned int)band.keys.size());
+	}
+}
+
+
+unsigned int SpectrogramStore::accumulate(Band &band, const int8_t *points, unsigned int count, long long timens, LineBuffer &out) {
+	if (!band.valid)
+		return 0;
+	if (band.count != count)
+		reset(band, count);
+	if (band.bins == 0)
+		return 0;
+
+	// one byte per bin's row, the oldest sweep drops out of the histogram as it is overwritten
+	const int8_t *in = points + band.first;
+	int8_t *row = band.history.data() + band.slot;
+	uint16_t *histogram = band.histogram.data();
+	bool full = band.filled == windowSweeps;
+	for (unsigned int b = 0; b < band.bins; b++) {
+		if (full)
+			histogram[*row + 128]--;
+		*row = in[b];
+		histogram[in[b] + 128]++;
+		row += windowSweeps;
+		histogram += 256;
+	}
+	if (++band.slot == windowSweeps)
+		band.slot = 0;
+	if (!full)
+		band.filled++;
+	band.lastTimens = timens;
+
+	if (band.nextSummary < 0)
+		band.nextSummary = timens + intervalNs;
+	if (timens < band.nextSummary)
+		return 0;
+	// on the interval grid, unless the stream fell behind it
+	band.nextSummary += intervalNs;
+	if (band.nextSummary <= timens)
+		band.nextSummary = timens + intervalNs;
+	return writeSummary(band, out);
+}
+
+
+unsigned int SpectrogramStore::writeSummary(Band &band, LineBuffer &out) {
+	if (band.filled == 0)
+		return 0;
+
+	// nearest rank: the smallest value with at least rank sweeps at or below it
+	unsigned int rank50 = (band.filled + 1) / 2;
+	unsigned int rank95 = (unsigned int)(((unsigned long long)band.filled * 95 + 99) / 100);
+	for (int s = 0; s < 3; s++)
+		stats[s].resize(band.bins);
+	const uint16_t *histogram = band.histogram.data();
+	for (unsigned int b = 0; b < band.bins; b++, histogram += 256) {
+		unsigned int seen = 0;
+		int v = 0;
+		for (; v < 256; v++) {
+			seen += histogram[v];
+			if (seen >= rank50)
+				break;
+		}
+		stats[0][b] = (int8_t)(v - 128);
+		for (; seen < rank95; )
+			seen += histogram[++v];
+		stats[1][b] = (int8_t)(v - 128);
+		int top = 255;
+		while (histogram[top] == 0)
+			top--;
+		stats[2][b] = (int8_t)(top - 128);
+	}
+
+	const char *names[3] = { "p50 sweeps=", "p95 sweeps=", "max sweeps=" };
+	const char *keys = band.keys.data();
+	const unsigned int *offsets = band.offsets.data();
+	for (int s = 0; s < 3; s++) {
+		// longest value and a comma per bin, plus prefix, sweep count and timestamp
+		size_t worst = band.prefix.size() + 16 + band.keys.size() + band.bins * 5 + 24;
+		char *start = out.reserve(worst);
+		char *p = start;
+		memcpy(p, band.prefix.data(), band.prefix.size());
+		p += band.prefix.size();
+		memcpy(p, names[s], 11);
+		p = formatInt(p + 11, band.filled);
+		*p++ = ',';
+		const int8_t *value = stats[s].data();
+		for (unsigned int b = 0; b < band.bins; b++) {
+			unsigned int keyLen = offsets[b + 1] - offsets[b];
+			memcpy(p, keys + offsets[b], keyLen);
+			p = formatInt(p + keyLen, value[b]);
+			*p++ = ',';
+		}
+		p[-1] = ' ';
+		p = formatInt(p, band.lastTimens);
+		*p++ = '\n';
+		out.commit(p - start);
+	}
+	return 3;
+}
+
+
+unsigned int SpectrogramStore::add(const RssiFrame &frame, LineBuffer &out) {
+	if (frame.count == 0)
+		return 0;
+	if (frame.dataType == oscium::WiPryClarity::DataType::RSSI_DUAL25) {
+		unsigned int split = dualSplit != 0 ? dualSplit : frame.count / 2;
+		if (split >= frame.count)
+			return 0;
+		return accumulate(bands[0], frame.points, split, frame.timens, out)
+			+ accumulate(bands[1], frame.points + split, frame.count - split, frame.timens, out);
+	}
+	Band *band = bandFor(frame.dataType);
+	if (band == nullptr)
+		return 0;
+	return accumulate(*band, frame.points, frame.count, frame.timens, out);
+}
+
+
+unsigned int SpectrogramStore::flush(LineBuffer &out) {
+	unsigned int lines = 0;
+	for (int i = 0; i < 3; i++) {
+		if (bands[i].valid && bands[i].count != 0)
+			lines += writeSummary(bands[i], out);
+	}
+	return lines;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "WiPryClarity.h"
+#include "writer.h"
+#include "lineprotocol.h"
+#include <string>
+#include <vector>
+
+/*
+
+    SpectrogramStore
+
+    Keeps the last N sweeps of each band and summarizes them per bin, so
+    what a band looked like over the last minutes is available without
+    querying every raw sweep.  Every interval it writes three lines per band:
+
+        wipry_summary,serial=<serial>,band=<2|5|6>,stat=p50 sweeps=<n>,<freq>=<dBm>,... <timens>\n
+        wipry_summary,serial=<serial>,band=<2|5|6>,stat=p95 sweeps=<n>,<freq>=<dBm>,... <timens>\n
+        wipry_summary,serial=<serial>,band=<2|5|6>,stat=max sweeps=<n>,<freq>=<dBm>,... <timens>\n
+
+    with the median, the 95th percentile and the maximum of each bin over
+    the sweeps held, and the timestamp of the latest sweep.  The keys are
+    the same as in the per-bin line protocol, zoom windows included.
+
+    Sweeps are kept as int8 dBm in a ring laid out bin by bin, so the
+    history of one bin is contiguous.  Next to it every bin has a histogram
+    of its values in the ring, updated as a sweep goes in and the oldest
+    one drops out, so the percentiles are read off the histograms instead
+    of sorting.  Memory is window * bins bytes of history plus 512 bytes of
+    histogram per bin.
+
+*/
+
+
+// The histograms count in 16 bits.
+#define SPECTROGRAM_MAX_SWEEPS 65535
+
+
+class SpectrogramStore {
+public:
+	// Summarizes the last windowSweeps sweeps every intervalMs.
+	SpectrogramStore(unsigned int windowSweeps, unsigned int intervalMs);
+
+	void setSerial(const std::string &serial);
+	void setBoundary(oscium::WiPryClarity::DataType dataType, float freqLow, float freqHigh);
+
+	// As LineProtocolSerializer::setWindow and setDualSplit.
+	void setWindow(oscium::WiPryClarity::DataType dataType, unsigned int first, unsigned int width);
+	void setDualSplit(unsigned int points);
+
+	// Adds frame to the history and appends a summary if one is due.
+	// Returns the number of lines appended.
+	unsigned int add(const RssiFrame &frame, LineBuffer &out);
+
+	// Appends a summary of every band holding sweeps.
+	unsigned int flush(LineBuffer &out);
+
+private:
+	struct Band {
+		const char *name;
+		bool valid;
+		float freqLow, freqHigh;
+		unsigned int windowFirst, windowWidth;
+		unsigned int count;				// sweep size the history is for
+		unsigned int first, bins;		// bins of the sweep that are kept
+		std::vector<int8_t> history;	// bins * windowSweeps, bin-major
+		std::vector<uint16_t> histogram;	// bins * 256, by dBm + 128
+		unsigned int slot;				// where the next sweep goes
+		unsigned int filled;			// sweeps held
+		std::string prefix;				// "wipry_summary,serial=...,band=N,stat="
+		std::vector<char> keys;			// "<freq>=" per kept bin
+		std::vector<unsigned int> offsets;
+		long long nextSummary;			// timens, -1 until the first sweep
+		long long lastTimens;
+	};
+
+	Band *bandFor(oscium::WiPryClarity::DataType dataType);
+	void reset(Band &band, unsigned int count);
+	unsigned int accumulate(Band &band, const int8_t *points, unsigned int count, long long timens, LineBuffer &out);
+	unsigned int writeSummary(Band &band, LineBuffer &out);
+
+	unsigned int windowSweeps;
+	long long intervalNs;
+	std::string serial;
+	unsigned int dualSplit;
+	std::vector<int8_t> stats[3];		// p50, p95, max of each kept bin
+	Band bands[3];
+};
@@ -0,0 +1,346 @@
+#include "spool.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+
+#define SPOOL_MAGIC "WPSPOOL1"
+#define SPOOL_RECORD_MAGIC 0x44524357	// "WCRD"
+
+
+struct SpoolSegmentHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t headerCrc;	// over magic, version, sequence and segmentBytes
+	uint64_t sequence;
+	uint64_t segmentBytes;
+	uint64_t readOffset;	// rewritten while replaying, checked against the records
+	uint64_t reserved[3];
+};
+
+struct SpoolRecordHeader {
+	uint32_t magic;
+	uint32_t flags;
+	uint32_t length;
+	uint32_t payloadCrc;
+	uint32_t headerCrc;	// over the four fields above
+	uint32_t reserved;
+};
+
+
+static uint32_t checksum(const void *data, size_t len) {
+	return (uint32_t)crc32(0L, (const Bytef *)data, (uInt)len);
+}
+
+
+static uint32_t segmentHeaderCrc(const SpoolSegmentHeader &header) {
+	SpoolSegmentHeader copy;
+	memset(&copy, 0, sizeof(copy));
+	memcpy(copy.magic, header.magic, sizeof(copy.magic));
+	copy.version = header.version;
+	copy.sequence = header.sequence;
+	copy.segmentBytes = header.segmentBytes;
+	return checksum(&copy, sizeof(copy));
+}
+
+
+static size_t recordSpan(size_t len) {
+	return sizeof(SpoolRecordHeader) + ((len + 7) & ~(size_t)7);
+}
+
+
+Spool::Spool(const std::string &dir, size_t segmentBytes, size_t maxBytes)
+	: dir(dir), segmentBytes(segmentBytes), maxBytes(maxBytes < segmentBytes ? segmentBytes : maxBytes), nextSequence(1),
+	pending(0), spooled(0), replayed(0), evicted(0), diskBytes(0) {
+}
+
+
+Spool::~Spool() {
+	for (size_t i = 0; i < segments.size(); i++) {
+		msync(segments[i].map, segmentBytes, MS_SYNC);
+		munmap(segments[i].map, segmentBytes);
+		if (segments[i].records == 0)
+			unlink(segments[i].path.c_str());
+	}
+}
+
+
+bool Spool::open() {
+	if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+		std::cerr << "Unable to create spool directory " << dir << ": " << strerror(errno) << std::endl;
+		return false;
+	}
+
+	DIR *d = opendir(dir.c_str());
+	if (d == nullptr) {
+		std::cerr << "Unable to open spool directory " << dir << ": " << strerror(errno) << std::endl;
+		return false;
+	}
+	std::vector<uint64_t> found;
+	struct dirent *entry;
+	while ((entry = readdir(d)) != nullptr) {
+		unsigned long long sequence;
+		int end = 0;
+		if (sscanf(entry->d_name, "wipry-%16llx.spool%n", &sequence, &end) == 1 && end > 0 && entry->d_name[end] == '\0')
+			found.push_back(sequence);
+	}
+	closedir(d);
+	std::sort(found.begin(), found.end());
+
+	for (size_t i = 0; i < found.size(); i++) {
+		char name[64];
+		snprintf(name, sizeof(name), "/wipry-%016llx.spool", (unsigned long long)found[i]);
+		if (!openSegment(dir + name, found[i]))
+			unlink((dir + name).c_str());
+		nextSequence = found[i] + 1;
+	}
+
+	if (!segments.empty())
+		std::cerr << "Spool holds " << recordsPending() << " records from a previous run." << std::endl;
+	return true;
+}
+
+
+size_t Spool::scan(Segment &segment, size_t from, unsigned long long *records) {
+	size_t offset = from;
+	*records = 0;
+	while (offset + sizeof(SpoolRecordHeader) <= segmentBytes) {
+		SpoolRecordHeader header;
+		memcpy(&header, segment.map + offset, sizeof(header));
+		if (header.magic != SPOOL_RECORD_MAGIC || header.headerCrc != checksum(&header, offsetof(SpoolRecordHeader, headerCrc)))
+			break;
+		if (offset + recordSpan(header.length) > segmentBytes)
+			break;
+		if (header.payloadCrc != checksum(segment.map + offset + sizeof(header), header.length))
+			break;
+		offset += recordSpan(header.length);
+		(*records)++;
+	}
+	return offset;
+}
+
+
+bool Spool::openSegment(const std::string &path, uint64_t sequence) {
+	int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size != segmentBytes) {
+		// written with another --spool-segment-mb, or truncated
+		close(fd);
+		std::cerr << "Discarding spool segment " << path << " of unexpected size." << std::endl;
+		return false;
+	}
+	void *map = mmap(nullptr, segmentBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return false;
+
+	SpoolSegmentHeader header;
+	memcpy(&header, map, sizeof(header));
+	if (memcmp(header.magic, SPOOL_MAGIC, 8) != 0 || header.headerCrc != segmentHeaderCrc(header)
+		|| header.sequence != sequence || header.segmentBytes != segmentBytes) {
+		munmap(map, segmentBytes);
+		std::cerr << "Discarding spool segment " << path << " with a bad header." << std::endl;
+		return false;
+	}
+
+	Segment segment;
+	segment.path = path;
+	segment.sequence = sequence;
+	segment.map = (char *)map;
+	segment.sealed = true;
+
+	// Trust the stored replay position only if it lands on a record boundary.
+	unsigned long long all;
+	segment.writeOffset = scan(segment, sizeof(SpoolSegmentHeader), &all);
+	segment.readOffset = sizeof(SpoolSegmentHeader);
+	segment.records = all;
+	size_t offset = sizeof(SpoolSegmentHeader);
+	while (offset < segment.writeOffset && offset < header.readOffset) {
+		SpoolRecordHeader record;
+		memcpy(&record, segment.map + offset, sizeof(record));
+		offset += recordSpan(record.length);
+		if (offset == header.readOffset) {
+			unsigned long long rest;
+			scan(segment, offset, &rest);
+			segment.readOffset = offset;
+			segment.records = rest;
+		}
+	}
+
+	if (segment.records == 0) {
+		munmap(map, segmentBytes);
+		return false;
+	}
+
+	segments.push_back(segment);
+	pending.fetch_add(segment.records, std::memory_order_relaxed);
+	diskBytes.fetch_add(segmentBytes, std::memory_order_relaxed);
+	return true;
+}
+
+
+void Spool::removeOldest() {
+	Segment &oldest = segments.front();
+	if (oldest.records > 0) {
+		std::cerr << "Spool full, evicting " << oldest.records << " records." << std::endl;
+		evicted.fetch_add(oldest.records, std::memory_order_relaxed);
+		pending.fetch_sub(oldest.records, std::memory_order_relaxed);
+	}
+	removeSegment(0);
+}
+
+
+// Unmaps and deletes a segment that has nothing left to replay, or whose
+// records have been counted as lost.
+void Spool::removeSegment(size_t index) {
+	Segment &segment = segments[index];
+	munmap(segment.map, segmentBytes);
+	unlink(segment.path.c_str());
+	diskBytes.fetch_sub(segmentBytes, std::memory_order_relaxed);
+	segments.erase(segments.begin() + index);
+}
+
+
+bool Spool::createSegment() {
+	if (!segments.empty() && !segments.back().sealed) {
+		// replayed to the end already, consume() left it for further appends
+		if (segments.back().records == 0)
+			removeSegment(segments.size() - 1);
+		else {
+			msync(segments.back().map, segmentBytes, MS_ASYNC);
+			segments.back().sealed = true;
+		}
+	}
+	while (!segments.empty() && (segments.size() + 1) * segmentBytes > maxBytes)
+		removeOldest();
+
+	char name[64];
+	snprintf(name, sizeof(name), "/wipry-%016llx.spool", (unsigned long long)nextSequence);
+	std::string path = dir + name;
+
+	int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		std::cerr << "Unable to create spool segment " << path << ": " << strerror(errno) << std::endl;
+		return false;
+	}
+	if (ftruncate(fd, segmentBytes) != 0) {
+		std::cerr << "Unable to size spool segment " << path << ": " << strerror(errno) << std::endl;
+		close(fd);
+		unlink(path.c_str());
+		return false;
+	}
+	void *map = mmap(nullptr, segmentBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		unlink(path.c_str());
+		return false;
+	}
+
+	SpoolSegmentHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SPOOL_MAGIC, 8);
+	header.version = 1;
+	header.sequence = nextSequence;
+	header.segmentBytes = segmentBytes;
+	header.readOffset = sizeof(SpoolSegmentHeader);
+	header.headerCrc = segmentHeaderCrc(header);
+	memcpy(map, &header, sizeof(header));
+
+	Segment segment;
+	segment.path = path;
+	segment.sequence = nextSequence++;
+	segment.map = (char *)map;
+	segment.readOffset = sizeof(SpoolSegmentHeader);
+	segment.writeOffset = sizeof(SpoolSegmentHeader);
+	segment.records = 0;
+	segment.sealed = false;
+	segments.push_back(segment);
+	diskBytes.fetch_add(segmentBytes, std::memory_order_relaxed);
+	return true;
+}
+
+
+bool Spool::append(const char *data, size_t len, uint32_t flags) {
+	if (recordSpan(len) > segmentBytes - sizeof(SpoolSegmentHeader)) {
+		std::cerr << "Record of " << len << " bytes does not fit a spool segment." << std::endl;
+		return false;
+	}
+	if (segments.empty() || segments.back().sealed || segments.back().writeOffset + recordSpan(len) > segmentBytes) {
+		if (!createSegment())
+			return false;
+	}
+
+	Segment &segment = segments.back();
+	char *at = segment.map + segment.writeOffset;
+
+	// payload first, then the header that makes it visible
+	memcpy(at + sizeof(SpoolRecordHeader), data, len);
+	SpoolRecordHeader header;
+	header.magic = SPOOL_RECORD_MAGIC;
+	header.flags = flags;
+	header.length = (uint32_t)len;
+	header.payloadCrc = checksum(data, len);
+	header.headerCrc = checksum(&header, offsetof(SpoolRecordHeader, headerCrc));
+	header.reserved = 0;
+	memcpy(at, &header, sizeof(header));
+
+	segment.writeOffset += recordSpan(len);
+	segment.records++;
+	pending.fetch_add(1, std::memory_order_relaxed);
+	spooled.fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
+
+
+bool Spool::peek(const char *&data, size_t &len, uint32_t &flags) {
+	for (size_t i = 0; i < segments.size(); i++) {
+		Segment &segment = segments[i];
+		if (segment.records == 0)
+			continue;
+		SpoolRecordHeader header;
+		memcpy(&header, segment.map + segment.readOffset, sizeof(header));
+		data = segment.map + segment.readOffset + sizeof(header);
+		len = header.length;
+		flags = header.flags;
+		return true;
+	}
+	return false;
+}
+
+
+void Spool::storeReadOffset(Segment &segment) {
+	uint64_t offset = segment.readOffset;
+	memcpy(segment.map + offsetof(SpoolSegmentHeader, readOffset), &offset, sizeof(offset));
+}
+
+
+void Spool::consume() {
+	for (size_t i = 0; i < segments.size(); i++) {
+		Segment &segment = segments[i];
+		if (segment.records == 0)
+			continue;
+
+		SpoolRecordHeader header;
+		memcpy(&header, segment.map + segment.readOffset, sizeof(header));
+		segment.readOffset += recordSpan(header.length);
+		segment.records--;
+		storeReadOffset(segment);
+		pending.fetch_sub(1, std::memory_order_relaxed);
+		replayed.fetch_add(1, std::memory_order_relaxed);
+
+		if (segment.records == 0 && segment.sealed)
+			removeSegment(i);
+		return;
+	}
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*
+
+    Spool
+
+    Write-ahead store for output that could not be delivered.  Records are
+    appended to fixed-size, mmap'd segment files in a directory; once the
+    total would pass maxBytes the oldest segment is deleted, unreplayed
+    records and all.
+
+    Every segment starts with a checksummed header, and every record carries
+    a checksum of its own header and of its payload.  Reading stops at the
+    first record that does not check out, so a crash in the middle of an
+    append only loses that tail.  The replay position is kept in the segment
+    header, so a restart resumes where the last run stopped; at worst a
+    record is sent twice, which InfluxDB treats as an overwrite.
+
+    Not thread safe: the owning sink uses it from its sender thread only.
+
+*/
+
+
+class Spool {
+public:
+	Spool(const std::string &dir, size_t segmentBytes, size_t maxBytes);
+	~Spool();
+
+	// Opens the directory and picks up segments left by a previous run.
+	bool open();
+
+	// Appends one record.  flags is opaque to the spool and returned by peek().
+	bool append(const char *data, size_t len, uint32_t flags);
+
+	bool empty() const { return pending.load(std::memory_order_relaxed) == 0; }
+
+	// Oldest record not yet replayed.  data stays valid until consume().
+	bool peek(const char *&data, size_t &len, uint32_t &flags);
+
+	// Marks the record returned by peek() as replayed.
+	void consume();
+
+	unsigned long long recordsPending() const { return pending.load(std::memory_order_relaxed); }
+	unsigned long long recordsSpooled() const { return spooled.load(std::memory_order_relaxed); }
+	unsigned long long recordsReplayed() const { return replayed.load(std::memory_order_relaxed); }
+	unsigned long long recordsEvicted() const { return evicted.load(std::memory_order_relaxed); }
+	unsigned long long bytesOnDisk() const { return diskBytes.load(std::memory_order_relaxed); }
+
+private:
+	struct Segment {
+		std::string path;
+		uint64_t sequence;
+		char *map;
+		size_t readOffset;
+		size_t writeOffset;
+		unsigned long long records;	// not yet replayed
+		bool sealed;			// no more appends
+	};
+
+	bool openSegment(const std::string &path, uint64_t sequence);
+	bool createSegment();
+	void removeOldest();
+	void removeSegment(size_t index);
+	size_t scan(Segment &segment, size_t from, unsigned long long *records);
+	void storeReadOffset(Segment &segment);
+
+	std::string dir;
+	size_t segmentBytes;
+	size_t maxBytes;
+	uint64_t nextSequence;
+	std::vector<Segment> segments;	// oldest first, the last one is appended to
+
+	std::atomic<unsigned long long> pending;
+	std::atomic<unsigned long long> spooled;
+	std::atomic<unsigned long long> replayed;
+	std::atomic<unsigned long long> evicted;
+	std::atomic<unsigned long long> diskBytes;
+};
@@ -0,0 +1,115 @@
+#include "device.h"
+#include <chrono>
+
+
+SyntheticDevice::SyntheticDevice(const SyntheticConfig &aConfig) : config(aConfig), rng(aConfig.seed ? aConfig.seed : 1), sinceOpen(0) {
+}
+
+
+SyntheticDevice::~SyntheticDevice() {
+	endCommunication();
+}
+
+
+bool SyntheticDevice::getOddRssiLimts(float *min, float *max, float *noiseFloor) {
+	*min = -110;
+	*max = -10;
+	*noiseFloor = -96;
+	return true;
+}
+
+
+bool SyntheticDevice::getEvenRssiLimts(float *min, float *max, float *noiseFloor) {
+	*min = -110;
+	*max = -10;
+	*noiseFloor = -95;
+	return true;
+}
+
+
+bool SyntheticDevice::get2_4GHzBoundary(float *minMHz, float *maxMHz) {
+	*minMHz = 2400;
+	*maxMHz = 2495;
+	return true;
+}
+
+
+bool SyntheticDevice::get5GHzBoundary(float *minMHz, float *maxMHz) {
+	*minMHz = 5150;
+	*maxMHz = 5895;
+	return true;
+}
+
+
+bool SyntheticDevice::get6EBoundary(float *minMHz, float *maxMHz) {
+	*minMHz = 5925;
+	*maxMHz = 7125;
+	return true;
+}
+
+
+bool SyntheticDevice::open() {
+	sinceOpen = 0;
+	return true;
+}
+
+
+bool SyntheticDevice::stream(oscium::WiPryClarity::DataType dataType) {
+	unsigned int points = config.points[(int)dataType & 3];
+	sweep.assign(points, 0.0f);
+
+	// bins outside a zoom window are left at 0, like the invalid bins of a zoomed WiPry frame
+	unsigned int first = 0, end = points;
+	if (zoomWidth != 0) {
+		first = zoomStart < points ? zoomStart.load() : points;
+		end = first + zoomWidth < points ? first + zoomWidth : points;
+	}
+	double rate = config.sweepsPerSecond;
+	if (end > first)
+		rate *= (double)points / (end - first);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	unsigned long long sent = 0;
+
+	while (keepStreaming(dataType)) {
+		if (rate > 0) {
+			std::chrono::steady_clock::time_point due = start
+				+ std::chrono::nanoseconds((long long)(sent * 1e9 / rate));
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			// sleep only when ahead by more than a millisecond, high rates go out in bursts
+			if (due - now > std::chrono::milliseconds(1)) {
+				std::this_thread::sleep_until(due);
+				continue;
+			}
+		}
+
+		// noise floor with a slow-moving carrier and an occasional burst
+		double phase = (double)(sent % 600) / 600.0;
+		unsigned int carrier = (unsigned int)(phase * points);
+		unsigned int halfWidth = points / 50 + 1;
+		bool burst = (sent % 37) == 0;
+		for (unsigned int p = first; p < end; p++) {
+			rng ^= rng << 13;
+			rng ^= rng >> 17;
+			rng ^= rng << 5;
+			float value = -97.0f + (float)(rng % 600) / 100.0f;
+			unsigned int distance = p > carrier ? p - carrier : carrier - p;
+			if (distance < halfWidth)
+				value += 35.0f * (1.0f - (float)distance / halfWidth);
+			if (burst && p % 97 < 4)
+				value = -40.0f - (float)(rng % 10);
+			sweep[p] = value;
+		}
+
+		if (delegate != nullptr)
+			delegate->deviceDidReceiveRSSIData(this, dataType, sweep);
+		sent++;
+		frames.fetch_add(1, std::memory_order_relaxed);
+
+		if (config.dropEvery != 0 && ++sinceOpen == config.dropEvery) {
+			connectionLost(oscium::WiPryClarity::ErrorCode::UnableToCommunicateWithAccessory);
+			break;
+		}
+	}
+	return true;
+}
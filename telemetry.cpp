@@ -0,0 +1,275 @@
+#include "telemetry.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+
+// How often the server thread looks at running while no scraper connects.
+#define METRICS_POLL_MS 200
+
+static const char *bandNames[4] = { "2", "5", "6", "dual" };
+
+
+LatencyHistogram::LatencyHistogram() : total(0), sumNs(0) {
+	for (int b = 0; b < TELEMETRY_BUCKETS; b++)
+		buckets[b] = 0;
+}
+
+
+void LatencyHistogram::record(long long ns) {
+	int b = 0;
+	unsigned long long v = ns > 0 ? (unsigned long long)(ns - 1) >> 8 : 0;
+	if (v != 0)
+		b = 64 - __builtin_clzll(v);
+	if (b >= TELEMETRY_BUCKETS)
+		b = TELEMETRY_BUCKETS - 1;
+	buckets[b].fetch_add(1, std::memory_order_relaxed);
+	total.fetch_add(1, std::memory_order_relaxed);
+	sumNs.fetch_add(ns > 0 ? ns : 0, std::memory_order_relaxed);
+}
+
+
+double LatencyHistogram::meanUs() const {
+	unsigned long long n = count();
+	return n != 0 ? sumNs.load(std::memory_order_relaxed) / 1000.0 / n : 0;
+}
+
+
+double LatencyHistogram::quantileUs(double q) const {
+	unsigned long long n = count();
+	if (n == 0)
+		return 0;
+	unsigned long long rank = (unsigned long long)(q * n);
+	unsigned long long seen = 0;
+	for (int b = 0; b < TELEMETRY_BUCKETS - 1; b++) {
+		seen += buckets[b].load(std::memory_order_relaxed);
+		if (seen > rank)
+			return bucketBound(b) / 1000.0;
+	}
+	// slower than the last bound, all we know is that it is at least this
+	return bucketBound(TELEMETRY_BUCKETS - 2) / 1000.0;
+}
+
+
+void LatencyHistogram::writePrometheus(std::string &out, const char *name, const char *help) const {
+	char line[160];
+	snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+	out += line;
+	unsigned long long cumulative = 0;
+	for (int b = 0; b < TELEMETRY_BUCKETS; b++) {
+		cumulative += buckets[b].load(std::memory_order_relaxed);
+		if (b < TELEMETRY_BUCKETS - 1)
+			snprintf(line, sizeof(line), "%s_bucket{le=\"%g\"} %llu\n", name, bucketBound(b) / 1e9, cumulative);
+		else
+			snprintf(line, sizeof(line), "%s_bucket{le=\"+Inf\"} %llu\n", name, cumulative);
+		out += line;
+	}
+	// the buckets are read one by one while they change, keep _count consistent with +Inf
+	snprintf(line, sizeof(line), "%s_sum %.9f\n%s_count %llu\n", name, sumNs.load(std::memory_order_relaxed) / 1e9, name, cumulative);
+	out += line;
+}
+
+
+Telemetry::Telemetry() : writer(nullptr), output(nullptr) {
+	for (int t = 0; t < 4; t++) {
+		received[t] = 0;
+		emitted[t] = 0;
+		gaps[t] = 0;
+		missed[t] = 0;
+	}
+}
+
+
+void Telemetry::setSources(const FrameWriter *aWriter, const Sink *aOutput) {
+	writer = aWriter;
+	output = aOutput;
+}
+
+
+unsigned int Telemetry::writeLines(LineBuffer &out, long long timens) const {
+	unsigned int lines = 0;
+	char line[512];
+	for (int t = 0; t < 4; t++) {
+		unsigned long long r = received[t].load(std::memory_order_relaxed);
+		unsigned long long e = emitted[t].load(std::memory_order_relaxed);
+		if (r == 0 && e == 0)
+			continue;
+		int n = snprintf(line, sizeof(line), "wipry_internal,band=%s received=%llu,emitted=%llu,gaps=%llu,missed=%llu %lld\n", bandNames[t], r, e,
+			gaps[t].load(std::memory_order_relaxed), missed[t].load(std::memory_order_relaxed), timens);
+		out.append(line, n);
+		lines++;
+	}
+
+	int n = snprintf(line, sizeof(line), "wipry_internal dropped=%llu,queue_depth=%zu,bytes_out=%llu",
+		writer != nullptr ? writer->droppedFrames() : 0ULL, writer != nullptr ? writer->queueDepth() : (size_t)0,
+		output != nullptr ? output->bytesOut() : 0ULL);
+	out.append(line, n);
+	const LatencyHistogram *histograms[4] = { &callback, &serialize, &write, &jitter };
+	const char *names[4] = { "callback", "serialize", "write", "jitter" };
+	for (int h = 0; h < 4; h++) {
+		n = snprintf(line, sizeof(line), ",%s_count=%llu,%s_mean_us=%.1f,%s_p50_us=%.1f,%s_p99_us=%.1f",
+			names[h], histograms[h]->count(), names[h], histograms[h]->meanUs(),
+			names[h], histograms[h]->quantileUs(0.5), names[h], histograms[h]->quantileUs(0.99));
+		out.append(line, n);
+	}
+	n = snprintf(line, sizeof(line), " %lld\n", timens);
+	out.append(line, n);
+	return lines + 1;
+}
+
+
+std::string Telemetry::prometheus() const {
+	std::string out;
+	char line[160];
+
+	out += "# HELP wipry_frames_received_total Sweeps the device callback received.\n# TYPE wipry_frames_received_total counter\n";
+	for (int t = 0; t < 4; t++) {
+		snprintf(line, sizeof(line), "wipry_frames_received_total{band=\"%s\"} %llu\n", bandNames[t], received[t].load(std::memory_order_relaxed));
+		out += line;
+	}
+	out += "# HELP wipry_frames_emitted_total Sweeps formatted and handed to the output.\n# TYPE wipry_frames_emitted_total counter\n";
+	for (int t = 0; t < 4; t++) {
+		snprintf(line, sizeof(line), "wipry_frames_emitted_total{band=\"%s\"} %llu\n", bandNames[t], emitted[t].load(std::memory_order_relaxed));
+		out += line;
+	}
+	out += "# HELP wipry_sweep_gaps_total Breaks in the sweeps of a band.\n# TYPE wipry_sweep_gaps_total counter\n";
+	for (int t = 0; t < 4; t++) {
+		snprintf(line, sizeof(line), "wipry_sweep_gaps_total{band=\"%s\"} %llu\n", bandNames[t], gaps[t].load(std::memory_order_relaxed));
+		out += line;
+	}
+	out += "# HELP wipry_sweeps_missed_total Sweeps lost in the breaks.\n# TYPE wipry_sweeps_missed_total counter\n";
+	for (int t = 0; t < 4; t++) {
+		snprintf(line, sizeof(line), "wipry_sweeps_missed_total{band=\"%s\"} %llu\n", bandNames[t], missed[t].load(std::memory_order_relaxed));
+		out += line;
+	}
+	snprintf(line, sizeof(line), "# HELP wipry_frames_dropped_total Sweeps lost to a full queue.\n# TYPE wipry_frames_dropped_total counter\n"
+		"wipry_frames_dropped_total %llu\n", writer != nullptr ? writer->droppedFrames() : 0ULL);
+	out += line;
+	snprintf(line, sizeof(line), "# HELP wipry_queue_depth Sweeps waiting for the writer thread.\n# TYPE wipry_queue_depth gauge\n"
+		"wipry_queue_depth %zu\n", writer != nullptr ? writer->queueDepth() : (size_t)0);
+	out += line;
+	snprintf(line, sizeof(line), "# HELP wipry_bytes_out_total Bytes written to the output.\n# TYPE wipry_bytes_out_total counter\n"
+		"wipry_bytes_out_total %llu\n", output != nullptr ? output->bytesOut() : 0ULL);
+	out += line;
+
+	callback.writePrometheus(out, "wipry_callback_seconds", "Time spent in the device callback.");
+	serialize.writePrometheus(out, "wipry_serialize_seconds", "Time to format one sweep.");
+	write.writePrometheus(out, "wipry_write_seconds", "Time to hand one sweep's lines to the output.");
+	jitter.writePrometheus(out, "wipry_sweep_jitter_seconds", "Sweep arrival against the modeled sweep period.");
+	return out;
+}
+
+
+MetricsServer::MetricsServer(const Telemetry *telemetry, int port)
+	: telemetry(telemetry), port(port), fd(-1), running(false) {
+}
+
+
+MetricsServer::~MetricsServer() {
+	stop();
+}
+
+
+bool MetricsServer::start() {
+	fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return false;
+	int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	// localhost only, there is no authentication
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 4) != 0) {
+		std::cerr << "Unable to listen on 127.0.0.1:" << port << ": " << strerror(errno) << std::endl;
+		close(fd);
+		fd = -1;
+		return false;
+	}
+	running = true;
+	thread = std::thread(&MetricsServer::threadMain, this);
+	return true;
+}
+
+
+void MetricsServer::stop() {
+	if (!running.exchange(false))
+		return;
+	if (thread.joinable())
+		thread.join();
+	close(fd);
+	fd = -1;
+}
+
+
+void MetricsServer::threadMain() {
+	while (running) {
+		struct pollfd p;
+		p.fd = fd;
+		p.events = POLLIN;
+		if (poll(&p, 1, METRICS_POLL_MS) <= 0)
+			continue;
+		int client = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+		if (client < 0)
+			continue;
+		serve(client);
+		close(client);
+	}
+}
+
+
+void MetricsServer::serve(int client) {
+	struct timeval tv;
+	tv.tv_sec = 1;
+	tv.tv_usec = 0;
+	setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	// only the request line matters, read until the end of the headers
+	std::string request;
+	char buf[1024];
+	while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+		ssize_t n = recv(client, buf, sizeof(buf), 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return;
+		request.append(buf, n);
+	}
+
+	std::string body, status;
+	if (request.compare(0, 4, "GET ") == 0) {
+		status = "200 OK";
+		body = telemetry->prometheus();
+	}
+	else {
+		status = "405 Method Not Allowed";
+		body = "GET only\n";
+	}
+	char header[256];
+	int n = snprintf(header, sizeof(header), "HTTP/1.1 %s\r\nContent-Type: text/plain; version=0.0.4\r\n"
+		"Content-Length: %zu\r\nConnection: close\r\n\r\n", status.c_str(), body.size());
+	std::string response(header, n);
+	response += body;
+
+	const char *p = response.data();
+	size_t left = response.size();
+	while (left > 0) {
+		ssize_t sent = send(client, p, left, MSG_NOSIGNAL);
+		if (sent < 0 && errno == EINTR)
+			continue;
+		if (sent <= 0)
+			return;
+		p += sent;
+		left -= sent;
+	}
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "WiPryClarity.h"
+#include "writer.h"
+#include "sink.h"
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+/*
+
+    Telemetry
+
+    Counters and latency histograms for the pipeline itself, so it shows
+    whether wipry-lp keeps up with the device.  Everything is a relaxed
+    atomic: the device callback, the writer thread and the metrics server
+    update and read them without ever taking a lock.
+
+    The writer thread appends them to the output every so often as
+
+        wipry_internal,band=<2|5|6|dual> received=N,emitted=N,gaps=N,missed=N <timens>
+        wipry_internal dropped=N,queue_depth=N,bytes_out=N,callback_count=N,callback_mean_us=X,... <timens>
+
+    and MetricsServer serves the same numbers in Prometheus text format.
+
+    gaps counts the breaks in a band's sweeps the SweepClock noticed and
+    missed the sweeps lost in them, the jitter histogram how far arrivals
+    were from the modeled sweep period.
+
+*/
+
+
+// Latencies in power-of-two buckets from 256ns up to about 34ms, plus one
+// for anything slower.
+#define TELEMETRY_BUCKETS 19
+
+
+class LatencyHistogram {
+public:
+	LatencyHistogram();
+
+	void record(long long ns);
+
+	unsigned long long count() const { return total.load(std::memory_order_relaxed); }
+	double meanUs() const;
+
+	// Upper bound in us of the bucket holding quantile q, a conservative estimate.
+	double quantileUs(double q) const;
+
+	// Bucket b holds latencies up to this many ns.  The last one is unbounded.
+	static long long bucketBound(int b) { return 256LL << b; }
+
+	// Appends the histogram as a Prometheus histogram in seconds.
+	void writePrometheus(std::string &out, const char *name, const char *help) const;
+
+private:
+	std::atomic<unsigned long long> buckets[TELEMETRY_BUCKETS];
+	std::atomic<unsigned long long> total;
+	std::atomic<unsigned long long> sumNs;
+};
+
+
+class Telemetry {
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	Telemetry();
+
+	// Where dropped frames, queue depth and bytes out are read from.
+	void setSources(const FrameWriter *writer, const Sink *output);
+
+	void frameReceived(oscium::WiPryClarity::DataType dataType) {
+		received[(int)dataType & 3].fetch_add(1, std::memory_order_relaxed);
+	}
+	void frameEmitted(oscium::WiPryClarity::DataType dataType) {
+		emitted[(int)dataType & 3].fetch_add(1, std::memory_order_relaxed);
+	}
+	// Device callback: how a sweep arrived against its band's SweepClock.
+	void sweepTimed(oscium::WiPryClarity::DataType dataType, long long jitterns, unsigned int missedSweeps) {
+		if (missedSweeps != 0) {
+			gaps[(int)dataType & 3].fetch_add(1, std::memory_order_relaxed);
+			missed[(int)dataType & 3].fetch_add(missedSweeps, std::memory_order_relaxed);
+		}
+		else
+			jitter.record(jitterns < 0 ? -jitterns : jitterns);
+	}
+
+	static long long elapsedNs(Clock::time_point since) {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - since).count();
+	}
+
+	LatencyHistogram callback;		// device callback, start to finish
+	LatencyHistogram serialize;		// formatting one sweep on the writer thread
+	LatencyHistogram write;			// handing the formatted lines to the output
+	LatencyHistogram jitter;		// sweep arrival against the modeled period, either way
+
+	// Writer thread: appends the wipry_internal lines and returns how many.
+	unsigned int writeLines(LineBuffer &out, long long timens) const;
+
+	std::string prometheus() const;
+
+private:
+	std::atomic<unsigned long long> received[4];	// per DataType
+	std::atomic<unsigned long long> emitted[4];
+	std::atomic<unsigned long long> gaps[4];
+	std::atomic<unsigned long long> missed[4];
+	const FrameWriter *writer;
+	const Sink *output;
+};
+
+
+// Serves Telemetry::prometheus() to any GET on 127.0.0.1:port.
+class MetricsServer {
+public:
+	MetricsServer(const Telemetry *telemetry, int port);
+	~MetricsServer();
+
+	bool start();
+	void stop();
+
+private:
+	void threadMain();
+	void serve(int client);
+
+	const Telemetry *telemetry;
+	int port;
+	int fd;
+	std::atomic<bool> running;
+	std::thread thread;
+};
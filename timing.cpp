@@ -0,0 +1,132 @@
+#include "timing.h"
+#include <cmath>
+#include <cstdlib>
+
+
+// A late arrival moves the modeled end this fraction of the way towards it.
+#define TIMING_FOLLOW 8
+
+
+SweepClock::SweepClock()
+	: running(false), learnt(false), inGap(false), period(0), slack(0), spanLate(0), lastSpanLate(0),
+	anchorSteady(0), anchorSequence(0), longestInterval(0), lastArrival(0), end(0), offset(0), nextResync(0), sequence(0),
+	gapCount(0), missedCount(0), stepCount(0), jitterCount(0), jitterSum(0), jitterMax(0) {
+}
+
+
+void SweepClock::restart() {
+	running = false;
+	learnt = false;
+}
+
+
+SweepTime SweepClock::arrived(long long steadyns, long long wallns) {
+	SweepTime t;
+	t.jitterns = 0;
+	t.missed = 0;
+
+	bool first = !running;
+	if (first) {
+		running = true;
+		end = steadyns;
+	}
+	else if (!learnt) {
+		// nothing to model against yet
+		if (steadyns - lastArrival > longestInterval)
+			longestInterval = steadyns - lastArrival;
+		end = steadyns;
+	}
+	else {
+		long long expected = end + period;
+		long long late = steadyns - expected;
+		if (late * 2 > period + slack * 2) {
+			// later than queueing has held a sweep back lately, by more than
+			// half a period: sweeps went missing, start modeling afresh
+			long long n = llround((double)(late - slack) / period);
+			t.missed = n > 0 ? (unsigned int)n : 1;
+			gapCount++;
+			missedCount += t.missed;
+			sequence += t.missed;
+			end = steadyns;
+			// two gaps in a row, the period itself is suspect
+			if (inGap) {
+				learnt = false;
+				first = true;
+			}
+		}
+		else {
+			t.jitterns = late;
+			long long magnitude = llabs(late);
+			jitterCount++;
+			jitterSum += magnitude;
+			if (magnitude > jitterMax)
+				jitterMax = magnitude;
+
+			if (late > spanLate)
+				spanLate = late;
+			slack = spanLate > lastSpanLate ? spanLate : lastSpanLate;
+
+			if (late < 0)
+				end = steadyns;
+			else
+				end = expected + late / TIMING_FOLLOW;
+		}
+	}
+	inGap = t.missed != 0;
+	lastArrival = steadyns;
+	sequence++;
+
+	if (first) {
+		anchorSteady = steadyns;
+		anchorSequence = sequence;
+		if (!learnt)
+			longestInterval = 0;
+	}
+	else
+		measure(steadyns);
+
+	// follow slewing at every resync, a jump beyond TIMING_STEP_MS at once
+	long long sample = wallns - steadyns;
+	long long drift = sample - offset;
+	if (sequence == 1 || steadyns >= nextResync || llabs(drift) > TIMING_STEP_MS * 1000000LL) {
+		if (sequence != 1 && llabs(drift) > TIMING_STEP_MS * 1000000LL)
+			stepCount++;
+		offset = sample;
+		nextResync = steadyns + TIMING_RESYNC_MS * 1000000LL;
+	}
+
+	t.sequence = sequence;
+	t.endns = end + offset;
+	t.startns = t.endns - period;
+	return t;
+}
+
+
+// The period is the time since the anchor over the sweeps since then, missed
+// ones included, taken once that spans TIMING_SPAN_MS and TIMING_LEARN
+// sweeps.  Until the first span is over the estimate so far stands in.
+void SweepClock::measure(long long steadyns) {
+	long long elapsed = steadyns - anchorSteady;
+	unsigned long long sweeps = sequence - anchorSequence;
+	if (sweeps < TIMING_LEARN || elapsed < TIMING_SPAN_MS * 1000000LL) {
+		if (!learnt)
+			period = elapsed / (long long)sweeps;
+		return;
+	}
+
+	period = elapsed / (long long)sweeps;
+	anchorSteady = steadyns;
+	anchorSequence = sequence;
+	if (period <= 0)
+		return;
+
+	if (!learnt) {
+		// the longest wait for a sweep while learning is what queueing can do
+		learnt = true;
+		lastSpanLate = longestInterval > period ? longestInterval - period : 0;
+	}
+	else
+		lastSpanLate = spanLate;
+	spanLate = 0;
+	slack = lastSpanLate;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+
+    SweepClock
+
+    Times the sweeps of one band from when they arrive, on the steady clock,
+    instead of stamping each with the wall clock when its callback happens
+    to run.
+
+    The sweep period is the time spanned by at least TIMING_SPAN_MS and
+    TIMING_LEARN arrivals over the sweeps among them, missed ones included,
+    measured afresh every span.  The library queues sweeps and often hands
+    them over in bursts; single intervals say little then, but the span of
+    many does not care how they were bunched up.
+
+    Every arrival is compared with the end of the previous sweep plus one
+    period: the library only ever delivers late, never early, so an early
+    arrival is taken as the true end of the sweep and a late one is
+    followed only a little, which keeps queueing jitter out of the
+    timestamps while still tracking drift.  The difference is the jitter.
+
+    How late queueing holds a sweep back is learnt as well: from the
+    longest interval of the first span, then the most any sweep was late in
+    this span or the one before.  A sweep later than that by more than half
+    a period means a gap: the sweeps that would have fit into it are counted
+    as missed and skipped in the sequence numbers, so a consumer sees the
+    gap as well.  Until the first span is over, and again after two gaps in
+    a row, which means the period itself is wrong, no gaps are looked for.
+
+    Steady time is turned into wall time by an offset sampled from the wall
+    clock, refreshed every TIMING_RESYNC_MS so that NTP slewing is followed.
+    When the wall clock moves against the steady clock by more than
+    TIMING_STEP_MS at once, NTP stepped it: the offset is taken over at once
+    and the step counted.
+
+    Only the device's data thread calls arrived(); the statistics are read
+    once it has stopped.
+
+*/
+
+
+// The wall clock offset is sampled again this often.
+#define TIMING_RESYNC_MS 10000
+// A jump of the wall clock against the steady clock beyond this is a step.
+#define TIMING_STEP_MS 50
+// The period is measured over at least this long and this many sweeps.
+#define TIMING_SPAN_MS 1000
+#define TIMING_LEARN 16
+
+
+struct SweepTime {
+	unsigned long long sequence;
+	long long startns;		// wall clock
+	long long endns;
+	long long jitterns;		// arrival against the model, 0 for the first sweep of a run
+	unsigned int missed;	// sweeps missing right before this one
+};
+
+
+class SweepClock {
+public:
+	SweepClock();
+
+	// A sweep arrived at steadyns on the steady clock, wallns on the wall clock.
+	SweepTime arrived(long long steadyns, long long wallns);
+
+	// The next sweep starts a new run, after the scheduler switched bands.
+	// The interval to it is neither a gap nor jitter.
+	void resume() { running = false; }
+
+	// As resume(), and the period is learnt afresh: the stream was started
+	// again and the zoom, and with it the sweep rate, may have changed.
+	void restart();
+
+	long long periodNs() const { return period; }
+	unsigned long long sweeps() const { return sequence; }
+	unsigned long long gaps() const { return gapCount; }
+	unsigned long long missed() const { return missedCount; }
+	unsigned long long steps() const { return stepCount; }
+	double jitterMeanUs() const { return jitterCount != 0 ? jitterSum / 1000.0 / jitterCount : 0; }
+	double jitterMaxUs() const { return jitterMax / 1000.0; }
+
+private:
+	void measure(long long steadyns);
+
+	bool running;
+	bool learnt;				// period and slack can be trusted to find gaps
+	bool inGap;					// the last interval was a gap
+	long long period;			// ns, 0 until two sweeps came in a row
+	long long slack;			// ns queueing held a sweep back, lately
+	long long spanLate, lastSpanLate;	// the most a sweep was late in this span and the last
+	long long anchorSteady;		// where the span being measured began
+	unsigned long long anchorSequence;
+	long long longestInterval;	// while learning
+	long long lastArrival;		// steady
+	long long end;				// modeled end of the last sweep, steady
+	long long offset;			// wall - steady
+	long long nextResync;		// steady
+	unsigned long long sequence;
+
+	unsigned long long gapCount, missedCount, stepCount;
+	unsigned long long jitterCount;
+	long long jitterSum, jitterMax;
+};
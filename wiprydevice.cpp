@@ -0,0 +1,96 @@
+#include "device.h"
+
+
+// Passes libWiPryClarity's delegate calls on to the DeviceDelegate.
+class WiPryDevice::Forwarder final : public oscium::WiPryClarityDelegate {
+public:
+	explicit Forwarder(WiPryDevice *device) : device(device) {}
+
+	void wipryClarityDidConnect(oscium::WiPryClarity *wipryClarity) {
+		if (device->delegate != nullptr)
+			device->delegate->deviceDidConnect(device);
+	}
+
+	void wipryClarityUnableToConnect(oscium::WiPryClarity *wipryClarity, oscium::WiPryClarity::ErrorCode errorCode) {
+		if (device->delegate != nullptr)
+			device->delegate->deviceUnableToConnect(device, errorCode);
+	}
+
+	void wipryClarityDidReceiveRSSIData(oscium::WiPryClarity *wipryClarity, oscium::WiPryClarity::DataType dataType, std::vector<float> rssiData) {
+		if (device->delegate != nullptr)
+			device->delegate->deviceDidReceiveRSSIData(device, dataType, rssiData);
+	}
+
+private:
+	WiPryDevice *device;
+};
+
+
+WiPryDevice::WiPryDevice() {
+	wipryClarity = new oscium::WiPryClarity();
+	forwarder = new Forwarder(this);
+	wipryClarity->setDelegate(forwarder);
+}
+
+
+WiPryDevice::~WiPryDevice() {
+	if (wipryClarity->didStartCommunication())
+		wipryClarity->endCommunication();
+	delete wipryClarity;
+	delete forwarder;
+}
+
+
+bool WiPryDevice::startCommunication() {
+	return wipryClarity->startCommunication();
+}
+
+
+bool WiPryDevice::endCommunication() {
+	return wipryClarity->endCommunication();
+}
+
+
+bool WiPryDevice::didStartCommunication() {
+	return wipryClarity->didStartCommunication();
+}
+
+
+bool WiPryDevice::startRssiData(oscium::WiPryClarity::DataType dataType, uint8_t shouldZoom, uint16_t startIndex, uint16_t width) {
+	return wipryClarity->startRssiData(dataType, shouldZoom, startIndex, width);
+}
+
+
+bool WiPryDevice::stopRssiData() {
+	return wipryClarity->stopRssiData();
+}
+
+
+std::string WiPryDevice::getSerialNumber() {
+	return wipryClarity->getSerialNumber();
+}
+
+
+bool WiPryDevice::getOddRssiLimts(float *min, float *max, float *noiseFloor) {
+	return wipryClarity->getOddRssiLimts(min, max, noiseFloor);
+}
+
+
+bool WiPryDevice::getEvenRssiLimts(float *min, float *max, float *noiseFloor) {
+	return wipryClarity->getEvenRssiLimts(min, max, noiseFloor);
+}
+
+
+bool WiPryDevice::get2_4GHzBoundary(float *minMHz, float *maxMHz) {
+	return wipryClarity->get2_4GHzBoundary(minMHz, maxMHz);
+}
+
+
+bool WiPryDevice::get5GHzBoundary(float *minMHz, float *maxMHz) {
+	return wipryClarity->get5GHzBoundary(minMHz, maxMHz);
+}
+
+
+bool WiPryDevice::get6EBoundary(float *minMHz, float *maxMHz) {
+	return wipryClarity->get6EBoundary(minMHz, maxMHz);
+}
@@ -0,0 +1,147 @@
+#include "writer.h"
+#include "kernels.h"
+#include <chrono>
+
+
+FrameWriter::FrameWriter(size_t capacity, OverflowPolicy policy, Handler handler, unsigned int queueCount)
+	: policy(policy), handler(handler), idleIntervalMs(10), running(false), drains(0), syncs(0) {
+	for (unsigned int q = 0; q < (queueCount > 0 ? queueCount : 1); q++)
+		queues.push_back(std::unique_ptr<Queue>(new Queue(capacity)));
+}
+
+
+void FrameWriter::setIdleHandler(IdleHandler aIdleHandler, unsigned int intervalMs) {
+	idleHandler = aIdleHandler;
+	idleIntervalMs = intervalMs > 0 && intervalMs < 10 ? intervalMs : 10;
+}
+
+
+FrameWriter::~FrameWriter() {
+	stop();
+}
+
+
+void FrameWriter::start() {
+	if (running.exchange(true))
+		return;
+	thread = std::thread(&FrameWriter::threadMain, this);
+}
+
+
+void FrameWriter::stop() {
+	if (!running.exchange(false))
+		return;
+	cv.notify_one();
+	if (thread.joinable())
+		thread.join();
+}
+
+
+void FrameWriter::sync() {
+	std::unique_lock<std::mutex> lock(mtx);
+	if (!running.load())
+		return;
+	// the drain under way may have missed frames pushed just now, wait for the one after it
+	unsigned long long until = drains + 2;
+	syncs++;
+	cv.notify_one();
+	drained.wait(lock, [&] { return drains >= until || !running.load(); });
+	syncs--;
+}
+
+
+unsigned long long FrameWriter::droppedFrames() const {
+	unsigned long long total = 0;
+	for (size_t q = 0; q < queues.size(); q++)
+		total += queues[q]->dropped.load(std::memory_order_relaxed);
+	return total;
+}
+
+
+size_t FrameWriter::queueDepth() const {
+	size_t total = 0;
+	for (size_t q = 0; q < queues.size(); q++)
+		total += queues[q]->ring.size();
+	return total;
+}
+
+
+size_t FrameWriter::poolBytes() const {
+	size_t total = 0;
+	for (size_t q = 0; q < queues.size(); q++)
+		total += queues[q]->ring.bytes();
+	return total;
+}
+
+
+bool FrameWriter::push(unsigned int queue, oscium::WiPryClarity::DataType dataType, const std::vector<float> &rssiData, long long timens,
+	long long startns, unsigned long long sequence) {
+	Queue &q = *queues[queue];
+	if (rssiData.size() > WIPRY_MAX_POINTS) {
+		q.dropped.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	bool droppedOldest;
+	RssiFrame *slot = q.ring.reserve(policy, droppedOldest);
+	if (droppedOldest)
+		q.dropped.fetch_add(1, std::memory_order_relaxed);
+	if (slot == nullptr) {
+		q.dropped.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	slot->source = queue;
+	slot->timens = timens;
+	slot->startns = startns;
+	slot->sequence = sequence;
+	slot->dataType = dataType;
+	slot->count = (unsigned int)rssiData.size();
+	kernelQuantize8(rssiData.data(), slot->points, slot->count);
+	q.ring.commit();
+
+	cv.notify_one();
+	return true;
+}
+
+
+// Hands on at most one frame from each queue.  Returns false if all were empty.
+bool FrameWriter::drainRound() {
+	bool any = false;
+	for (size_t q = 0; q < queues.size(); q++) {
+		RssiFrame *frame = queues[q]->ring.acquire();
+		if (frame != nullptr) {
+			handler(*frame);
+			queues[q]->ring.release(frame);
+			any = true;
+		}
+	}
+	return any;
+}
+
+
+void FrameWriter::threadMain() {
+	for (;;) {
+		while (drainRound())
+			;
+
+		if (idleHandler)
+			idleHandler();
+
+		if (!running.load())
+			break;
+
+		// The producer does not take the mutex, so a wakeup can slip past us;
+		// the timeout bounds how long that frame waits.
+		std::unique_lock<std::mutex> lock(mtx);
+		drains++;
+		drained.notify_all();
+		// no sleeping while sync() waits for the next drain
+		if (syncs == 0)
+			cv.wait_for(lock, std::chrono::milliseconds(idleIntervalMs));
+	}
+
+	// drain anything pushed while we were shutting down
+	while (drainRound())
+		;
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "WiPryClarity.h"
+#include "ring.h"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+
+    FrameWriter
+
+    Decouples the libWiPryClarity data thread from formatting and I/O.  The
+    delegate callback only quantizes the sweep into a pooled frame of a
+    PooledRing and stamps it; a dedicated writer thread hands each frame to
+    the handler, which does the formatting and writing, straight out of the
+    pool and gives it back afterwards.  Once started nothing is allocated
+    per sweep.
+
+    Frames hold whole dB as int8, the resolution the line protocol writes,
+    so that a queued frame takes a quarter of the memory of the library's
+    floats and the stages after the queue read a quarter of the bytes.
+
+    With several devices each one gets its own queue, so a busy device can
+    only overflow its own ring.  The writer takes one frame from each queue in
+    turn, so no device waits behind another's backlog.
+
+*/
+
+
+// Largest sweep accepted from the library, in points.
+#define WIPRY_MAX_POINTS 4096
+
+
+struct RssiFrame {
+	int8_t points[WIPRY_MAX_POINTS];	// dBm truncated and clamped to -128..127, first so it starts a cache line
+	unsigned int source;		// queue the frame came through
+	long long timens;			// wall clock, the end of the sweep
+	long long startns;			// the start of the sweep
+	unsigned long long sequence;	// per band, skips the sweeps known to be missing
+	oscium::WiPryClarity::DataType dataType;
+	unsigned int count;
+};
+
+
+class FrameWriter {
+public:
+	typedef std::function<void(const RssiFrame &)> Handler;
+	typedef std::function<void()> IdleHandler;
+
+	// queues rings of capacity frames each.
+	FrameWriter(size_t capacity, OverflowPolicy policy, Handler handler, unsigned int queues = 1);
+	~FrameWriter();
+
+	// Called on the writer thread whenever the ring runs empty, and at least
+	// every intervalMs while it stays empty.  Set before start().
+	void setIdleHandler(IdleHandler idleHandler, unsigned int intervalMs);
+
+	void start();
+
+	// Stops the writer thread after it has drained every queued frame.
+	void stop();
+
+	// Waits until the writer thread has handled every frame pushed before the
+	// call.  With the producers of a queue stopped, its handler state can be
+	// changed from the calling thread afterwards.
+	void sync();
+
+	// Called from the library's data thread.  Never blocks and never allocates.
+	// Returns false if this frame was dropped.  Each queue takes frames from
+	// one thread only.
+	bool push(unsigned int queue, oscium::WiPryClarity::DataType dataType, const std::vector<float> &rssiData, long long timens,
+		long long startns = 0, unsigned long long sequence = 0);
+	bool push(oscium::WiPryClarity::DataType dataType, const std::vector<float> &rssiData, long long timens) {
+		return push(0, dataType, rssiData, timens);
+	}
+
+	unsigned int queueCount() const { return (unsigned int)queues.size(); }
+	unsigned long long droppedFrames() const;
+	unsigned long long droppedFrames(unsigned int queue) const { return queues[queue]->dropped.load(std::memory_order_relaxed); }
+	size_t queueDepth() const;
+	// Bytes of the preallocated frames of every queue.
+	size_t poolBytes() const;
+
+private:
+	struct Queue {
+		explicit Queue(size_t capacity) : ring(capacity), dropped(0) {}
+		PooledRing<RssiFrame> ring;
+		std::atomic<unsigned long long> dropped;
+	};
+
+	void threadMain();
+	bool drainRound();
+
+	std::vector<std::unique_ptr<Queue>> queues;
+	OverflowPolicy policy;
+	Handler handler;
+	IdleHandler idleHandler;
+	unsigned int idleIntervalMs;
+
+	std::thread thread;
+	std::atomic<bool> running;
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::condition_variable drained;
+	unsigned long long drains;		// times every queue ran empty, under mtx
+	unsigned int syncs;				// sync() calls waiting, under mtx
+};
@@ -0,0 +1,89 @@
+#include "zoom.h"
+#include <cmath>
+#include <cstdlib>
+
+
+// Half of a 20MHz channel.
+#define CHANNEL_HALF_WIDTH 10.0f
+
+
+bool ZoomRange::parse(const std::string &spec) {
+	char *end;
+	float low = strtof(spec.c_str(), &end);
+	if (end == spec.c_str() || *end != '-')
+		return false;
+	const char *next = end + 1;
+	float high = strtof(next, &end);
+	if (end == next || *end != 0 || high <= low)
+		return false;
+	lowMHz = low;
+	highMHz = high;
+	return true;
+}
+
+
+bool ZoomRange::parseChannels(const std::string &spec, unsigned int band) {
+	const char *p = spec.c_str();
+	float low = 0, high = 0;
+	while (*p != 0) {
+		char *end;
+		long channel = strtol(p, &end, 10);
+		if (end == p || (*end != ',' && *end != 0) || channel <= 0)
+			return false;
+		float center = channelCenter(band, channel);
+		if (center == 0)
+			return false;
+		if (high == 0 || center - CHANNEL_HALF_WIDTH < low)
+			low = center - CHANNEL_HALF_WIDTH;
+		if (center + CHANNEL_HALF_WIDTH > high)
+			high = center + CHANNEL_HALF_WIDTH;
+		p = *end == ',' ? end + 1 : end;
+	}
+	if (high == 0)
+		return false;
+	lowMHz = low;
+	highMHz = high;
+	return true;
+}
+
+
+float channelCenter(unsigned int band, unsigned int channel) {
+	switch (band) {
+		case 2:
+			if (channel >= 1 && channel <= 13)
+				return 2407.0f + 5 * channel;
+			return channel == 14 ? 2484.0f : 0;
+		case 5:
+			return channel >= 32 && channel <= 177 ? 5000.0f + 5 * channel : 0;
+		case 6:
+			return channel >= 1 && channel <= 233 ? 5950.0f + 5 * channel : 0;
+		default:
+			return 0;
+	}
+}
+
+
+bool zoomWindow(const ZoomRange &range, float freqLow, float freqHigh, unsigned int count,
+	uint16_t &startIndex, uint16_t &width) {
+	if (count == 0 || freqHigh <= freqLow || range.highMHz <= freqLow || range.lowMHz >= freqHigh)
+		return false;
+
+	// bin p starts at freqLow + p * step, as in the line protocol keys
+	float step = (freqHigh - freqLow) / count;
+	long first = (long)floor((range.lowMHz - freqLow) / step);
+	long end = (long)ceil((range.highMHz - freqLow) / step);
+	if (first < 0)
+		first = 0;
+	if (end > (long)count)
+		end = count;
+	if (first > ZOOM_MAX_START)
+		return false;
+	if (end - first > ZOOM_MAX_WIDTH)
+		end = first + ZOOM_MAX_WIDTH;
+	if (end <= first)
+		return false;
+
+	startIndex = (uint16_t)first;
+	width = (uint16_t)(end - first);
+	return true;
+}
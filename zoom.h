@@ -0,0 +1,51 @@
+#pragma once
+
+#include "WiPryClarity.h"
+#include <stdint.h>
+#include <string>
+
+/*
+
+    Zoom
+
+    Narrows a sweep to part of a band.  The range is given in MHz or as a
+    list of Wi-Fi channels and is turned into the startIndex and width that
+    WiPryClarity::startRssiData() takes.  Those index the bins of the
+    unzoomed frame, so the bin count of the band has to be known first; a
+    zoomed frame still has that many bins, only the window is valid.
+
+*/
+
+
+// Widest window startRssiData() accepts, its width is 8 bits.
+#define ZOOM_MAX_WIDTH 255
+// Highest startIndex, 12 bits.
+#define ZOOM_MAX_START 0x0FFF
+
+
+struct ZoomRange {
+	float lowMHz;
+	float highMHz;
+
+	ZoomRange() : lowMHz(0), highMHz(0) {}
+
+	bool empty() const { return highMHz <= lowMHz; }
+
+	// "5170-5250", MHz.
+	bool parse(const std::string &spec);
+
+	// "36,40,44": the span from the lower edge of the lowest channel to the
+	// upper edge of the highest, 20MHz channels of the given band (2, 5 or 6).
+	bool parseChannels(const std::string &spec, unsigned int band);
+};
+
+
+// Center frequency of a channel in MHz, 0 if the channel does not exist in the band.
+float channelCenter(unsigned int band, unsigned int channel);
+
+
+// Bins [startIndex, startIndex + width) of a count-bin sweep from freqLow to
+// freqHigh that cover range, clipped to the band and to ZOOM_MAX_WIDTH.
+// Returns false if the range misses the band.
+bool zoomWindow(const ZoomRange &range, float freqLow, float freqHigh, unsigned int count,
+	uint16_t &startIndex, uint16_t &width);